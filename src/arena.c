@@ -0,0 +1,82 @@
+/* arena - Growable region allocator for record storage
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ngscmd.h"
+#include "arena.h"
+
+/* Keep every allocation aligned for any pointer or integer type */
+#define ARENA_ALIGN(n) (((n) + 15) & ~((size_t) 15))
+
+/* Initialize an empty arena */
+
+void
+arena_init (ngs_arena *a, size_t chunk_size)
+{
+  a->head = NULL;
+  a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+  a->total = 0;
+}
+
+/* Carve len bytes out of the arena, adding a chunk when the
+   current one is full-- a request larger than the chunk size
+   gets a chunk of its own */
+
+void *
+arena_alloc (ngs_arena *a, size_t len)
+{
+  size_t cap = 0;
+  arena_chunk *c = a->head;
+  void *ptr = NULL;
+
+  len = ARENA_ALIGN (len);
+  if ((c == NULL) || (c->cap - c->len < len))
+    {
+      cap = (len > a->chunk_size) ? len : a->chunk_size;
+      c = (arena_chunk *) malloc (ARENA_ALIGN (sizeof (arena_chunk)) + cap);
+      if (c == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for record "
+                 "arena.\n\n", stderr);
+          abort ();
+        }
+      c->len = 0;
+      c->cap = cap;
+      c->next = a->head;
+      a->head = c;
+    }
+
+  ptr = (char *) c + ARENA_ALIGN (sizeof (arena_chunk)) + c->len;
+  c->len += len;
+  a->total += len;
+
+  return ptr;
+}
+
+/* Release all chunks held by the arena */
+
+void
+arena_free (ngs_arena *a)
+{
+  arena_chunk *c = NULL;
+
+  while (a->head != NULL)
+    {
+      c = a->head;
+      a->head = c->next;
+      free (c);
+    }
+  a->total = 0;
+}
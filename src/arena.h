@@ -0,0 +1,56 @@
+/* arena - Growable region allocator for record storage
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define ARENA_CHUNK_SIZE 0x1000000
+
+  typedef struct _arena_chunk
+  {
+    struct _arena_chunk *next;
+    size_t len;          /* bytes handed out from this chunk */
+    size_t cap;          /* usable bytes in this chunk */
+  } arena_chunk;
+
+  /* A list of large chunks that small allocations are carved from--
+     everything is released at once by arena_free */
+  typedef struct _ngs_arena
+  {
+    arena_chunk *head;
+    size_t chunk_size;
+    size_t total;        /* bytes handed out over all chunks */
+  } ngs_arena;
+
+
+/* Function prototypes */
+  extern void arena_init (ngs_arena *, size_t);
+  extern void *arena_alloc (ngs_arena *, size_t);
+  extern void arena_free (ngs_arena *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* ARENA_H */
@@ -0,0 +1,1325 @@
+/* bgzf - Blocked gzip streams compressed and decompressed on a pool
+   of threads
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ngscmd.h"
+#include "bgzf.h"
+#include "gzindex.h"
+
+/* The empty block that marks the end of a BGZF file */
+static const unsigned char bgzf_eof[28] = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+  0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00
+};
+
+/* One block of the output stream */
+typedef struct _bgzf_block
+{
+  unsigned char data[BGZF_BLOCK_SIZE];     /* uncompressed bytes */
+  unsigned char out[BGZF_MAX_BLOCK_SIZE];  /* compressed member */
+  size_t len;
+  size_t out_len;
+  int done;                                /* the member is compressed */
+} bgzf_block;
+
+struct _bgzf_writer
+{
+  FILE *fp;
+  const char *name;            /* file name used in error messages */
+  int format;                  /* BGZF_FORMAT_PLAIN, _GZ or _BGZF */
+  int level;                   /* zlib compression level */
+  z_stream zs;                 /* deflate state of a single gzip member */
+  int nthreads;                /* compression threads, 0 when serial */
+  bgzf_block *ring;            /* blocks being filled, compressed or written */
+  int nring;
+  unsigned long long filled;   /* blocks handed to the compressors */
+  unsigned long long taken;    /* blocks picked up by a compressor */
+  unsigned long long written;  /* blocks written to the file */
+  int closing;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cv;      /* a block was handed to the compressors */
+  pthread_cond_t done_cv;      /* a compressor finished a block */
+};
+
+static void bgzf_compress (bgzf_writer *, bgzf_block *);
+static void bgzf_deflate (bgzf_writer *, bgzf_block *, int);
+static void bgzf_submit (bgzf_writer *);
+static void bgzf_flush (bgzf_writer *, int);
+static void *bgzf_worker (void *);
+
+/* Open an output file in the given format-- BGZF output is compressed
+   at the given zlib level on nthreads threads, a single gzip member
+   on the calling thread.  The name "-" is the standard output.
+   Returns NULL if the file cannot be opened */
+
+bgzf_writer *
+bgzf_open (const char *name, int format, int level, int nthreads)
+{
+  int i = 0;
+  bgzf_writer *w = NULL;
+
+  w = (bgzf_writer *) calloc (1, sizeof (bgzf_writer));
+  if (w == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for BGZF output "
+             "stream.\n\n", stderr);
+      abort ();
+    }
+
+  if (strcmp (name, "-") == 0)
+    w->fp = stdout;
+  else if ((w->fp = fopen (name, "wb")) == NULL)
+    {
+      free (w);
+      return NULL;
+    }
+  w->name = name;
+  w->format = format;
+  w->level = level;
+  w->nthreads = ((format == BGZF_FORMAT_BGZF) && (nthreads > 1)) ?
+    nthreads : 0;
+
+  if ((format == BGZF_FORMAT_GZ) &&
+      (deflateInit2 (&w->zs, level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK))
+    {
+      fputs ("\n\nError: cannot initialize the compressor.\n\n", stderr);
+      abort ();
+    }
+
+  /* Keep enough blocks in flight that every compressor stays
+     busy while the calling thread waits on the oldest one */
+  w->nring = w->nthreads ? 4 * w->nthreads : 1;
+  w->ring = (bgzf_block *) calloc (w->nring, sizeof (bgzf_block));
+  if (w->ring == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for BGZF output "
+             "stream.\n\n", stderr);
+      abort ();
+    }
+
+  if (w->nthreads)
+    {
+      pthread_mutex_init (&w->lock, NULL);
+      pthread_cond_init (&w->work_cv, NULL);
+      pthread_cond_init (&w->done_cv, NULL);
+      w->threads = (pthread_t *) malloc (w->nthreads * sizeof (pthread_t));
+      if (w->threads == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for BGZF output "
+                 "stream.\n\n", stderr);
+          abort ();
+        }
+      for (i = 0; i < w->nthreads; ++i)
+        {
+          if (pthread_create (&w->threads[i], NULL, bgzf_worker, w) != 0)
+            {
+              fputs ("\n\nError: cannot create a compression thread.\n\n",
+                     stderr);
+              abort ();
+            }
+        }
+    }
+
+  return w;
+}
+
+/* Append len bytes to the output stream */
+
+void
+bgzf_write (bgzf_writer *w, const char *s, size_t len)
+{
+  size_t n = 0;
+  bgzf_block *b = NULL;
+
+  /* Uncompressed output goes straight to the stream buffer */
+  if (w->format == BGZF_FORMAT_PLAIN)
+    {
+      if (fwrite (s, 1, len, w->fp) != len)
+        {
+          fprintf (stderr, "\n\nError: cannot write to the output fastQ "
+                   "file: %s.\n", w->name);
+          abort ();
+        }
+      return;
+    }
+
+  while (len > 0)
+    {
+      b = &w->ring[w->filled % w->nring];
+      n = BGZF_BLOCK_SIZE - b->len;
+      if (n > len)
+        n = len;
+      memcpy (b->data + b->len, s, n);
+      b->len += n;
+      s += n;
+      len -= n;
+      if (b->len == BGZF_BLOCK_SIZE)
+        bgzf_submit (w);
+    }
+}
+
+/* Compress the remaining data, write the end-of-file marker
+   and close the output stream */
+
+void
+bgzf_close (bgzf_writer *w)
+{
+  int i = 0;
+  int ret = 0;
+
+  if (w->format == BGZF_FORMAT_GZ)
+    {
+      bgzf_deflate (w, &w->ring[0], Z_FINISH);
+      deflateEnd (&w->zs);
+    }
+  else if (w->ring[w->filled % w->nring].len > 0)
+    bgzf_submit (w);
+  bgzf_flush (w, 1);
+
+  if (w->nthreads)
+    {
+      pthread_mutex_lock (&w->lock);
+      w->closing = 1;
+      pthread_cond_broadcast (&w->work_cv);
+      pthread_mutex_unlock (&w->lock);
+      for (i = 0; i < w->nthreads; ++i)
+        pthread_join (w->threads[i], NULL);
+      pthread_mutex_destroy (&w->lock);
+      pthread_cond_destroy (&w->work_cv);
+      pthread_cond_destroy (&w->done_cv);
+      free (w->threads);
+    }
+
+  if (w->format == BGZF_FORMAT_BGZF)
+    ret = fwrite (bgzf_eof, 1, sizeof (bgzf_eof), w->fp) != sizeof (bgzf_eof);
+  if (w->fp == stdout)
+    ret |= fflush (w->fp) != 0;
+  else
+    ret |= fclose (w->fp) != 0;
+  if (ret)
+    {
+      fprintf (stderr, "\n\nError: cannot write to the output fastQ file: "
+               "%s.\n", w->name);
+      abort ();
+    }
+
+  free (w->ring);
+  free (w);
+}
+
+/* Hand the block being filled to the compressors and make
+   sure the next block in the ring is free to fill */
+
+static void
+bgzf_submit (bgzf_writer *w)
+{
+  bgzf_block *b = &w->ring[w->filled % w->nring];
+
+  if (w->format == BGZF_FORMAT_GZ)
+    {
+      bgzf_deflate (w, b, Z_NO_FLUSH);
+      return;
+    }
+  if (w->nthreads == 0)
+    {
+      bgzf_compress (w, b);
+      ++w->filled;
+      bgzf_flush (w, 0);
+      return;
+    }
+
+  pthread_mutex_lock (&w->lock);
+  b->done = 0;
+  ++w->filled;
+  pthread_cond_signal (&w->work_cv);
+  pthread_mutex_unlock (&w->lock);
+
+  /* Write whatever is finished, waiting only when the ring is full */
+  bgzf_flush (w, 0);
+  if (w->filled - w->written == (unsigned long long) w->nring)
+    {
+      pthread_mutex_lock (&w->lock);
+      while (!w->ring[w->written % w->nring].done)
+        pthread_cond_wait (&w->done_cv, &w->lock);
+      pthread_mutex_unlock (&w->lock);
+      bgzf_flush (w, 0);
+    }
+}
+
+/* Write compressed blocks in order-- if wait is set, block until
+   every submitted block has been written */
+
+static void
+bgzf_flush (bgzf_writer *w, int wait)
+{
+  int done = 0;
+  bgzf_block *b = NULL;
+
+  while (w->written < w->filled)
+    {
+      b = &w->ring[w->written % w->nring];
+      if (w->nthreads)
+        {
+          pthread_mutex_lock (&w->lock);
+          while (wait && !b->done)
+            pthread_cond_wait (&w->done_cv, &w->lock);
+          done = b->done;
+          pthread_mutex_unlock (&w->lock);
+          if (!done)
+            break;
+        }
+      if (fwrite (b->out, 1, b->out_len, w->fp) != b->out_len)
+        {
+          fprintf (stderr, "\n\nError: cannot write to the output fastQ "
+                   "file: %s.\n", w->name);
+          abort ();
+        }
+      b->len = 0;
+      ++w->written;
+    }
+}
+
+/* Compression thread-- compress blocks in the order they were filled */
+
+static void *
+bgzf_worker (void *arg)
+{
+  bgzf_writer *w = (bgzf_writer *) arg;
+  bgzf_block *b = NULL;
+
+  while (1)
+    {
+      pthread_mutex_lock (&w->lock);
+      while ((w->taken == w->filled) && !w->closing)
+        pthread_cond_wait (&w->work_cv, &w->lock);
+      if (w->taken == w->filled)
+        {
+          pthread_mutex_unlock (&w->lock);
+          break;
+        }
+      b = &w->ring[w->taken++ % w->nring];
+      pthread_mutex_unlock (&w->lock);
+
+      bgzf_compress (w, b);
+
+      pthread_mutex_lock (&w->lock);
+      b->done = 1;
+      pthread_cond_broadcast (&w->done_cv);
+      pthread_mutex_unlock (&w->lock);
+    }
+
+  return NULL;
+}
+
+/* Store a 16-bit or 32-bit little-endian integer */
+#define PUT16(p, v) { (p)[0] = (v) & 0xff; (p)[1] = ((v) >> 8) & 0xff; }
+#define PUT32(p, v) { PUT16 (p, (v) & 0xffff); PUT16 ((p) + 2, (v) >> 16); }
+
+/* Compress one block into a self-contained gzip member */
+
+static void
+bgzf_compress (bgzf_writer *w, bgzf_block *b)
+{
+  int ret = 0;
+  int level = w->level;
+  unsigned long crc = 0;
+  z_stream zs;
+
+  while (1)
+    {
+      memset (&zs, 0, sizeof (z_stream));
+      if (deflateInit2 (&zs, level, Z_DEFLATED, -15, 8,
+                        Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+          fputs ("\n\nError: cannot initialize the compressor.\n\n", stderr);
+          abort ();
+        }
+      zs.next_in = b->data;
+      zs.avail_in = (uInt) b->len;
+      zs.next_out = b->out + BGZF_HEADER_SIZE;
+      zs.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+      ret = deflate (&zs, Z_FINISH);
+      deflateEnd (&zs);
+      if (ret == Z_STREAM_END)
+        break;
+
+      /* Data that does not compress always fits when stored */
+      if ((ret != Z_OK) || (level == 0))
+        {
+          fputs ("\n\nError: cannot compress the output stream.\n\n", stderr);
+          abort ();
+        }
+      level = 0;
+    }
+
+  b->out_len = BGZF_HEADER_SIZE + zs.total_out + BGZF_FOOTER_SIZE;
+
+  /* gzip header with the BC extra field holding the member size */
+  memcpy (b->out, bgzf_eof, BGZF_HEADER_SIZE);
+  PUT16 (b->out + 16, b->out_len - 1);
+
+  /* gzip footer */
+  crc = crc32 (crc32 (0L, Z_NULL, 0), b->data, (uInt) b->len);
+  PUT32 (b->out + b->out_len - 8, crc);
+  PUT32 (b->out + b->out_len - 4, b->len);
+}
+
+/* Feed a block to the single gzip member and write what comes out */
+
+static void
+bgzf_deflate (bgzf_writer *w, bgzf_block *b, int flush)
+{
+  int ret = 0;
+  size_t n = 0;
+
+  w->zs.next_in = b->data;
+  w->zs.avail_in = (uInt) b->len;
+  do
+    {
+      w->zs.next_out = b->out;
+      w->zs.avail_out = BGZF_MAX_BLOCK_SIZE;
+      ret = deflate (&w->zs, flush);
+      n = BGZF_MAX_BLOCK_SIZE - w->zs.avail_out;
+      if ((ret == Z_STREAM_ERROR) || (fwrite (b->out, 1, n, w->fp) != n))
+        {
+          fprintf (stderr, "\n\nError: cannot write to the output fastQ "
+                   "file: %s.\n", w->name);
+          abort ();
+        }
+    }
+  while (w->zs.avail_out == 0);
+  b->len = 0;
+}
+
+/* Ways of turning the input file into decompressed bytes */
+enum
+{
+  IN_RAW,        /* uncompressed-- copied through */
+  IN_STREAM,     /* gzip inflated on the calling thread */
+  IN_BLOCKS,     /* BGZF blocks inflated on a pool of threads */
+  IN_MEMBERS,    /* gzip members inflated on a pool of threads */
+  IN_INDEX       /* one gzip member split at the checkpoints of its index */
+};
+
+/* States of an inflate job */
+enum
+{
+  JOB_PENDING,
+  JOB_OK,
+  JOB_BAD,       /* the chunk did not hold whole, valid members */
+  JOB_STOP       /* no more chunks-- the rest is inflated serially */
+};
+
+/* A chunk of whole gzip members and its decompressed bytes */
+typedef struct _inflate_job
+{
+  unsigned char *in;
+  size_t in_len;
+  size_t in_cap;
+  unsigned char *out;
+  size_t out_len;
+  size_t out_cap;
+  int state;
+  const gzi_point *from;       /* checkpoint the chunk starts at, if any */
+  size_t want;                 /* bytes up to the next checkpoint, 0 if last */
+  unsigned long crc;           /* checksum of the output of a checkpoint */
+  unsigned char trailer[8];    /* gzip footer after the last checkpoint */
+} inflate_job;
+
+struct _bgzf_reader
+{
+  int fd;
+  const char *name;            /* file name used in error messages */
+  int mode;
+  int eof;                     /* the file has been read to the end */
+  unsigned char *buf;          /* compressed bytes read ahead of the chunks */
+  unsigned long long buf_off;  /* file offset of buf[0] */
+  size_t buf_pos;
+  size_t buf_len;
+  size_t buf_cap;
+  z_stream zs;                 /* serial inflate state */
+  int in_member;               /* the serial inflate is inside a member */
+  int stream_end;              /* nothing but trailing garbage is left */
+  int nthreads;
+  pthread_t *threads;
+  inflate_job *ring;
+  int nring;
+  unsigned long long submitted;  /* chunks cut from the input */
+  unsigned long long taken;      /* chunks picked up by an inflater */
+  unsigned long long consumed;   /* chunks handed to the caller */
+  int stopped;                 /* a JOB_STOP chunk has been submitted */
+  int closing;
+  inflate_job *cur;            /* chunk being copied to the caller */
+  size_t cur_pos;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cv;      /* a chunk was cut for the inflaters */
+  pthread_cond_t done_cv;      /* an inflater finished a chunk */
+  gz_index *idx;               /* checkpoints of a single-member file */
+  size_t next_point;           /* first checkpoint not cut yet */
+  size_t skip;                 /* output ahead of the first record wanted */
+  int partial;                 /* started past the first checkpoint, so the
+                                  footer cannot be checked */
+  unsigned long crc;           /* checksum of the output so far */
+  unsigned long long length;   /* bytes of output so far */
+};
+
+static size_t bgzf_fill (bgzf_reader *, size_t);
+static void bgzf_cut (bgzf_reader *);
+static int bgzf_member_start (const unsigned char *);
+static void *bgzf_inflater (void *);
+static int bgzf_inflate_job (inflate_job *);
+static int bgzf_inflate_point (inflate_job *);
+static void bgzf_check_point (bgzf_reader *, inflate_job *);
+static void bgzf_serial (bgzf_reader *);
+static size_t bgzf_stream_read (bgzf_reader *, char *, size_t);
+
+/* Read a 16-bit little-endian integer */
+#define GET16(p) ((p)[0] | ((p)[1] << 8))
+
+/* Open a possibly compressed input file-- BGZF, multi-member gzip
+   and indexed gzip files are inflated on nthreads threads, anything
+   else serially.  The name "-" is the standard input.  An indexed file
+   starts at the last checkpoint that reaches fastQ record *first, and
+   *first is set to the number of the record the output starts with--
+   0 for any other file.  Returns NULL if the file cannot be opened */
+
+bgzf_reader *
+bgzf_ropen (const char *name, int nthreads, unsigned long long *first)
+{
+  int i = 0;
+  size_t avail = 0;
+  off_t at = 0;
+  struct stat st;
+  bgzf_reader *r = NULL;
+  const gzi_point *pt = NULL;
+
+  r = (bgzf_reader *) calloc (1, sizeof (bgzf_reader));
+  if (r == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for input stream.\n\n",
+             stderr);
+      abort ();
+    }
+
+  if (strcmp (name, "-") == 0)
+    r->fd = STDIN_FILENO;
+  else if ((r->fd = open (name, O_RDONLY)) < 0)
+    {
+      free (r);
+      return NULL;
+    }
+  r->name = name;
+
+  /* Look at the first member header */
+  avail = bgzf_fill (r, BGZF_HEADER_SIZE);
+  if ((avail < 2) || (r->buf[0] != 0x1f) || (r->buf[1] != 0x8b))
+    {
+      *first = 0;
+      r->mode = IN_RAW;
+      return r;
+    }
+
+  /* BGZF marks every member with its compressed size, while a
+     single member needs the checkpoints written by ngscmd index--
+     which also let a single thread start near a record */
+  if (((nthreads > 1) || (*first > 0)) && (r->fd != STDIN_FILENO) &&
+      (fstat (r->fd, &st) == 0) && S_ISREG (st.st_mode) &&
+      ((r->idx = gzi_load (name, st.st_size, st.st_mtime)) != NULL) &&
+      (r->idx->n > 1))
+    r->mode = IN_INDEX;
+  else if (nthreads < 2)
+    {
+      *first = 0;
+      bgzf_serial (r);
+      return r;
+    }
+  else if ((avail >= BGZF_HEADER_SIZE) && (r->buf[3] & 0x4) &&
+      (GET16 (r->buf + 10) == 6) && (r->buf[12] == 'B') &&
+      (r->buf[13] == 'C') && (GET16 (r->buf + 14) == 2))
+    r->mode = IN_BLOCKS;
+  else
+    r->mode = IN_MEMBERS;
+
+  /* Start reading at the checkpoint of the first record wanted, and
+     pass over the output ahead of that record */
+  if ((r->mode == IN_INDEX) && (*first > 0))
+    {
+      r->next_point = gzi_find_record (r->idx, *first);
+      pt = &r->idx->list[r->next_point];
+      at = (off_t) (pt->in - (pt->bits ? 1 : 0));
+      if (lseek (r->fd, at, SEEK_SET) != at)
+        {
+          fprintf (stderr, "\n\nError: cannot seek in the input file: "
+                   "%s.\n\n", name);
+          abort ();
+        }
+      r->buf_off = (unsigned long long) at;
+      r->buf_pos = r->buf_len = 0;
+      r->skip = (size_t) (pt->rec_out - pt->out);
+      r->partial = (r->next_point > 0);
+      *first = pt->rec;
+    }
+  else
+    *first = 0;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  r->nthreads = nthreads;
+  r->nring = 2 * nthreads;
+  r->ring = (inflate_job *) calloc (r->nring, sizeof (inflate_job));
+  r->threads = (pthread_t *) malloc (nthreads * sizeof (pthread_t));
+  if ((r->ring == NULL) || (r->threads == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for input stream.\n\n",
+             stderr);
+      abort ();
+    }
+  pthread_mutex_init (&r->lock, NULL);
+  pthread_cond_init (&r->work_cv, NULL);
+  pthread_cond_init (&r->done_cv, NULL);
+
+  /* Cut the first chunks before starting the inflaters */
+  for (i = 0; i < r->nring; ++i)
+    bgzf_cut (r);
+  for (i = 0; i < nthreads; ++i)
+    {
+      if (pthread_create (&r->threads[i], NULL, bgzf_inflater, r) != 0)
+        {
+          fputs ("\n\nError: cannot create a decompression thread.\n\n",
+                 stderr);
+          abort ();
+        }
+    }
+
+  return r;
+}
+
+/* Read up to len decompressed bytes-- returns the number of bytes
+   read, zero at the end of the input */
+
+size_t
+bgzf_read (bgzf_reader *r, char *s, size_t len)
+{
+  size_t n = 0;
+  size_t total = 0;
+  ssize_t ret = 0;
+  inflate_job *job = NULL;
+
+  while (len > 0)
+    {
+      if (r->mode == IN_STREAM)
+        return total + bgzf_stream_read (r, s, len);
+
+      if (r->mode == IN_RAW)
+        {
+          /* Hand out what was read ahead, then read straight
+             into the caller's buffer */
+          if (r->buf_pos < r->buf_len)
+            {
+              n = r->buf_len - r->buf_pos;
+              n = (n < len) ? n : len;
+              memcpy (s, r->buf + r->buf_pos, n);
+              r->buf_pos += n;
+            }
+          else
+            {
+              do
+                ret = read (r->fd, s, len);
+              while ((ret < 0) && (errno == EINTR));
+              if (ret < 0)
+                {
+                  fprintf (stderr, "\n\nError: cannot read from the input "
+                           "file: %s.\n\n", r->name);
+                  abort ();
+                }
+              if (ret == 0)
+                break;
+              n = (size_t) ret;
+            }
+          s += n;
+          len -= n;
+          total += n;
+          continue;
+        }
+
+      /* Copy out of the current chunk */
+      if ((r->cur != NULL) && (r->cur_pos < r->cur->out_len))
+        {
+          n = r->cur->out_len - r->cur_pos;
+          n = (n < len) ? n : len;
+          memcpy (s, r->cur->out + r->cur_pos, n);
+          r->cur_pos += n;
+          s += n;
+          len -= n;
+          total += n;
+          continue;
+        }
+
+      /* Recycle the finished chunk for the next cut */
+      if (r->cur != NULL)
+        {
+          r->cur = NULL;
+          pthread_mutex_lock (&r->lock);
+          ++r->consumed;
+          pthread_mutex_unlock (&r->lock);
+          bgzf_cut (r);
+        }
+      if (r->consumed == r->submitted)
+        break;
+
+      /* Wait for the next chunk in input order */
+      job = &r->ring[r->consumed % r->nring];
+      pthread_mutex_lock (&r->lock);
+      while (job->state == JOB_PENDING)
+        pthread_cond_wait (&r->done_cv, &r->lock);
+      pthread_mutex_unlock (&r->lock);
+
+      if (job->state == JOB_OK)
+        {
+          if (r->mode == IN_INDEX)
+            bgzf_check_point (r, job);
+          r->cur = job;
+          r->cur_pos = (r->skip < job->out_len) ? r->skip : job->out_len;
+          r->skip -= r->cur_pos;
+        }
+      else if (r->mode == IN_INDEX)
+        {
+          fprintf (stderr, "\n\nError: corrupt gzip data or stale index "
+                   "for the input file: %s.\n\n", r->name);
+          abort ();
+        }
+      else
+        bgzf_serial (r);
+    }
+
+  return total;
+}
+
+/* Close an input file */
+
+void
+bgzf_rclose (bgzf_reader *r)
+{
+  int i = 0;
+
+  if (r == NULL)
+    return;
+
+  if (r->nthreads && (r->mode != IN_STREAM))
+    {
+      pthread_mutex_lock (&r->lock);
+      r->closing = 1;
+      pthread_cond_broadcast (&r->work_cv);
+      pthread_mutex_unlock (&r->lock);
+      for (i = 0; i < r->nthreads; ++i)
+        pthread_join (r->threads[i], NULL);
+    }
+  if (r->nthreads)
+    {
+      for (i = 0; i < r->nring; ++i)
+        {
+          free (r->ring[i].in);
+          free (r->ring[i].out);
+        }
+      pthread_mutex_destroy (&r->lock);
+      pthread_cond_destroy (&r->work_cv);
+      pthread_cond_destroy (&r->done_cv);
+      free (r->ring);
+      free (r->threads);
+    }
+  if (r->mode == IN_STREAM)
+    inflateEnd (&r->zs);
+  gzi_free (r->idx);
+
+  if (r->fd != STDIN_FILENO)
+    close (r->fd);
+  free (r->buf);
+  free (r);
+}
+
+/* Make sure at least want compressed bytes are read ahead, unless
+   the file ends first-- returns the number of bytes read ahead */
+
+static size_t
+bgzf_fill (bgzf_reader *r, size_t want)
+{
+  ssize_t ret = 0;
+
+  if ((r->buf_len - r->buf_pos >= want) || r->eof)
+    return r->buf_len - r->buf_pos;
+
+  /* Move the unread bytes to the front and make room */
+  memmove (r->buf, r->buf + r->buf_pos, r->buf_len - r->buf_pos);
+  r->buf_off += r->buf_pos;
+  r->buf_len -= r->buf_pos;
+  r->buf_pos = 0;
+  if (r->buf_cap < want + BGZF_CHUNK_SIZE)
+    {
+      r->buf_cap = want + BGZF_CHUNK_SIZE;
+      if ((r->buf = (unsigned char *) realloc (r->buf, r->buf_cap)) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for input "
+                 "stream.\n\n", stderr);
+          abort ();
+        }
+    }
+
+  while (!r->eof && (r->buf_len < want))
+    {
+      ret = read (r->fd, r->buf + r->buf_len, r->buf_cap - r->buf_len);
+      if ((ret < 0) && (errno == EINTR))
+        continue;
+      if (ret < 0)
+        {
+          fprintf (stderr, "\n\nError: cannot read from the input file: "
+                   "%s.\n\n", r->name);
+          abort ();
+        }
+      if (ret == 0)
+        r->eof = 1;
+      r->buf_len += ret;
+    }
+
+  return r->buf_len;
+}
+
+/* Return nonzero if p looks like the start of a gzip member */
+
+static int
+bgzf_member_start (const unsigned char *p)
+{
+  return (p[0] == 0x1f) && (p[1] == 0x8b) && (p[2] == 8) &&
+    ((p[3] & 0xe0) == 0) && ((p[8] == 0) || (p[8] == 2) || (p[8] == 4)) &&
+    ((p[9] <= 13) || (p[9] == 255));
+}
+
+/* Cut the next chunk of whole members off the read-ahead buffer and
+   hand it to the inflaters-- a chunk that cannot be cut ends the
+   parallel part of the input with a JOB_STOP chunk */
+
+static void
+bgzf_cut (bgzf_reader *r)
+{
+  size_t n = 0;
+  size_t bsize = 0;
+  size_t avail = 0;
+  size_t from = 0;
+  size_t skip = 0;
+  size_t keep = 0;
+  unsigned char *hit = NULL;
+  inflate_job *job = NULL;
+  const gzi_point *pt = NULL;
+  int state = JOB_PENDING;
+
+  if (r->stopped)
+    return;
+
+  if (r->mode == IN_INDEX)
+    {
+      /* Cut from one checkpoint to the next-- when a deflate block
+         starts inside a byte, the two chunks share that byte */
+      if (r->next_point == r->idx->n)
+        return;
+      pt = &r->idx->list[r->next_point++];
+      skip = pt->in - (pt->bits ? 1 : 0) - (r->buf_off + r->buf_pos);
+      if (r->next_point < r->idx->n)
+        {
+          n = r->idx->list[r->next_point].in - pt->in + (pt->bits ? 1 : 0);
+          keep = r->idx->list[r->next_point].bits ? 1 : 0;
+          avail = bgzf_fill (r, skip + n);
+        }
+      else
+        {
+          while (!r->eof)
+            bgzf_fill (r, r->buf_len - r->buf_pos + BGZF_CHUNK_SIZE);
+          avail = r->buf_len - r->buf_pos;
+          n = (avail > skip) ? avail - skip : 0;
+        }
+      if ((avail < skip + n) || (n == 0))
+        {
+          fprintf (stderr, "\n\nError: the index does not match the input "
+                   "file: %s.\n\n", r->name);
+          abort ();
+        }
+      r->buf_pos += skip;
+    }
+  else if (r->mode == IN_BLOCKS)
+    {
+      /* Walk the BGZF block sizes */
+      while (n < BGZF_CHUNK_SIZE)
+        {
+          avail = bgzf_fill (r, n + BGZF_HEADER_SIZE);
+          if (avail == n)
+            break;
+          if ((avail < n + BGZF_HEADER_SIZE) ||
+              !(r->buf[r->buf_pos + n + 3] & 0x4) ||
+              (r->buf[r->buf_pos + n + 12] != 'B') ||
+              (r->buf[r->buf_pos + n + 13] != 'C'))
+            {
+              /* Not a BGZF block-- inflate the rest serially */
+              if (n == 0)
+                state = JOB_STOP;
+              break;
+            }
+          bsize = GET16 (r->buf + r->buf_pos + n + 16) + 1;
+          if (bgzf_fill (r, n + bsize) < n + bsize)
+            {
+              if (n == 0)
+                state = JOB_STOP;
+              break;
+            }
+          n += bsize;
+        }
+    }
+  else
+    {
+      /* Cut at the first thing that looks like a member header past
+         the chunk size-- a false hit shows up as a bad chunk */
+      n = BGZF_CHUNK_SIZE;
+      while (1)
+        {
+          avail = bgzf_fill (r, n + BGZF_HEADER_SIZE);
+          if (avail < n + BGZF_HEADER_SIZE)
+            {
+              n = avail;
+              break;
+            }
+          hit = NULL;
+          for (from = n; from + BGZF_HEADER_SIZE <= avail; ++from)
+            {
+              hit = (unsigned char *) memchr (r->buf + r->buf_pos + from,
+                                              0x1f, avail
+                                              - BGZF_HEADER_SIZE - from + 1);
+              if (hit == NULL)
+                break;
+              from = hit - (r->buf + r->buf_pos);
+              if (bgzf_member_start (hit))
+                break;
+              hit = NULL;
+            }
+          if (hit != NULL)
+            {
+              n = from;
+              break;
+            }
+
+          /* A single large member cannot be split */
+          if (avail >= BGZF_SEARCH_SIZE)
+            {
+              n = 0;
+              state = JOB_STOP;
+              break;
+            }
+          n = avail - BGZF_HEADER_SIZE + 1;
+          bgzf_fill (r, 2 * avail);
+        }
+    }
+
+  if ((n == 0) && (state != JOB_STOP))
+    return;
+
+  /* Copy the chunk into the next free job */
+  job = &r->ring[r->submitted % r->nring];
+  if (job->in_cap < n)
+    {
+      job->in_cap = n;
+      if ((job->in = (unsigned char *) realloc (job->in, n)) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for input "
+                 "stream.\n\n", stderr);
+          abort ();
+        }
+    }
+  memcpy (job->in, r->buf + r->buf_pos, n);
+  job->in_len = n;
+  job->from = pt;
+  job->want = 0;
+  if ((pt != NULL) && (r->next_point < r->idx->n))
+    job->want = r->idx->list[r->next_point].out - pt->out;
+  r->buf_pos += n - keep;
+
+  pthread_mutex_lock (&r->lock);
+  job->state = state;
+  if (state == JOB_STOP)
+    r->stopped = 1;
+  ++r->submitted;
+  pthread_cond_signal (&r->work_cv);
+  pthread_mutex_unlock (&r->lock);
+}
+
+/* Inflater thread-- inflate chunks in the order they were cut, passing
+   over the JOB_STOP chunk left for the reading thread */
+
+static void *
+bgzf_inflater (void *arg)
+{
+  bgzf_reader *r = (bgzf_reader *) arg;
+  inflate_job *job = NULL;
+  int state = JOB_PENDING;
+
+  while (1)
+    {
+      pthread_mutex_lock (&r->lock);
+      while ((r->taken == r->submitted) && !r->closing)
+        pthread_cond_wait (&r->work_cv, &r->lock);
+      if (r->taken == r->submitted)
+        {
+          pthread_mutex_unlock (&r->lock);
+          break;
+        }
+      job = &r->ring[r->taken++ % r->nring];
+      state = job->state;
+      pthread_mutex_unlock (&r->lock);
+      if (state == JOB_STOP)
+        continue;
+
+      state = bgzf_inflate_job (job);
+
+      pthread_mutex_lock (&r->lock);
+      job->state = state;
+      pthread_cond_broadcast (&r->done_cv);
+      pthread_mutex_unlock (&r->lock);
+    }
+
+  return NULL;
+}
+
+/* Inflate every member of a chunk-- the chunk is bad unless the
+   last member ends exactly at the end of the chunk */
+
+static int
+bgzf_inflate_job (inflate_job *job)
+{
+  int ret = 0;
+  int state = JOB_BAD;
+  z_stream zs;
+
+  if (job->from != NULL)
+    return bgzf_inflate_point (job);
+  if (job->in_len == 0)
+    return JOB_BAD;
+
+  memset (&zs, 0, sizeof (z_stream));
+  if (inflateInit2 (&zs, 15 + 16) != Z_OK)
+    {
+      fputs ("\n\nError: cannot initialize the decompressor.\n\n", stderr);
+      abort ();
+    }
+  if (job->out_cap < 4 * job->in_len)
+    {
+      job->out_cap = 4 * job->in_len;
+      free (job->out);
+      if ((job->out = (unsigned char *) malloc (job->out_cap)) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for input "
+                 "stream.\n\n", stderr);
+          abort ();
+        }
+    }
+  job->out_len = 0;
+  zs.next_in = job->in;
+  zs.avail_in = (uInt) job->in_len;
+
+  while (1)
+    {
+      if (job->out_len == job->out_cap)
+        {
+          job->out_cap <<= 1;
+          job->out = (unsigned char *) realloc (job->out, job->out_cap);
+          if (job->out == NULL)
+            {
+              fputs ("\n\nError: memory allocation failure for input "
+                     "stream.\n\n", stderr);
+              abort ();
+            }
+        }
+      zs.next_out = job->out + job->out_len;
+      zs.avail_out = (uInt) (job->out_cap - job->out_len);
+      ret = inflate (&zs, Z_NO_FLUSH);
+      job->out_len = job->out_cap - zs.avail_out;
+
+      if (ret == Z_STREAM_END)
+        {
+          if (zs.avail_in == 0)
+            {
+              state = JOB_OK;
+              break;
+            }
+          inflateReset (&zs);
+        }
+      else if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+        break;
+      else if ((zs.avail_in == 0) && (zs.avail_out > 0))
+        break;
+    }
+  inflateEnd (&zs);
+
+  return state;
+}
+
+/* Inflate a chunk of one gzip member from a checkpoint-- the chunk is
+   bad unless it inflates to exactly the bytes up to the next checkpoint,
+   or for the last chunk to the end of the member */
+
+static int
+bgzf_inflate_point (inflate_job *job)
+{
+  int ret = 0;
+  int state = JOB_BAD;
+  size_t limit = 0;
+  uLongf len = GZI_WINSIZE;
+  unsigned char window[GZI_WINSIZE];
+  z_stream zs;
+
+  memset (&zs, 0, sizeof (z_stream));
+  if (inflateInit2 (&zs, -15) != Z_OK)
+    {
+      fputs ("\n\nError: cannot initialize the decompressor.\n\n", stderr);
+      abort ();
+    }
+  zs.next_in = job->in;
+  zs.avail_in = (uInt) job->in_len;
+
+  /* Restore the bits of the shared byte and the history window */
+  if (job->from->bits)
+    {
+      inflatePrime (&zs, job->from->bits,
+                    job->in[0] >> (8 - job->from->bits));
+      ++zs.next_in;
+      --zs.avail_in;
+    }
+  if (job->from->window_len > 0)
+    {
+      if ((uncompress (window, &len, job->from->window,
+                       job->from->window_len) != Z_OK) ||
+          (len != GZI_WINSIZE))
+        {
+          inflateEnd (&zs);
+          return JOB_BAD;
+        }
+      inflateSetDictionary (&zs, window, GZI_WINSIZE);
+    }
+
+  limit = job->want ? job->want : 4 * job->in_len;
+  if (job->out_cap < limit)
+    {
+      job->out_cap = limit;
+      free (job->out);
+      if ((job->out = (unsigned char *) malloc (job->out_cap)) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for input "
+                 "stream.\n\n", stderr);
+          abort ();
+        }
+    }
+  job->out_len = 0;
+
+  while (1)
+    {
+      if (!job->want && (job->out_len == job->out_cap))
+        {
+          job->out_cap <<= 1;
+          job->out = (unsigned char *) realloc (job->out, job->out_cap);
+          if (job->out == NULL)
+            {
+              fputs ("\n\nError: memory allocation failure for input "
+                     "stream.\n\n", stderr);
+              abort ();
+            }
+        }
+      limit = job->want ? job->want : job->out_cap;
+      zs.next_out = job->out + job->out_len;
+      zs.avail_out = (uInt) (limit - job->out_len);
+      ret = inflate (&zs, Z_NO_FLUSH);
+      job->out_len = limit - zs.avail_out;
+
+      if (job->want && (job->out_len == job->want))
+        {
+          state = JOB_OK;
+          break;
+        }
+      if (ret == Z_STREAM_END)
+        {
+          /* Keep the gzip footer for the reading thread to check */
+          if (!job->want && (zs.avail_in >= 8))
+            {
+              memcpy (job->trailer, zs.next_in, 8);
+              state = JOB_OK;
+            }
+          break;
+        }
+      if (((ret != Z_OK) && (ret != Z_BUF_ERROR)) ||
+          ((zs.avail_in == 0) && (zs.avail_out > 0)))
+        break;
+    }
+  inflateEnd (&zs);
+
+  job->crc = crc32 (crc32 (0L, Z_NULL, 0), job->out, (uInt) job->out_len);
+
+  return state;
+}
+
+/* Add an inflated checkpoint chunk to the running checksum, and check
+   it against the gzip footer at the end of the member-- unless the
+   reading started past the first checkpoint, so the checksum does not
+   cover the whole member.  Each chunk still has to inflate to exactly
+   the length the index gives it */
+
+static void
+bgzf_check_point (bgzf_reader *r, inflate_job *job)
+{
+  unsigned long crc = 0;
+  unsigned long len = 0;
+
+  r->crc = crc32_combine (r->crc, job->crc, (z_off_t) job->out_len);
+  r->length += job->out_len;
+  if (job->want || r->partial)
+    return;
+
+  crc = job->trailer[0] | (job->trailer[1] << 8) |
+    (job->trailer[2] << 16) | ((unsigned long) job->trailer[3] << 24);
+  len = job->trailer[4] | (job->trailer[5] << 8) |
+    (job->trailer[6] << 16) | ((unsigned long) job->trailer[7] << 24);
+  if ((crc != r->crc) || (len != (r->length & 0xffffffffUL)))
+    {
+      fprintf (stderr, "\n\nError: corrupt gzip data in the input "
+               "file: %s.\n\n", r->name);
+      abort ();
+    }
+}
+
+/* Switch to inflating the rest of the input on the calling thread,
+   starting from the oldest chunk that has not been handed out */
+
+static void
+bgzf_serial (bgzf_reader *r)
+{
+  int i = 0;
+  size_t n = 0;
+  size_t pending = 0;
+  unsigned long long k = 0;
+  unsigned char *buf = NULL;
+
+  if (r->nthreads)
+    {
+      /* Let the inflaters finish and stop them */
+      pthread_mutex_lock (&r->lock);
+      r->closing = 1;
+      pthread_cond_broadcast (&r->work_cv);
+      pthread_mutex_unlock (&r->lock);
+      for (i = 0; i < r->nthreads; ++i)
+        pthread_join (r->threads[i], NULL);
+
+      /* Put the compressed bytes of the unread chunks back
+         in front of the read-ahead buffer */
+      for (k = r->consumed; k < r->submitted; ++k)
+        pending += r->ring[k % r->nring].in_len;
+      n = r->buf_len - r->buf_pos;
+      if ((buf = (unsigned char *) malloc (pending + n + BGZF_CHUNK_SIZE))
+          == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for input "
+                 "stream.\n\n", stderr);
+          abort ();
+        }
+      pending = 0;
+      for (k = r->consumed; k < r->submitted; ++k)
+        {
+          memcpy (buf + pending, r->ring[k % r->nring].in,
+                  r->ring[k % r->nring].in_len);
+          pending += r->ring[k % r->nring].in_len;
+        }
+      memcpy (buf + pending, r->buf + r->buf_pos, n);
+      free (r->buf);
+      r->buf = buf;
+      r->buf_pos = 0;
+      r->buf_len = pending + n;
+      r->buf_cap = pending + n + BGZF_CHUNK_SIZE;
+      r->consumed = r->submitted;
+      r->cur = NULL;
+    }
+
+  memset (&r->zs, 0, sizeof (z_stream));
+  if (inflateInit2 (&r->zs, 15 + 16) != Z_OK)
+    {
+      fputs ("\n\nError: cannot initialize the decompressor.\n\n", stderr);
+      abort ();
+    }
+  r->in_member = 1;
+  r->mode = IN_STREAM;
+}
+
+/* Inflate up to len bytes on the calling thread */
+
+static size_t
+bgzf_stream_read (bgzf_reader *r, char *s, size_t len)
+{
+  int ret = 0;
+  size_t avail = 0;
+
+  r->zs.next_out = (unsigned char *) s;
+  r->zs.avail_out = (uInt) len;
+
+  while ((r->zs.avail_out > 0) && !r->stream_end)
+    {
+      if ((avail = bgzf_fill (r, 1)) == 0)
+        {
+          if (r->in_member)
+            {
+              fprintf (stderr, "\n\nError: unexpected end of the gzip "
+                       "file: %s.\n\n", r->name);
+              abort ();
+            }
+          break;
+        }
+      r->zs.next_in = r->buf + r->buf_pos;
+      r->zs.avail_in = (uInt) avail;
+      ret = inflate (&r->zs, Z_NO_FLUSH);
+      r->buf_pos += avail - r->zs.avail_in;
+
+      if (ret == Z_STREAM_END)
+        {
+          /* Another member may follow-- anything else is ignored
+             as trailing garbage, as gzip does */
+          r->in_member = 0;
+          if ((bgzf_fill (r, 2) >= 2) && (r->buf[r->buf_pos] == 0x1f) &&
+              (r->buf[r->buf_pos + 1] == 0x8b))
+            {
+              inflateReset (&r->zs);
+              r->in_member = 1;
+            }
+          else
+            r->stream_end = 1;
+        }
+      else if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+        {
+          fprintf (stderr, "\n\nError: corrupt gzip data in the input "
+                   "file: %s.\n\n", r->name);
+          abort ();
+        }
+    }
+
+  return len - r->zs.avail_out;
+}
@@ -0,0 +1,64 @@
+/* bgzf - Blocked gzip streams compressed and decompressed on a pool
+   of threads
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define BGZF_BLOCK_SIZE 0xff00       /* uncompressed bytes per block */
+#define BGZF_MAX_BLOCK_SIZE 0x10000  /* compressed bytes per block */
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+#define BGZF_CHUNK_SIZE 0x80000      /* compressed bytes per inflate job */
+#define BGZF_SEARCH_SIZE 0x1000000   /* read-ahead limit for a member start */
+
+/* Output formats */
+#define BGZF_FORMAT_PLAIN 0          /* uncompressed */
+#define BGZF_FORMAT_GZ 1             /* a single gzip member */
+#define BGZF_FORMAT_BGZF 2           /* blocked gzip */
+
+  /* An output stream-- by default blocked gzip, where every block is an
+     independent gzip member, so any gzip reader can decompress the file.
+     It can also be a single gzip member or uncompressed */
+  typedef struct _bgzf_writer bgzf_writer;
+
+  /* A possibly compressed input stream-- BGZF and multi-member gzip
+     files are inflated a chunk of whole members at a time on a pool of
+     threads, anything else is inflated or copied on the calling thread */
+  typedef struct _bgzf_reader bgzf_reader;
+
+
+/* Function prototypes */
+  extern bgzf_writer *bgzf_open (const char *, int, int, int);
+  extern void bgzf_write (bgzf_writer *, const char *, size_t);
+  extern void bgzf_close (bgzf_writer *);
+  extern bgzf_reader *bgzf_ropen (const char *, int, unsigned long long *);
+  extern size_t bgzf_read (bgzf_reader *, char *, size_t);
+  extern void bgzf_rclose (bgzf_reader *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* BGZF_H */
@@ -0,0 +1,575 @@
+/* fastq - Block-buffered fastQ record reader
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ngscmd.h"
+#include "fastq.h"
+
+static size_t fq_parse (const char *, fq_batch *, size_t, unsigned long long);
+static size_t fq_fill (fq_reader *, fq_batch *, size_t, int);
+static size_t fq_map_fill (fq_reader *, fq_batch *, size_t, int);
+static size_t fq_map_boundary (fq_reader *, size_t);
+static int fq_map (fq_reader *, const char *);
+static void fq_skip (fq_reader *, unsigned long long);
+
+/* Open a fastQ input stream that starts at record first, counting
+   from 0-- uncompressed files are mapped into memory and compressed
+   input is inflated on nthreads threads where the file layout allows
+   it.  An indexed gzip file seeks to the checkpoint before the record,
+   and the records from there are passed over */
+
+fq_reader *
+fq_open (const char *name, int nthreads, unsigned long long first)
+{
+  unsigned long long at = first;
+  fq_reader *r = NULL;
+
+  r = (fq_reader *) calloc (1, sizeof (fq_reader));
+  if (r == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for fastQ reader.\n\n",
+             stderr);
+      abort ();
+    }
+  r->name = name;
+
+  if (fq_map (r, name))
+    at = 0;
+  else if ((r->in = bgzf_ropen (name, nthreads, &at)) == NULL)
+    {
+      free (r);
+      return NULL;
+    }
+  r->nrec = at;
+  fq_skip (r, first - at);
+
+  return r;
+}
+
+/* Close a fastQ input stream */
+
+void
+fq_close (fq_reader *r)
+{
+  if (r == NULL)
+    return;
+  if (r->map != NULL)
+    munmap (r->map, r->map_len);
+  else
+    bgzf_rclose (r->in);
+  free (r->tail);
+  free (r);
+}
+
+/* Initialize an empty batch whose block starts at block_size bytes--
+   the block grows to fit the longest record and is reused by every
+   read into the batch */
+
+void
+fq_batch_init (fq_batch *b, size_t block_size)
+{
+  memset (b, 0, sizeof (fq_batch));
+  b->cap = block_size ? block_size : FQ_BLOCK_SIZE;
+}
+
+/* Free the memory held by a batch */
+
+void
+fq_batch_free (fq_batch *b)
+{
+  if (!b->mapped)
+    free (b->data);
+  free (b->rec);
+  memset (b, 0, sizeof (fq_batch));
+}
+
+/* Resize the block of a batch, keeping room for a closing newline */
+
+static void
+fq_batch_grow (fq_batch *b, size_t cap)
+{
+  b->cap = cap;
+  if ((b->data = (char *) realloc (b->data, b->cap + 1)) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for fastQ block "
+             "buffer.\n\n", stderr);
+      abort ();
+    }
+}
+
+/* Read whole records into a batch until max_records records or the
+   byte budget of the block is reached-- if exact is set, the block
+   grows until max_records records fit or the stream ends */
+
+static size_t
+fq_fill (fq_reader *r, fq_batch *b, size_t max_records, int exact)
+{
+  size_t used = 0;
+  size_t ret = 0;
+
+  if (r->map != NULL)
+    return fq_map_fill (r, b, max_records, exact);
+
+  /* Allocate the block on first use, or enlarge it for
+     the records left over from the last read */
+  if (b->cap == 0)
+    b->cap = FQ_BLOCK_SIZE;
+  if ((b->data == NULL) || (b->cap < r->tail_len))
+    fq_batch_grow (b, (b->cap < r->tail_len) ? r->tail_len : b->cap);
+
+  /* Start the block with the records left over from the last read */
+  memcpy (b->data, r->tail, r->tail_len);
+  b->len = r->tail_len;
+  r->tail_len = 0;
+
+  while (1)
+    {
+      /* Top up the block from the decompressed stream */
+      while (!r->eof && (b->len < b->cap))
+        {
+          ret = bgzf_read (r->in, b->data + b->len, b->cap - b->len);
+          if (ret == 0)
+            r->eof = 1;
+          b->len += ret;
+        }
+
+      /* Terminate a last line that lacks a newline */
+      if (r->eof && (b->len > 0) && (b->data[b->len - 1] != '\n'))
+        b->data[b->len++] = '\n';
+
+      /* Find the record boundaries */
+      used = fq_parse (r->name, b, max_records, r->nrec);
+      if (exact ? ((b->n == max_records) || r->eof)
+          : ((b->n > 0) || (used == b->len)))
+        break;
+
+      if (r->eof)
+        {
+          fprintf (stderr, "\n\nError: truncated fastQ record %llu in "
+                   "file: %s.\n\n", r->nrec + 1, r->name);
+          abort ();
+        }
+
+      /* The next record does not fit-- double the block */
+      fq_batch_grow (b, b->cap << 1);
+    }
+
+  /* Keep the bytes past the last whole record for the next read */
+  r->tail_len = b->len - used;
+  if (r->tail_len > r->tail_cap)
+    {
+      r->tail_cap = b->cap;
+      if ((r->tail = (char *) realloc (r->tail, r->tail_cap)) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for fastQ block "
+                 "buffer.\n\n", stderr);
+          abort ();
+        }
+    }
+  memcpy (r->tail, b->data + used, r->tail_len);
+  b->len = used;
+  r->nrec += b->n;
+
+  return b->n;
+}
+
+/* Pass over the next k records of a stream, parsed as fq_read does--
+   a stream of fewer records is left at its end */
+
+static void
+fq_skip (fq_reader *r, unsigned long long k)
+{
+  size_t n = 0;
+  fq_batch b;
+
+  fq_batch_init (&b, 0);
+  while (k > 0)
+    {
+      n = (k < FQ_BATCH_RECORDS) ? (size_t) k : FQ_BATCH_RECORDS;
+      if (fq_fill (r, &b, n, 1) < n)
+        break;
+      k -= n;
+    }
+  fq_batch_free (&b);
+}
+
+/* Read up to max_records whole records into a batch-- returns the
+   number of records read, zero at the end of the stream */
+
+size_t
+fq_read (fq_reader *r, fq_batch *b, size_t max_records)
+{
+  return fq_fill (r, b, max_records, 0);
+}
+
+/* Read a batch from the first of two mated input streams and the
+   same number of records from the second */
+
+size_t
+fq_read_pair (fq_reader *r1, fq_reader *r2, fq_batch *b1, fq_batch *b2,
+              size_t max_records)
+{
+  size_t n1 = 0;
+  size_t n2 = 0;
+
+  n1 = fq_fill (r1, b1, max_records, 0);
+
+  /* At the end of the first stream, make sure
+     the second one is exhausted as well */
+  n2 = fq_fill (r2, b2, n1 ? n1 : 1, 1);
+
+  /* Unequal number of records */
+  if (n1 != n2)
+    {
+      fputs ("Error processing paired fastQ sequences. "
+             "Are these files properly paired?", stderr);
+      abort ();
+    }
+
+  return n1;
+}
+
+/* Cut the next block of whole records off a mapped file without
+   splitting it into records, so that can be done on another thread
+   by fq_batch_parse-- other streams are read as by fq_read.  Returns
+   zero at the end of the stream */
+
+size_t
+fq_read_block (fq_reader *r, fq_batch *b, size_t max_records)
+{
+  size_t end = 0;
+
+  if (r->map == NULL)
+    return fq_read (r, b, max_records);
+  if (r->map_pos == r->map_len)
+    return 0;
+
+  end = fq_map_boundary (r, r->map_pos + (b->cap ? b->cap : FQ_BLOCK_SIZE));
+  b->data = r->map + r->map_pos;
+  b->len = end - r->map_pos;
+  b->n = 0;
+  b->mapped = 1;
+  b->pending = 1;
+  b->offset = r->map_pos;
+  r->map_pos = end;
+
+  return b->len;
+}
+
+/* Split a block cut by fq_read_block into records-- does nothing
+   for a batch that already holds records */
+
+void
+fq_batch_parse (fq_reader *r, fq_batch *b)
+{
+  size_t used = 0;
+
+  if (!b->pending)
+    return;
+
+  used = fq_parse (r->name, b, (size_t) -1, 0);
+  if (used < b->len)
+    {
+      fprintf (stderr, "\n\nError: truncated fastQ record at byte %llu in "
+               "file: %s.\n\n", b->offset + used, r->name);
+      abort ();
+    }
+  b->pending = 0;
+}
+
+/* Split the block into record views-- returns the number of bytes
+   taken up by whole records.  nrec is the number of records ahead
+   of the block, used in error messages */
+
+static size_t
+fq_parse (const char *name, fq_batch *b, size_t max_records,
+          unsigned long long nrec)
+{
+  int k = 0;
+  char *s = b->data;
+  char *end = b->data + b->len;
+  char *q = NULL;
+  char *nl = NULL;
+  char *line[4];
+  size_t len[4];
+  fq_record *rec = NULL;
+
+  b->n = 0;
+  while (b->n < max_records)
+    {
+      /* Skip blank lines between records */
+      while ((s < end) && ((*s == '\n') || (*s == '\r')))
+        ++s;
+
+      /* Locate the four lines of the next record */
+      q = s;
+      for (k = 0; k < 4; ++k)
+        {
+          if ((nl = (char *) memchr (q, '\n', end - q)) == NULL)
+            return s - b->data;
+          line[k] = q;
+          len[k] = nl - q;
+          q = nl + 1;
+
+          /* Drop the carriage return of a DOS line end */
+          if ((len[k] > 0) && (line[k][len[k] - 1] == '\r'))
+            --len[k];
+        }
+
+      if ((len[0] == 0) || (line[0][0] != '@') ||
+          (len[2] == 0) || (line[2][0] != '+'))
+        {
+          if (b->pending)
+            fprintf (stderr, "\n\nError: malformed fastQ record at byte "
+                     "%llu in file: %s.\n\n",
+                     b->offset + (unsigned long long) (s - b->data), name);
+          else
+            fprintf (stderr, "\n\nError: malformed fastQ record %llu in "
+                     "file: %s.\n\n", nrec + b->n + 1, name);
+          abort ();
+        }
+
+      /* Grow the record array */
+      if (b->n == b->m)
+        {
+          b->m = b->m ? b->m << 1 : 1024;
+          b->rec = (fq_record *) realloc (b->rec, b->m * sizeof (fq_record));
+          if (b->rec == NULL)
+            {
+              fputs ("\n\nError: memory allocation failure for fastQ "
+                     "records.\n\n", stderr);
+              abort ();
+            }
+        }
+
+      rec = &b->rec[b->n++];
+      rec->id = line[0];
+      rec->id_len = len[0];
+      rec->seq = line[1];
+      rec->seq_len = len[1];
+      rec->plus = line[2];
+      rec->plus_len = len[2];
+      rec->qual = line[3];
+      rec->qual_len = len[3];
+      s = q;
+    }
+
+  return s - b->data;
+}
+
+/* Map an uncompressed regular file that ends in a newline-- returns
+   zero if the file has to be read as a stream instead */
+
+static int
+fq_map (fq_reader *r, const char *name)
+{
+  int fd = 0;
+  char head[2];
+  char last = 0;
+  void *map = NULL;
+  struct stat st;
+
+  if ((strcmp (name, "-") == 0) || ((fd = open (name, O_RDONLY)) < 0))
+    return 0;
+  if ((fstat (fd, &st) != 0) || !S_ISREG (st.st_mode) || (st.st_size < 2) ||
+      (pread (fd, head, 2, 0) != 2) ||
+      (pread (fd, &last, 1, st.st_size - 1) != 1) ||
+      (((unsigned char) head[0] == 0x1f) &&
+       ((unsigned char) head[1] == 0x8b)) || (last != '\n'))
+    {
+      close (fd);
+      return 0;
+    }
+
+  map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  /* The file is read once from front to back */
+  posix_madvise (map, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+  r->map = (char *) map;
+  r->map_len = (size_t) st.st_size;
+
+  return 1;
+}
+
+/* Point a batch at whole records of the mapped file, parsed in place--
+   the view widens until a record fits, as fq_fill grows the block */
+
+static size_t
+fq_map_fill (fq_reader *r, fq_batch *b, size_t max_records, int exact)
+{
+  size_t used = 0;
+  size_t left = r->map_len - r->map_pos;
+  size_t len = b->cap ? b->cap : FQ_BLOCK_SIZE;
+
+  b->data = r->map + r->map_pos;
+  b->mapped = 1;
+  b->pending = 0;
+  while (1)
+    {
+      b->len = (len < left) ? len : left;
+      used = fq_parse (r->name, b, max_records, r->nrec);
+      if ((b->len == left) ||
+          (exact ? (b->n == max_records) : (b->n > 0)))
+        break;
+      len <<= 1;
+    }
+
+  if ((b->len == left) && (used < left) && (b->n < max_records))
+    {
+      fprintf (stderr, "\n\nError: truncated fastQ record %llu in "
+               "file: %s.\n\n", r->nrec + b->n + 1, r->name);
+      abort ();
+    }
+
+  b->len = used;
+  r->map_pos += used;
+  r->nrec += b->n;
+
+  return b->n;
+}
+
+/* Return the start of the first record at or past offset pos of the
+   mapped file-- the first line starting with '@' whose next line but
+   one starts with '+'.  A quality line can start with '@' too, but it
+   is followed by a header and a sequence line, never by a '+' line */
+
+static size_t
+fq_map_boundary (fq_reader *r, size_t pos)
+{
+  int k = 0;
+  char *end = r->map + r->map_len;
+  char *s = NULL;
+  char *q = NULL;
+
+  if (pos >= r->map_len)
+    return r->map_len;
+
+  /* Move to the start of a line */
+  s = r->map + pos;
+  if (s[-1] != '\n')
+    s = (char *) memchr (s, '\n', end - s) + 1;
+
+  while (s < end)
+    {
+      if (*s == '@')
+        {
+          for (q = s, k = 0; (k < 2) && (q != NULL); ++k)
+            {
+              q = (char *) memchr (q, '\n', end - q);
+              q = (q != NULL) ? q + 1 : NULL;
+            }
+          if ((q != NULL) && (q < end) && (*q == '+'))
+            return s - r->map;
+        }
+      s = (char *) memchr (s, '\n', end - s) + 1;
+    }
+
+  return r->map_len;
+}
+
+/* Initialize an empty output buffer */
+
+void
+fq_buf_init (fq_buf *o)
+{
+  memset (o, 0, sizeof (fq_buf));
+}
+
+/* Free the memory held by an output buffer */
+
+void
+fq_buf_free (fq_buf *o)
+{
+  free (o->s);
+  memset (o, 0, sizeof (fq_buf));
+}
+
+/* Append len uninitialized bytes to the buffer and return
+   a pointer to them */
+
+char *
+fq_buf_reserve (fq_buf *o, size_t len)
+{
+  char *ptr = NULL;
+
+  if (o->l + len > o->m)
+    {
+      o->m = o->m ? o->m : 0x10000;
+      while (o->l + len > o->m)
+        o->m <<= 1;
+      if ((o->s = (char *) realloc (o->s, o->m)) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for fastQ output "
+                 "buffer.\n\n", stderr);
+          abort ();
+        }
+    }
+  ptr = o->s + o->l;
+  o->l += len;
+
+  return ptr;
+}
+
+/* Append len bytes to the buffer */
+
+void
+fq_buf_put (fq_buf *o, const char *s, size_t len)
+{
+  memcpy (fq_buf_reserve (o, len), s, len);
+}
+
+/* Append a whole fastQ record to the buffer */
+
+void
+fq_buf_record (fq_buf *o, const fq_record *rec)
+{
+  char *ptr = fq_buf_reserve (o, rec->id_len + rec->seq_len + rec->plus_len
+                              + rec->qual_len + 4);
+
+  memcpy (ptr, rec->id, rec->id_len);
+  ptr += rec->id_len;
+  *ptr++ = '\n';
+  memcpy (ptr, rec->seq, rec->seq_len);
+  ptr += rec->seq_len;
+  *ptr++ = '\n';
+  memcpy (ptr, rec->plus, rec->plus_len);
+  ptr += rec->plus_len;
+  *ptr++ = '\n';
+  memcpy (ptr, rec->qual, rec->qual_len);
+  ptr += rec->qual_len;
+  *ptr = '\n';
+}
+
+/* Length of the identifier shared by both mates of a pair-- the
+   identifier without trailing whitespace and the final mate number */
+
+size_t
+fq_mate_key_len (const fq_record *rec)
+{
+  size_t len = rec->id_len;
+
+  while ((len > 0) && isspace ((int) rec->id[len - 1]))
+    --len;
+
+  return len ? len - 1 : 0;
+}
@@ -0,0 +1,108 @@
+/* fastq - Block-buffered fastQ record reader
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef FASTQ_H
+#define FASTQ_H
+
+#include <stddef.h>
+#include <zlib.h>
+
+#include "bgzf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define FQ_BLOCK_SIZE 0x400000
+#define FQ_BATCH_RECORDS 0x4000
+
+  /* A single fastQ record-- each field points into the block buffer
+     of the batch that holds it and is not NUL-terminated */
+  typedef struct _fq_record
+  {
+    char *id;            /* identifier line, including the leading '@' */
+    char *seq;           /* sequence line */
+    char *plus;          /* separator line, including the leading '+' */
+    char *qual;          /* quality line */
+    size_t id_len;
+    size_t seq_len;
+    size_t plus_len;
+    size_t qual_len;
+  } fq_record;
+
+  /* A batch of whole fastQ records sharing one block buffer */
+  typedef struct _fq_batch
+  {
+    char *data;          /* decompressed block */
+    size_t len;          /* bytes used in the block */
+    size_t cap;          /* capacity of the block-- the byte budget */
+    fq_record *rec;      /* record views into the block */
+    size_t n;            /* number of records in the batch */
+    size_t m;            /* allocated size of the record array */
+    int mapped;          /* the block is a view of a mapped file */
+    int pending;         /* the block still has to be split into records */
+    unsigned long long offset;  /* file offset of a pending block */
+  } fq_batch;
+
+  /* A growable output buffer that whole batches of records are
+     serialized into before they are handed to the compressor */
+  typedef struct _fq_buf
+  {
+    char *s;
+    size_t l;            /* bytes used */
+    size_t m;            /* bytes allocated */
+  } fq_buf;
+
+  /* A fastQ input stream */
+  typedef struct _fq_reader
+  {
+    bgzf_reader *in;     /* NULL when the file is mapped */
+    char *map;           /* uncompressed file mapped into memory */
+    size_t map_len;
+    size_t map_pos;      /* offset of the next unread record */
+    const char *name;    /* file name used in error messages */
+    char *tail;          /* partial record left over from the last block */
+    size_t tail_len;
+    size_t tail_cap;
+    int eof;
+    unsigned long long nrec;  /* number of records read so far */
+  } fq_reader;
+
+
+/* Function prototypes */
+  extern fq_reader *fq_open (const char *, int, unsigned long long);
+  extern void fq_close (fq_reader *);
+  extern size_t fq_read (fq_reader *, fq_batch *, size_t);
+  extern size_t fq_read_pair (fq_reader *, fq_reader *, fq_batch *,
+                              fq_batch *, size_t);
+  extern size_t fq_read_block (fq_reader *, fq_batch *, size_t);
+  extern void fq_batch_parse (fq_reader *, fq_batch *);
+  extern void fq_batch_init (fq_batch *, size_t);
+  extern void fq_batch_free (fq_batch *);
+  extern void fq_buf_init (fq_buf *);
+  extern void fq_buf_free (fq_buf *);
+  extern char *fq_buf_reserve (fq_buf *, size_t);
+  extern void fq_buf_put (fq_buf *, const char *, size_t);
+  extern void fq_buf_record (fq_buf *, const fq_record *);
+  extern size_t fq_mate_key_len (const fq_record *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* FASTQ_H */
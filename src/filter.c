@@ -17,26 +17,72 @@
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "pipeline.h"
 
-int
-ngs_filter (ngs_params * p)
+/* Screen a batch of records for ambiguous characters */
+
+static void
+filter_batch (ngs_params * p, void *arg, fq_batch * in1, fq_batch * in2,
+	      fq_buf * out1, fq_buf * out2)
 {
-  int i = 0;
-  int j = 0;
-  int input_buffer_count = 0;
+  size_t i = 0;
+  size_t j = 0;
   int count_N1 = 0;
   int count_N2 = 0;
-  char *ret1 = NULL;
-  char *ret2 = NULL;
-  char input_buffer1[BUFFSIZE][MAX_LINE_LENGTH];
-  char input_buffer2[BUFFSIZE][MAX_LINE_LENGTH];
-  gzFile input_fastq1;
-  gzFile input_fastq2;
-  gzFile output_fastq1;
-  gzFile output_fastq2;
+
+  (void) arg;
+
+  /* Screen each sequence for number of ambiguous characters
+     if record passes filter-- write to the output buffers */
+  for (i = 0; i < in1->n; ++i)
+    {
+      const fq_record *r1 = &in1->rec[i];
+
+      /* Reset ambiguous character counters to zero */
+      count_N1 = 0;
+      count_N2 = 0;
+
+      /* Count the number of ambiguous characters
+         in the first fastQ entry */
+      for (j = 0; j < r1->seq_len; j++)
+	count_N1 += (r1->seq[j] == 'N');
+
+      /* If two fastQ input streams are specified and both sequences
+         pass the for ambiguous characters, then write to both fastQ
+         output buffers */
+      if (in2 != NULL)
+	{
+	  const fq_record *r2 = &in2->rec[i];
+
+	  /* Count the number of ambiguous characters
+	     in the second fastQ entry */
+	  for (j = 0; j < r2->seq_len; j++)
+	    count_N2 += (r2->seq[j] == 'N');
+
+	  if ((count_N1 <= p->num_ambig) && (count_N2 <= p->num_ambig))
+	    {
+	      fq_buf_record (out1, r1);
+	      fq_buf_record (out2, r2);
+	    }
+	}
+      else if (count_N1 <= p->num_ambig)
+	fq_buf_record (out1, r1);
+    }
+}
+
+int
+ngs_filter (ngs_params * p)
+{
+  ngs_pipeline pl;
+  fq_reader *input_fastq1 = NULL;
+  fq_reader *input_fastq2 = NULL;
+  bgzf_writer *output_fastq1;
+  bgzf_writer *output_fastq2 = NULL;
 
   /* Open the first fastQ input stream */
-  if ((input_fastq1 = gzopen (p->seqfile_name1, "r")) == Z_NULL)
+  if ((input_fastq1 = fq_open (p->seqfile_name1, p->threads,
+                               p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: %s.\n\n",
 	       p->seqfile_name1);
@@ -46,7 +92,9 @@ ngs_filter (ngs_params * p)
   /* If specified-- open the second fastQ input stream */
   if (p->flag & TWO_INPUTS)
     {
-      if ((input_fastq2 = gzopen (p->seqfile_name2, "r")) == Z_NULL)
+      input_fastq2 = fq_open (p->seqfile_name2, p->threads,
+                              p->first_record);
+      if (input_fastq2 == NULL)
 	{
 	  fprintf (stderr, "\n\nError: cannot open the second input fastQ "
 		   "file: %s.\n\n", p->seqfile_name2);
@@ -55,7 +103,8 @@ ngs_filter (ngs_params * p)
     }
 
   /* Open the first fastQ output stream */
-  if ((output_fastq1 = gzopen (p->outfile_name1, "w")) == Z_NULL)
+  if ((output_fastq1 = bgzf_open (p->outfile_name1, p->output_format,
+				  p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the output fastQ file: %s.\n",
 	       p->outfile_name1);
@@ -65,7 +114,8 @@ ngs_filter (ngs_params * p)
   /* If specified-- open the second fastQ output stream */
   if (p->flag & TWO_INPUTS)
     {
-      if ((output_fastq2 = gzopen (p->outfile_name2, "w")) == Z_NULL)
+      if ((output_fastq2 = bgzf_open (p->outfile_name2, p->output_format,
+				      p->compress_level, p->threads)) == NULL)
 	{
 	  fprintf (stderr, "\n\nError: cannot open the second output "
 		   "fastQ file: %s.\n", p->outfile_name2);
@@ -76,116 +126,26 @@ ngs_filter (ngs_params * p)
   /* Set up the interrupt trap */
   signal (SIGINT, INThandler);
 
-
   /* Read through both files */
-  while (1)
-    {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
-	{
-	  /* Get line from the first fastQ input stream */
-	  ret1 = gzgets (input_fastq1, input_buffer1[input_buffer_count],
-			 MAX_LINE_LENGTH);
-
-	  /* If specified-- get line from the second fastQ input stream */
-	  if (p->flag & TWO_INPUTS)
-	    ret2 = gzgets (input_fastq2, input_buffer2[input_buffer_count],
-			   MAX_LINE_LENGTH);
-
-	  /* Determine whether gzgets was successful */
-	  if (p->flag & TWO_INPUTS)
-	    {
-	      /* Both gzgets calls return null--
-	         we are at the end of the file */
-	      if ((ret1 == Z_NULL) && (ret2 == Z_NULL))
-		break;
-	      /* one or the other gzgets calls returns null--
-	         unequal number of records */
-	      else if (((ret1 == Z_NULL) && (ret2 != Z_NULL)) ||
-		       ((ret1 != Z_NULL) && (ret2 == Z_NULL)))
-		{
-		  fputs ("Error processing paired fastQ sequences. "
-			 "Are these files properly paired?", stderr);
-		  abort ();
-		}
-	    }
-	  else if (ret1 == Z_NULL)
-	    break;
-
-	  /* Increment the counter for the number of lines
-	     currently in the input buffer */
-	  ++input_buffer_count;
-	}
-
-      /* Screen each sequence for number of ambiguous characters
-         if record passes filter-- write to the output streams */
-      for (i = 0; i < input_buffer_count; ++i)
-	{
-	  if (i % 4 == 1)
-	    {
-	      /* Reset ambiguous character counters to zero */
-	      count_N1 = 0;
-	      count_N2 = 0;
-
-	      /* Count the number of ambiguous characters
-	         in the first fastQ entry */
-	      for (j = 0; input_buffer1[i][j]; j++)
-		count_N1 += (input_buffer1[i][j] == 'N');
-
-	      /* If specified-- count the number of ambiguous characters
-	         in the second fastQ entry */
-	      if (p->flag & TWO_INPUTS)
-		for (j = 0; input_buffer2[i][j]; j++)
-		  count_N2 += (input_buffer2[i][j] == 'N');
-
-	      /* If two fastQ input streams are specified and both sequences
-	         pass the for ambiguous characters, then write to both fastQ
-	         output streams */
-	      if (p->flag & TWO_INPUTS)
-		{
-		  if ((count_N1 <= p->num_ambig) &&
-		      (count_N2 <= p->num_ambig))
-		    {
-		      gzputs (output_fastq1, input_buffer1[i - 1]);
-		      gzputs (output_fastq1, input_buffer1[i]);
-		      gzputs (output_fastq1, input_buffer1[i + 1]);
-		      gzputs (output_fastq1, input_buffer1[i + 2]);
-		      gzputs (output_fastq2, input_buffer2[i - 1]);
-		      gzputs (output_fastq2, input_buffer2[i]);
-		      gzputs (output_fastq2, input_buffer2[i + 1]);
-		      gzputs (output_fastq2, input_buffer2[i + 2]);
-		    }
-		}
-	      else
-		{
-		  if (count_N1 <= p->num_ambig)
-		    {
-		      gzputs (output_fastq1, input_buffer1[i - 1]);
-		      gzputs (output_fastq1, input_buffer1[i]);
-		      gzputs (output_fastq1, input_buffer1[i + 1]);
-		      gzputs (output_fastq1, input_buffer1[i + 2]);
-		    }
-		}
-	    }
-	}
-
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-	break;
-    }
+  pl.p = p;
+  pl.in1 = input_fastq1;
+  pl.in2 = input_fastq2;
+  pl.out1 = output_fastq1;
+  pl.out2 = output_fastq2;
+  pl.work = filter_batch;
+  pl.emit = NULL;
+  pl.arg = NULL;
+  pipeline_run (&pl);
 
   /* Close the first fastQ input and output streams */
-  gzclose (input_fastq1);
-  gzclose (output_fastq1);
+  fq_close (input_fastq1);
+  bgzf_close (output_fastq1);
 
   /* If specified-- close the second fastQ input and output streams */
   if (p->flag & TWO_INPUTS)
     {
-      gzclose (input_fastq2);
-      gzclose (output_fastq2);
+      fq_close (input_fastq2);
+      bgzf_close (output_fastq2);
     }
 
   return 0;
@@ -0,0 +1,249 @@
+/* fptab - Open-addressing set of 128-bit read fingerprints
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ngscmd.h"
+#include "fptab.h"
+
+static void fp_alloc (fp_table *, size_t, int);
+static void fp_grow (fp_table *);
+
+#define FP_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Mix the bits of a 64-bit word-- the MurmurHash3 finalizer */
+
+static inline unsigned long long
+fp_fmix (unsigned long long x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/* Hash len bytes into a fingerprint, which seeds the hash-- the 128-bit
+   MurmurHash3, so hashing the two reads of a pair in turn gives the
+   fingerprint of the pair, and the lengths keep AC+GT apart from A+CGT */
+
+void
+fp_hash (fingerprint *f, const char *s, size_t len)
+{
+  size_t i = 0;
+  size_t tail = len & 15;
+  unsigned long long h1 = f->lo;
+  unsigned long long h2 = f->hi;
+  unsigned long long k1 = 0;
+  unsigned long long k2 = 0;
+  const unsigned long long c1 = 0x87c37b91114253d5ULL;
+  const unsigned long long c2 = 0x4cf5ad432745937fULL;
+  const unsigned char *t = NULL;
+
+  for (i = 0; i + 16 <= len; i += 16)
+    {
+      memcpy (&k1, s + i, 8);
+      memcpy (&k2, s + i + 8, 8);
+      k1 *= c1;
+      k1 = FP_ROTL (k1, 31);
+      k1 *= c2;
+      h1 ^= k1;
+      h1 = FP_ROTL (h1, 27);
+      h1 += h2;
+      h1 = h1 * 5 + 0x52dce729;
+      k2 *= c2;
+      k2 = FP_ROTL (k2, 33);
+      k2 *= c1;
+      h2 ^= k2;
+      h2 = FP_ROTL (h2, 31);
+      h2 += h1;
+      h2 = h2 * 5 + 0x38495ab5;
+    }
+
+  /* The last 1 to 15 bytes */
+  t = (const unsigned char *) s + i;
+  k1 = 0;
+  k2 = 0;
+  for (i = tail; i > 8; --i)
+    k2 |= (unsigned long long) t[i - 1] << (8 * (i - 9));
+  for (i = (tail < 8) ? tail : 8; i > 0; --i)
+    k1 |= (unsigned long long) t[i - 1] << (8 * (i - 1));
+  if (tail > 8)
+    {
+      k2 *= c2;
+      k2 = FP_ROTL (k2, 33);
+      k2 *= c1;
+      h2 ^= k2;
+    }
+  if (tail > 0)
+    {
+      k1 *= c1;
+      k1 = FP_ROTL (k1, 31);
+      k1 *= c2;
+      h1 ^= k1;
+    }
+
+  h1 ^= (unsigned long long) len;
+  h2 ^= (unsigned long long) len;
+  h1 += h2;
+  h2 += h1;
+  h1 = fp_fmix (h1);
+  h2 = fp_fmix (h2);
+  h1 += h2;
+  h2 += h1;
+
+  /* Keep clear of the empty slot */
+  f->lo = ((h1 | h2) == 0) ? 1 : h1;
+  f->hi = h2;
+}
+
+/* Initialize an empty set with room for at least size slots, and a
+   value for each fingerprint if vals is set */
+
+void
+fp_init (fp_table *t, size_t size, int vals)
+{
+  size_t n = 0x400;
+
+  while (n < size)
+    n <<= 1;
+  fp_alloc (t, n, vals);
+  t->n = 0;
+}
+
+/* Add a fingerprint to a set-- returns 1 if it is new, 0 if the set
+   already holds it */
+
+int
+fp_add (fp_table *t, const fingerprint *f)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) f->lo & mask;
+
+  while ((t->keys[i].lo | t->keys[i].hi) != 0)
+    {
+      if ((t->keys[i].lo == f->lo) && (t->keys[i].hi == f->hi))
+        return 0;
+      i = (i + 1) & mask;
+    }
+
+  t->keys[i] = *f;
+
+  /* Keep the load under 0.7 so probe runs stay short */
+  if (++t->n > t->size / 10 * 7)
+    fp_grow (t);
+
+  return 1;
+}
+
+/* Set the value of a fingerprint, adding it if it is new */
+
+void
+fp_set (fp_table *t, const fingerprint *f, unsigned long long val)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) f->lo & mask;
+
+  while ((t->keys[i].lo | t->keys[i].hi) != 0)
+    {
+      if ((t->keys[i].lo == f->lo) && (t->keys[i].hi == f->hi))
+        {
+          t->vals[i] = val;
+          return;
+        }
+      i = (i + 1) & mask;
+    }
+
+  t->keys[i] = *f;
+  t->vals[i] = val;
+  if (++t->n > t->size / 10 * 7)
+    fp_grow (t);
+}
+
+/* Return the value of a fingerprint, NULL if it is absent-- valid
+   until the next fingerprint is added */
+
+unsigned long long *
+fp_get (const fp_table *t, const fingerprint *f)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) f->lo & mask;
+
+  while ((t->keys[i].lo | t->keys[i].hi) != 0)
+    {
+      if ((t->keys[i].lo == f->lo) && (t->keys[i].hi == f->hi))
+        return &t->vals[i];
+      i = (i + 1) & mask;
+    }
+
+  return NULL;
+}
+
+/* Free the memory held by a set */
+
+void
+fp_free (fp_table *t)
+{
+  free (t->keys);
+  free (t->vals);
+  memset (t, 0, sizeof (fp_table));
+}
+
+/* Allocate size empty slots, with values if vals is set */
+
+static void
+fp_alloc (fp_table *t, size_t size, int vals)
+{
+  t->size = size;
+  t->keys = (fingerprint *) calloc (size, sizeof (fingerprint));
+  t->vals = vals ? (unsigned long long *)
+    malloc (size * sizeof (unsigned long long)) : NULL;
+  if ((t->keys == NULL) || (vals && (t->vals == NULL)))
+    {
+      fputs ("\n\nError: memory allocation failure for fingerprint "
+             "table.\n\n", stderr);
+      abort ();
+    }
+}
+
+/* Double the number of slots and reinsert every fingerprint */
+
+static void
+fp_grow (fp_table *t)
+{
+  size_t i = 0;
+  size_t j = 0;
+  size_t mask = 0;
+  size_t old_size = t->size;
+  fingerprint *old_keys = t->keys;
+  unsigned long long *old_vals = t->vals;
+
+  fp_alloc (t, old_size << 1, old_vals != NULL);
+  mask = t->size - 1;
+  for (i = 0; i < old_size; ++i)
+    {
+      if ((old_keys[i].lo | old_keys[i].hi) == 0)
+        continue;
+      j = (size_t) old_keys[i].lo & mask;
+      while ((t->keys[j].lo | t->keys[j].hi) != 0)
+        j = (j + 1) & mask;
+      t->keys[j] = old_keys[i];
+      if (old_vals != NULL)
+        t->vals[j] = old_vals[i];
+    }
+
+  free (old_keys);
+  free (old_vals);
+}
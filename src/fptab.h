@@ -0,0 +1,73 @@
+/* fptab - Open-addressing set of 128-bit read fingerprints
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef FPTAB_H
+#define FPTAB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define FP_INIT_SIZE 0x100000   /* initial number of slots */
+
+  /* A 128-bit fingerprint of one or more sequences-- all zeros marks
+     an empty slot and is never a fingerprint */
+  typedef struct _fingerprint
+  {
+    unsigned long long lo;
+    unsigned long long hi;
+  } fingerprint;
+
+  /* A set of fingerprints, 16 bytes per slot, probed linearly-- the
+     fingerprints are already uniform, so the low word picks the slot.
+     A table made with values keeps 8 more bytes for each fingerprint */
+  typedef struct _fp_table
+  {
+    fingerprint *keys;
+    unsigned long long *vals;  /* NULL for a plain set */
+    size_t size;         /* number of slots, a power of two */
+    size_t n;            /* number of fingerprints */
+  } fp_table;
+
+
+/* Inline functions */
+
+/* Start a fingerprint that sequences are then hashed into */
+  static inline void
+  fp_start (fingerprint *f)
+  {
+    f->lo = 0;
+    f->hi = 0;
+  }
+
+
+/* Function prototypes */
+  extern void fp_hash (fingerprint *, const char *, size_t);
+  extern void fp_init (fp_table *, size_t, int);
+  extern int fp_add (fp_table *, const fingerprint *);
+  extern void fp_set (fp_table *, const fingerprint *, unsigned long long);
+  extern unsigned long long *fp_get (const fp_table *, const fingerprint *);
+  extern void fp_free (fp_table *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* FPTAB_H */
@@ -0,0 +1,499 @@
+/* gzindex - Random-access checkpoint index for single-member gzip files
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <sys/stat.h>
+
+#include "ngscmd.h"
+#include "gzindex.h"
+
+/* Size of the compressed reads while building an index */
+#define GZI_CHUNK 0x40000
+
+/* Identifies an index file and its format version */
+static const char gzi_magic[8] = { 'N', 'G', 'S', 'G', 'Z', 'I', 0, 3 };
+
+/* Where the record scan is between two output buffers */
+typedef struct _gzi_scan
+{
+  int line;                   /* line of the current record, 0-3 */
+  int between;                /* waiting for the first byte of a record */
+  size_t pending;             /* first point still waiting for rec_out */
+} gzi_scan;
+
+static void gzi_add_point (gz_index *, int, unsigned long long,
+                           unsigned long long, const unsigned char *,
+                           size_t);
+static void gzi_scan_records (gz_index *, gzi_scan *, const unsigned char *,
+                              size_t, unsigned long long);
+static void gzi_put64 (FILE *, unsigned long long);
+static unsigned long long gzi_get64 (FILE *);
+static char *gzi_name (const char *);
+
+/* Inflate a single-member gzip file and record a checkpoint at the
+   first deflate block boundary after every span uncompressed bytes,
+   along with the number of fastQ records ahead of each checkpoint */
+
+gz_index *
+gzi_build (const char *name, unsigned long long span)
+{
+  int ret = 0;
+  size_t got = 0;
+  unsigned long long totin = 0;
+  unsigned long long totout = 0;
+  unsigned long long last = 0;
+  unsigned char *input = NULL;
+  unsigned char *window = NULL;
+  unsigned char *from = NULL;
+  FILE *fp = NULL;
+  gz_index *idx = NULL;
+  gzi_scan scan;
+  z_stream zs;
+  struct stat st;
+
+  if ((fp = fopen (name, "rb")) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the input file: %s.\n\n",
+               name);
+      abort ();
+    }
+
+  idx = (gz_index *) calloc (1, sizeof (gz_index));
+  input = (unsigned char *) malloc (GZI_CHUNK);
+  window = (unsigned char *) calloc (1, GZI_WINSIZE);
+  if ((idx == NULL) || (input == NULL) || (window == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for gzip index.\n\n",
+             stderr);
+      abort ();
+    }
+
+  /* Inflate with automatic gzip header processing */
+  memset (&zs, 0, sizeof (z_stream));
+  if (inflateInit2 (&zs, 47) != Z_OK)
+    {
+      fputs ("\n\nError: cannot initialize the decompressor.\n\n", stderr);
+      abort ();
+    }
+  memset (&scan, 0, sizeof (gzi_scan));
+  scan.between = 1;
+
+  do
+    {
+      /* Get some compressed data */
+      if ((zs.avail_in = (uInt) fread (input, 1, GZI_CHUNK, fp)) == 0)
+        {
+          fprintf (stderr, "\n\nError: unexpected end of the gzip file: "
+                   "%s.\n\n", name);
+          abort ();
+        }
+      zs.next_in = input;
+
+      do
+        {
+          /* Reset the sliding window when it is full */
+          if (zs.avail_out == 0)
+            {
+              zs.avail_out = GZI_WINSIZE;
+              zs.next_out = window;
+            }
+
+          /* Inflate until the end of the input or output,
+             or the end of a deflate block */
+          from = zs.next_out;
+          totin += zs.avail_in;
+          totout += zs.avail_out;
+          ret = inflate (&zs, Z_BLOCK);
+          totin -= zs.avail_in;
+          totout -= zs.avail_out;
+          if ((ret == Z_NEED_DICT) || (ret == Z_DATA_ERROR) ||
+              (ret == Z_MEM_ERROR))
+            {
+              fprintf (stderr, "\n\nError: %s is not a valid gzip file.\n\n",
+                       name);
+              abort ();
+            }
+          gzi_scan_records (idx, &scan, from, zs.next_out - from,
+                            totout - (zs.next_out - from));
+          if (ret == Z_STREAM_END)
+            break;
+
+          /* Add a checkpoint at the end of a block header when
+             enough output has passed since the last one */
+          if ((zs.data_type & 128) && !(zs.data_type & 64) &&
+              ((totout == 0) || (totout - last > span)))
+            {
+              gzi_add_point (idx, zs.data_type & 7, totin, totout,
+                             window, zs.avail_out);
+              last = totout;
+            }
+        }
+      while (zs.avail_in != 0);
+    }
+  while (ret != Z_STREAM_END);
+
+  /* Records that began past the last checkpoint */
+  while (scan.pending < idx->n)
+    {
+      idx->list[scan.pending].rec = idx->nrec;
+      idx->list[scan.pending++].rec_out = totout;
+    }
+  if (scan.line == 3)
+    ++idx->nrec;
+
+  /* Another gzip member would not be covered by the checkpoints */
+  got = zs.avail_in;
+  if (got < 2)
+    {
+      memmove (input, zs.next_in, got);
+      got += fread (input + got, 1, 2 - got, fp);
+      zs.next_in = input;
+    }
+  if ((got >= 2) && (zs.next_in[0] == 0x1f) && (zs.next_in[1] == 0x8b))
+    {
+      fprintf (stderr, "\n\nError: %s has more than one gzip member-- "
+               "these files are already decompressed in parallel.\n\n",
+               name);
+      abort ();
+    }
+
+  /* Note the compressed size and modification time so a rewritten
+     file invalidates the index */
+  fseek (fp, 0, SEEK_END);
+  idx->size = (unsigned long long) ftell (fp);
+  if (fstat (fileno (fp), &st) == 0)
+    idx->mtime = (unsigned long long) st.st_mtime;
+  idx->length = totout;
+
+  inflateEnd (&zs);
+  free (input);
+  free (window);
+  fclose (fp);
+
+  return idx;
+}
+
+/* Write the index to the sidecar file of a gzip file */
+
+void
+gzi_save (gz_index *idx, const char *name)
+{
+  size_t i = 0;
+  char *index_name = gzi_name (name);
+  FILE *fp = NULL;
+  gzi_point *pt = NULL;
+
+  if ((fp = fopen (index_name, "wb")) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the index file: %s.\n\n",
+               index_name);
+      abort ();
+    }
+
+  fwrite (gzi_magic, 1, sizeof (gzi_magic), fp);
+  gzi_put64 (fp, idx->size);
+  gzi_put64 (fp, idx->mtime);
+  gzi_put64 (fp, idx->length);
+  gzi_put64 (fp, idx->nrec);
+  gzi_put64 (fp, idx->n);
+  for (i = 0; i < idx->n; ++i)
+    {
+      pt = &idx->list[i];
+      gzi_put64 (fp, pt->in);
+      gzi_put64 (fp, pt->out);
+      gzi_put64 (fp, pt->bits);
+      gzi_put64 (fp, pt->rec);
+      gzi_put64 (fp, pt->rec_out);
+      gzi_put64 (fp, pt->window_len);
+      fwrite (pt->window, 1, pt->window_len, fp);
+    }
+
+  if (ferror (fp) || (fclose (fp) != 0))
+    {
+      fprintf (stderr, "\n\nError: cannot write the index file: %s.\n\n",
+               index_name);
+      abort ();
+    }
+  free (index_name);
+}
+
+/* Read the index of a gzip file of the given compressed size and
+   modification time-- returns NULL if there is no index or it belongs
+   to a different file, or to an older version of the file */
+
+gz_index *
+gzi_load (const char *name, unsigned long long size,
+          unsigned long long mtime)
+{
+  size_t i = 0;
+  char magic[sizeof (gzi_magic)];
+  char *index_name = gzi_name (name);
+  FILE *fp = NULL;
+  gz_index *idx = NULL;
+  gzi_point *pt = NULL;
+
+  fp = fopen (index_name, "rb");
+  free (index_name);
+  if (fp == NULL)
+    return NULL;
+
+  if ((fread (magic, 1, sizeof (magic), fp) != sizeof (magic)) ||
+      (memcmp (magic, gzi_magic, sizeof (magic)) != 0) ||
+      (gzi_get64 (fp) != size) || (gzi_get64 (fp) != mtime))
+    {
+      fclose (fp);
+      return NULL;
+    }
+
+  if ((idx = (gz_index *) calloc (1, sizeof (gz_index))) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for gzip index.\n\n",
+             stderr);
+      abort ();
+    }
+  idx->size = size;
+  idx->mtime = mtime;
+  idx->length = gzi_get64 (fp);
+  idx->nrec = gzi_get64 (fp);
+  idx->n = idx->m = (size_t) gzi_get64 (fp);
+  idx->list = (gzi_point *) calloc (idx->n ? idx->n : 1, sizeof (gzi_point));
+  if (idx->list == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for gzip index.\n\n",
+             stderr);
+      abort ();
+    }
+
+  for (i = 0; i < idx->n; ++i)
+    {
+      pt = &idx->list[i];
+      pt->in = gzi_get64 (fp);
+      pt->out = gzi_get64 (fp);
+      pt->bits = (int) gzi_get64 (fp);
+      pt->rec = gzi_get64 (fp);
+      pt->rec_out = gzi_get64 (fp);
+      pt->window_len = (size_t) gzi_get64 (fp);
+      if (pt->window_len > compressBound (GZI_WINSIZE))
+        break;
+      if (pt->window_len > 0)
+        {
+          if ((pt->window = (unsigned char *) malloc (pt->window_len))
+              == NULL)
+            {
+              fputs ("\n\nError: memory allocation failure for gzip "
+                     "index.\n\n", stderr);
+              abort ();
+            }
+          if (fread (pt->window, 1, pt->window_len, fp) != pt->window_len)
+            break;
+        }
+    }
+
+  /* A short or damaged index is not used */
+  if (ferror (fp) || feof (fp) || (i < idx->n))
+    {
+      gzi_free (idx);
+      idx = NULL;
+    }
+  fclose (fp);
+
+  return idx;
+}
+
+/* Return the last checkpoint from which record k can be reached
+   by skipping whole records */
+
+size_t
+gzi_find_record (const gz_index *idx, unsigned long long k)
+{
+  size_t lo = 0;
+  size_t hi = idx->n;
+  size_t mid = 0;
+
+  while (hi - lo > 1)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (idx->list[mid].rec <= k)
+        lo = mid;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Free the memory held by an index */
+
+void
+gzi_free (gz_index *idx)
+{
+  size_t i = 0;
+
+  if (idx == NULL)
+    return;
+  for (i = 0; i < idx->n; ++i)
+    free (idx->list[i].window);
+  free (idx->list);
+  free (idx);
+}
+
+/* Append a checkpoint-- the window holds the last 32K of output,
+   with the oldest left bytes at its end */
+
+static void
+gzi_add_point (gz_index *idx, int bits, unsigned long long in,
+               unsigned long long out, const unsigned char *window,
+               size_t left)
+{
+  uLongf len = 0;
+  unsigned char history[GZI_WINSIZE];
+  gzi_point *pt = NULL;
+
+  if (idx->n == idx->m)
+    {
+      idx->m = idx->m ? idx->m << 1 : 64;
+      idx->list = (gzi_point *) realloc (idx->list,
+                                         idx->m * sizeof (gzi_point));
+      if (idx->list == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for gzip "
+                 "index.\n\n", stderr);
+          abort ();
+        }
+    }
+
+  pt = &idx->list[idx->n++];
+  memset (pt, 0, sizeof (gzi_point));
+  pt->bits = bits;
+  pt->in = in;
+  pt->out = out;
+  if (out == 0)
+    return;
+
+  /* Unroll the circular window and deflate it-- fastQ history
+     compresses several fold, which keeps the index small */
+  if (left)
+    memcpy (history, window + GZI_WINSIZE - left, left);
+  if (left < GZI_WINSIZE)
+    memcpy (history + left, window, GZI_WINSIZE - left);
+  len = compressBound (GZI_WINSIZE);
+  if ((pt->window = (unsigned char *) malloc (len)) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for gzip index.\n\n",
+             stderr);
+      abort ();
+    }
+  if (compress2 (pt->window, &len, history, GZI_WINSIZE, 6) != Z_OK)
+    {
+      fputs ("\n\nError: cannot compress a gzip index window.\n\n", stderr);
+      abort ();
+    }
+  pt->window_len = len;
+}
+
+/* Follow the fastQ line structure through a piece of output starting
+   at uncompressed offset off-- the same way fq_parse does, blank lines
+   are skipped between records-- and give every checkpoint the first
+   record that starts at or after it */
+
+static void
+gzi_scan_records (gz_index *idx, gzi_scan *scan, const unsigned char *s,
+                  size_t len, unsigned long long off)
+{
+  const unsigned char *p = s;
+  const unsigned char *end = s + len;
+  const unsigned char *nl = NULL;
+
+  while (p < end)
+    {
+      if (scan->between)
+        {
+          while ((p < end) && ((*p == '\n') || (*p == '\r')))
+            ++p;
+          if (p == end)
+            break;
+
+          /* A record starts here */
+          while ((scan->pending < idx->n) &&
+                 (idx->list[scan->pending].out <= off + (p - s)))
+            {
+              idx->list[scan->pending].rec = idx->nrec;
+              idx->list[scan->pending++].rec_out = off + (p - s);
+            }
+          scan->between = 0;
+        }
+
+      if ((nl = (const unsigned char *) memchr (p, '\n', end - p)) == NULL)
+        break;
+      p = nl + 1;
+      if (++scan->line == 4)
+        {
+          scan->line = 0;
+          scan->between = 1;
+          ++idx->nrec;
+        }
+    }
+}
+
+/* Write a 64-bit little-endian integer */
+
+static void
+gzi_put64 (FILE *fp, unsigned long long x)
+{
+  int i = 0;
+  unsigned char b[8];
+
+  for (i = 0; i < 8; ++i)
+    b[i] = (unsigned char) (x >> (8 * i));
+  fwrite (b, 1, 8, fp);
+}
+
+/* Read a 64-bit little-endian integer */
+
+static unsigned long long
+gzi_get64 (FILE *fp)
+{
+  int i = 0;
+  unsigned char b[8];
+  unsigned long long x = 0;
+
+  memset (b, 0, 8);
+  if (fread (b, 1, 8, fp) != 8)
+    return 0;
+  for (i = 7; i >= 0; --i)
+    x = (x << 8) | b[i];
+
+  return x;
+}
+
+/* Return the name of the index file of a gzip file */
+
+static char *
+gzi_name (const char *name)
+{
+  char *index_name = NULL;
+
+  index_name = (char *) malloc (strlen (name) + sizeof (GZI_SUFFIX));
+  if (index_name == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for gzip index.\n\n",
+             stderr);
+      abort ();
+    }
+  strcpy (index_name, name);
+  strcat (index_name, GZI_SUFFIX);
+
+  return index_name;
+}
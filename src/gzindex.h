@@ -0,0 +1,70 @@
+/* gzindex - Random-access checkpoint index for single-member gzip files
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef GZINDEX_H
+#define GZINDEX_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define GZI_SUFFIX ".ngi"            /* appended to the gzip file name */
+#define GZI_SPAN 4                   /* default MB between checkpoints */
+#define GZI_WINSIZE 0x8000           /* deflate history window */
+
+  /* A point in the deflate stream where inflation can be restarted--
+     a deflate block boundary and the 32K of output that precede it */
+  typedef struct _gzi_point
+  {
+    unsigned long long in;     /* first whole compressed byte of the block */
+    unsigned long long out;    /* uncompressed offset of the block */
+    int bits;                  /* bits of the block in the byte before in */
+    unsigned long long rec;    /* number of fastQ records before rec_out */
+    unsigned long long rec_out;  /* offset of the first record at or past out */
+    unsigned char *window;     /* deflated history window, NULL at out 0 */
+    size_t window_len;
+  } gzi_point;
+
+  /* The checkpoints of one gzip file */
+  typedef struct _gz_index
+  {
+    gzi_point *list;
+    size_t n;
+    size_t m;
+    unsigned long long size;     /* compressed file size */
+    unsigned long long mtime;    /* modification time of the file */
+    unsigned long long length;   /* uncompressed stream length */
+    unsigned long long nrec;     /* number of fastQ records */
+  } gz_index;
+
+
+/* Function prototypes */
+  extern gz_index *gzi_build (const char *, unsigned long long);
+  extern void gzi_save (gz_index *, const char *);
+  extern gz_index *gzi_load (const char *, unsigned long long,
+                             unsigned long long);
+  extern size_t gzi_find_record (const gz_index *, unsigned long long);
+  extern void gzi_free (gz_index *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* GZINDEX_H */
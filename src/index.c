@@ -0,0 +1,41 @@
+/* index - Build a random-access checkpoint index for a gzip fastQ file
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ngscmd.h"
+#include "gzindex.h"
+
+int
+ngs_index (ngs_params * p)
+{
+  gz_index *idx = NULL;
+
+  /* Set up interrupt trap */
+  signal (SIGINT, INThandler);
+
+  /* One pass over the whole file-- the index is then reused by every
+     command that reads the file with more than one thread */
+  idx = gzi_build (p->seqfile_name1, (unsigned long long) p->index_span
+                   << 20);
+  gzi_save (idx, p->seqfile_name1);
+
+  printf ("%s%s: %lu checkpoints, %llu records, %llu bytes\n",
+          p->seqfile_name1, GZI_SUFFIX, (unsigned long) idx->n, idx->nrec,
+          idx->length);
+
+  gzi_free (idx);
+
+  return 0;
+}
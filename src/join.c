@@ -17,69 +17,120 @@
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "fastq.h"
+#include "arena.h"
 #include "uthash.h"
 
 typedef struct _entry
 {
   const char *fqid;     /* key */
-  const char *seq;      /* sequence string */
-  const char *qual;     /* quality string */
+  const char *seq;      /* reverse complemented sequence string */
+  const char *qual;     /* reversed quality string */
+  size_t fqid_len;
+  size_t seq_len;
+  size_t qual_len;
   UT_hash_handle hh;    /* makes this structure hashable */
 } entry;
 
 
 
-/* Complement DNA sequence */
-char *compdna(char s[])
-{    char *final = malloc(strlen(s) + 1);
-    int i=0;
-    while (s[i] != '\0')                      
+/* Reverse complement a DNA sequence */
+static void
+rev_comp (char *dst, const char *src, size_t len)
+{
+  size_t i = 0;
+
+  for (i = 0; i < len; ++i)
     {
-      if(s[i] == 'a' || s[i] == 'A')
+      switch (src[len - i - 1])
         {
-          final[i] = 'T';                       
-        }                                 
-      else if(s[i] == 'c' || s[i] == 'C')   
-        {                                 
-          final[i] = 'G';                      
-        }                                 
-      else if(s[i] == 'g' || s[i] == 'G')   
-        {                                 
-          final[i] = 'C';                      
-        }                                 
-      else if(s[i] == 't' || s[i] == 'T')
-        {
-          final[i] = 'A';
-        }
-      else if(s[i] == 'n' || s[i] == 'N')   
-        {                                 
-          final[i] = 'N';                     
+        case 'a':
+        case 'A':
+          dst[i] = 'T';
+          break;
+        case 'c':
+        case 'C':
+          dst[i] = 'G';
+          break;
+        case 'g':
+        case 'G':
+          dst[i] = 'C';
+          break;
+        case 't':
+        case 'T':
+          dst[i] = 'A';
+          break;
+        default:
+          dst[i] = 'N';
+          break;
         }
-      ++i;
-    }                                     
-    final[i]=0;
-    return final;
+    }
+}
+
+/* Reverse a quality string */
+static void
+rev_str (char *dst, const char *src, size_t len)
+{
+  size_t i = 0;
+
+  for (i = 0; i < len; ++i)
+    dst[i] = src[len - i - 1];
+}
+
+/* Serialize a joined pair into an output buffer-- the mates are
+   separated by gap Ns, with gap_qual quality scores to match */
+
+static void
+join_put (fq_buf *o, const fq_record *r, size_t key_len, const entry *e,
+          size_t gap, char gap_qual)
+{
+  char *s = fq_buf_reserve (o, key_len + 2 * gap + r->seq_len + e->seq_len
+                            + r->qual_len + e->qual_len + 5);
+
+  memcpy (s, r->id, key_len);
+  s += key_len;
+  *s++ = '\n';
+  memcpy (s, r->seq, r->seq_len);
+  s += r->seq_len;
+  memset (s, 'N', gap);
+  s += gap;
+  memcpy (s, e->seq, e->seq_len);
+  s += e->seq_len;
+  memcpy (s, "\n+\n", 3);
+  s += 3;
+  memcpy (s, r->qual, r->qual_len);
+  s += r->qual_len;
+  memset (s, gap_qual, gap);
+  s += gap;
+  memcpy (s, e->qual, e->qual_len);
+  s[e->qual_len] = '\n';
 }
 
 
 int
 ngs_join (ngs_params * p)
 {
-  int i = 0;
-  int input_buffer_count = 0;
-  char input_buffer1[BUFFSIZE][MAX_LINE_LENGTH];
-  char input_buffer2[BUFFSIZE][MAX_LINE_LENGTH];
+  size_t i = 0;
+  size_t key_len = 0;
+  char *s = NULL;
+  fq_batch batch;
+  fq_buf out;
+  ngs_arena records;
   entry *e = NULL;
-  entry *tmp = NULL;
   entry *hash_fastq2 = NULL;
-  gzFile input_fastq1;
-  gzFile input_fastq2;
-  gzFile output_fastq1;
-  int j = 0;
+  fq_reader *input_fastq1 = NULL;
+  fq_reader *input_fastq2 = NULL;
+  bgzf_writer *output_fastq1;
+  size_t gap = (p->gap_size > 0) ? (size_t) p->gap_size : 0;
+
+  /* Quality score of the gap: ! for Sanger and @ for Illumina */
+  char gap_qual = (p->flag & SCORE_ILLUMINA) ? '@' : '!';
 
 
  /* Open the first fastQ input stream */
-  if ((input_fastq1 = gzopen (p->seqfile_name1, "rb")) == Z_NULL)
+  if ((input_fastq1 = fq_open (p->seqfile_name1, p->threads,
+                               p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: %s.\n\n",
                p->seqfile_name1);
@@ -87,14 +138,16 @@ ngs_join (ngs_params * p)
     }
 
   /* Open the second fastQ input stream */
-  if ((input_fastq2 = gzopen (p->seqfile_name2, "rb")) == Z_NULL)
+  if ((input_fastq2 = fq_open (p->seqfile_name2, p->threads,
+                               p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the second input "
                "fastQ file: %s.\n\n", p->seqfile_name2);
       abort ();
     }
   /* Open the fastQ output stream */
-  if ((output_fastq1 = gzopen (p->outfile_name1, "wb")) == Z_NULL)
+  if ((output_fastq1 = bgzf_open (p->outfile_name1, p->output_format,
+                                  p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the output fastQ file: "
                "%s.\n", p->outfile_name1);
@@ -105,128 +158,71 @@ ngs_join (ngs_params * p)
   /* Set up interrupt trap */
   signal (SIGINT, INThandler);
 
+  fq_batch_init (&batch, FQ_BLOCK_SIZE);
+  fq_buf_init (&out);
+  arena_init (&records, ARENA_CHUNK_SIZE);
+
   /* Enter data from the second fastQ input file
      into a hash table */
-  while (1)
+  while (fq_read (input_fastq2, &batch, FQ_BATCH_RECORDS) > 0)
     {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
-        {
-          /* Get line from the second fastQ input stream */
-          if (gzgets (input_fastq2, input_buffer2[input_buffer_count], MAX_LINE_LENGTH)
-              == Z_NULL)
-            break;
-
-          /* Iterate the counter for the number of lines
-             currently in the input buffer */
-          ++input_buffer_count;
-        }
-
-      for (i = 0; i < input_buffer_count; ++i)
+      for (i = 0; i < batch.n; ++i)
         {
-          if (i % 4 == 3)
-            {
-               e = (entry *) malloc (sizeof (entry));
-               chomp (input_buffer2[i-3]);
-               input_buffer2[i-3][strlen (input_buffer2[i-3]) - 1] = '\0';
-               e->fqid = input_buffer2[i-3];
-               e->seq = input_buffer2[i-2];
-               e->qual = input_buffer2[i];
-               HASH_ADD_KEYPTR (hh, hash_fastq2, e->fqid, strlen (e->fqid), e);
-            }
+          const fq_record *r = &batch.rec[i];
+
+          /* Copy the record out of the batch, which is reused--
+             the mate is stored already reverse complemented */
+          key_len = fq_mate_key_len (r);
+          e = (entry *) arena_alloc (&records, sizeof (entry) + key_len
+                                     + r->seq_len + r->qual_len);
+          s = (char *) (e + 1);
+          memcpy (s, r->id, key_len);
+          e->fqid = s;
+          e->fqid_len = key_len;
+          s += key_len;
+          rev_comp (s, r->seq, r->seq_len);
+          e->seq = s;
+          e->seq_len = r->seq_len;
+          s += r->seq_len;
+          rev_str (s, r->qual, r->qual_len);
+          e->qual = s;
+          e->qual_len = r->qual_len;
+          HASH_ADD_KEYPTR (hh, hash_fastq2, e->fqid, e->fqid_len, e);
         }
-
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-        break;
     }
 
   /* Read through first fastQ input file
      and lookup IDs in hash table */
-  while (1)
+  while (fq_read (input_fastq1, &batch, FQ_BATCH_RECORDS) > 0)
     {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
-        {
-           /* Get line from the first fastQ input stream */
-           if (gzgets (input_fastq1, input_buffer1[input_buffer_count], MAX_LINE_LENGTH)
-               == Z_NULL)
-             break;
-
-           /* Iterate the counter for the number of lines
-              currently in the input buffer */
-           ++input_buffer_count;
-        }
-      for (i = 0; i < input_buffer_count; ++i)
+      out.l = 0;
+      for (i = 0; i < batch.n; ++i)
         {
-          if (i % 4 == 3)
-            {
-              chomp (input_buffer1[i-3]);
-              chomp (input_buffer1[i-2]);
-              chomp (input_buffer1[i]);
-              
-              input_buffer1[i-3][strlen (input_buffer1[i-3]) - 1] = '\0';
-              HASH_FIND_STR (hash_fastq2, input_buffer1[i-3], e);
-              if (e)
-                {
-                   chomp(e->seq);
-                   chomp(e->qual);
-                   strrev(e->seq);
-                   strrev(e->qual);
-
-                   gzputs (output_fastq1, input_buffer1[i-3]);
-                   gzputs (output_fastq1, "\n");
-                   gzputs (output_fastq1, input_buffer1[i-2]);
-                     for (j = 0; j < p->gap_size; ++j)
-                       {
-                       gzputs (output_fastq1, "N"); /* INSERT USER DEFINED NUMBER OF Ns here */  
-                       }                                     
-                   gzputs (output_fastq1, compdna(e->seq)); 
-                   gzputs (output_fastq1, "\n");
-                   gzputs (output_fastq1, "+\n");
-                   gzputs (output_fastq1, input_buffer1[i]);
-                   if (p->flag & SCORE_ILLUMINA)
-                     {
-                     for (j = 0; j < p->gap_size; ++j)
-                       {
-                       gzputs (output_fastq1, "@");   /* ADD USER DEFINED NUMBER of quality scores to match with Ns:  ! for Sanger and @ for illumina */
-                       } 
-                     }
-                   else
-                   for (j = 0; j < p->gap_size; ++j)
-                     {
-                     gzputs (output_fastq1, "!");   /* ADD USER DEFINED NUMBER of quality scores to match with Ns:  ! for Sanger and @ for illumina */
-                     } 
-                   gzputs (output_fastq1, e->qual);
-                   gzputs (output_fastq1, "\n");
-                 }
-            }
+          const fq_record *r = &batch.rec[i];
+
+          key_len = fq_mate_key_len (r);
+          HASH_FIND (hh, hash_fastq2, r->id, key_len, e);
+          if (e)
+            join_put (&out, r, key_len, e, gap, gap_qual);
         }
 
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-        break;
+      /* Hand the whole batch to the compressors at once */
+      bgzf_write (output_fastq1, out.s, out.l);
     }
 
-  /* Free the hash table contents */
-  HASH_ITER (hh, hash_fastq2, e, tmp)
-  {
-    HASH_DEL (hash_fastq2, e);
-    free (e);
-  }
+  fq_batch_free (&batch);
+  fq_buf_free (&out);
+
+  /* Free the hash table and the records it holds */
+  HASH_CLEAR (hh, hash_fastq2);
+  arena_free (&records);
 
   /* Close the fastQ input streams */
-  gzclose (input_fastq1);
-  gzclose (input_fastq2);
+  fq_close (input_fastq1);
+  fq_close (input_fastq2);
 
   /* Close the fastQ output streams */
-  gzclose (output_fastq1);
+  bgzf_close (output_fastq1);
 
   return 0;
 }
@@ -17,60 +17,366 @@
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "fastq.h"
+#include "kmertab.h"
+#include "kmer.h"
+#include "pipeline.h"
+
+/* A table shared by the pipeline workers-- the workers add to table
+   and the k-mers they miss when it fills are folded into overflow, in
+   input order, by kmer_sync_emit */
+typedef struct _kmer_shared
+{
+  kmer_table table;
+  kmer_table overflow;
+  bloom_filter *bloom;         /* NULL to count every k-mer */
+  unsigned long long total;
+} kmer_shared;
+
+static void kmer_sync_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+			     fq_buf *, fq_buf *);
+static void kmer_sync_emit (void *, fq_buf *, fq_buf *);
+static void kmer_count_shared (ngs_params *, fq_reader *, size_t,
+			       bloom_filter *, kmer_stats *, kmer_table *);
+
+/* Count the k-mers of a batch of reads straight into the shared table--
+   out1 collects the k-mers that missed it and out2 the number seen */
+
+static void
+kmer_sync_batch (ngs_params * p, void *arg, fq_batch * in1, fq_batch * in2,
+		 fq_buf * out1, fq_buf * out2)
+{
+  size_t i = 0;
+  unsigned long long total = 0;
+  kmer_shared *sh = (kmer_shared *) arg;
+
+  (void) in2;
+  for (i = 0; i < in1->n; ++i)
+    total += kt_sync_count_seq (&sh->table, in1->rec[i].seq,
+				in1->rec[i].qual, kt_rec_len (&in1->rec[i]),
+				p->kmer_size, p->kmer_qual + KT_PHRED,
+				sh->bloom, out1);
+  fq_buf_put (out2, (const char *) &total, sizeof (total));
+}
+
+/* Fold the tallies of a batch into the totals and the overflow table */
+
+static void
+kmer_sync_emit (void *arg, fq_buf * out1, fq_buf * out2)
+{
+  size_t i = 0;
+  unsigned long long kmer = 0;
+  unsigned long long total = 0;
+  kmer_shared *sh = (kmer_shared *) arg;
+
+  memcpy (&total, out2->s, sizeof (total));
+  sh->total += total;
+  for (i = 0; i + sizeof (kmer) <= out1->l; i += sizeof (kmer))
+    {
+      if (sh->overflow.keys == NULL)
+	kt_init (&sh->overflow, KT_MIN_SIZE);
+      memcpy (&kmer, out1->s + i, sizeof (kmer));
+      if (sh->bloom == NULL)
+	kt_add (&sh->overflow, kmer);
+      else
+	kt_promote (&sh->overflow, kmer);
+    }
+}
+
+/* Count k-mers on the pipeline workers in one table pre-sized for est
+   distinct k-mers, shared without a lock, into table-- behind a Bloom
+   filter that most k-mers seen once never get past, far fewer fit.
+   The table is rounded to a power of two and then held to the memory
+   cap, and the k-mers that find it full go to an overflow table that
+   grows as needed */
+
+static void
+kmer_count_shared (ngs_params * p, fq_reader * in, size_t est,
+		   bloom_filter * bloom, kmer_stats * stats, kmer_table * table)
+{
+  size_t i = 0;
+  size_t slots = KT_MIN_SIZE;
+  size_t want = ((bloom != NULL) ? est / 4 : est) / 7 * 10;
+  size_t cap = kmer_mem_cap ();
+  unsigned int count = 0;
+  kmer_shared sh;
+  ngs_pipeline pl;
+
+  memset (&sh, 0, sizeof (kmer_shared));
+  sh.bloom = bloom;
+  while (slots < want)
+    slots <<= 1;
+  while ((slots > KT_MIN_SIZE) &&
+	 (slots * (sizeof (unsigned long long) + sizeof (unsigned int)) > cap))
+    slots >>= 1;
+  kt_init (&sh.table, slots);
+
+  pl.p = p;
+  pl.in1 = in;
+  pl.in2 = NULL;
+  pl.out1 = NULL;
+  pl.out2 = NULL;
+  pl.work = kmer_sync_batch;
+  pl.emit = kmer_sync_emit;
+  pl.arg = &sh;
+  pipeline_run (&pl);
+
+  /* Merge the k-mers that did not fit-- some may also have made it
+     into the shared table before it filled, and then both tables
+     hold the sighting that first got past the Bloom filter */
+  for (i = 0; i < sh.overflow.size; ++i)
+    {
+      if (sh.overflow.keys[i] == KT_EMPTY)
+	continue;
+      count = sh.overflow.counts[i];
+      if ((bloom != NULL) && (kt_get (&sh.table, sh.overflow.keys[i]) > 0))
+	--count;
+      kt_add_count (&sh.table, sh.overflow.keys[i], count);
+    }
+  if (sh.overflow.keys != NULL)
+    kt_free (&sh.overflow);
+
+  stats->total = sh.total;
+  *table = sh.table;
+}
+
+/* Write every k-mer and its count as a tab-delimited line */
+
+void
+kmer_dump (kmer_table * t, int k, bgzf_writer * out)
+{
+  size_t i = 0;
+  char *s = NULL;
+  fq_buf o;
+
+  fq_buf_init (&o);
+  for (i = 0; i < t->size; ++i)
+    {
+      if (t->keys[i] == KT_EMPTY)
+	continue;
+      s = fq_buf_reserve (&o, k + 12);
+      kt_decode (t->keys[i], k, s);
+      o.l -= 12 - sprintf (s + k, "\t%u\n", t->counts[i]);
+      if (o.l >= BGZF_BLOCK_SIZE * 16)
+	{
+	  bgzf_write (out, o.s, o.l);
+	  o.l = 0;
+	}
+    }
+  bgzf_write (out, o.s, o.l);
+  fq_buf_free (&o);
+}
 
 int
 ngs_kmer (ngs_params * p)
 {
-  int i = 0;
-  int input_buffer_count = 0;
-  char io_buffer[BUFFSIZE][MAX_LINE_LENGTH];
-  gzFile input_fastq;
+  size_t i = 0;
+  fq_batch batch;
+  kmer_table table;
+  kmer_stats stats;
+  size_t est = 0;
+  fq_reader *input_fastq = NULL;
+  bgzf_writer *output_kmers = NULL;
+  bgzf_writer *dump = NULL;
+  bloom_filter bloom;
+  bloom_filter *filter = NULL;
+  kdb_builder db;
+  kmer_db *dbs[KMER_MAX_DBS];
+  unsigned long long *hist = NULL;
+  char *db_name = NULL;
+  FILE *report = stdout;
 
 
+  /* Map the databases to merge, which set k without a fastQ file */
+  for (i = 0; i < (size_t) p->kmer_ndbs; ++i)
+    {
+      if ((dbs[i] = kdb_open (p->kmer_dbs[i])) == NULL)
+	{
+	  fprintf (stderr, "\n\nError: cannot open the k-mer database: "
+		   "%s.\n\n", p->kmer_dbs[i]);
+	  abort ();
+	}
+      if (p->seqfile_name1[0] == '\0')
+	p->kmer_size = (int) dbs[0]->h->k;
+      if (dbs[i]->h->k != (unsigned int) p->kmer_size)
+	{
+	  fprintf (stderr, "\n\nError: k-mer database %s has k of %u, "
+		   "not %d.\n\n", p->kmer_dbs[i], dbs[i]->h->k, p->kmer_size);
+	  abort ();
+	}
+    }
+
   /* Open the first fastQ input stream */
-  if ((input_fastq = gzopen (p->seqfile_name1, "rb")) == Z_NULL)
+  if ((p->seqfile_name1[0] != '\0') &&
+      ((input_fastq = fq_open (p->seqfile_name1, p->threads,
+                               p->first_record)) == NULL))
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: "
 	       "%s.\n\n", p->seqfile_name1);
       abort ();
     }
 
+  /* If specified-- open the stream for every k-mer with its count,
+     or for the histogram of counts */
+  if (p->flag & (KMER_DUMP | KMER_HIST))
+    {
+      if ((output_kmers = bgzf_open (p->outfile_name1, p->output_format,
+				     p->compress_level, p->threads)) == NULL)
+	{
+	  fprintf (stderr, "\n\nError: cannot open the output k-mer file: "
+		   "%s.\n", p->outfile_name1);
+	  abort ();
+	}
+      if (p->flag & KMER_DUMP)
+	dump = output_kmers;
+
+      /* Keep the summary out of a dump on the standard output */
+      if (strcmp (p->outfile_name1, "-") == 0)
+	report = stderr;
+    }
+
   /* Set up interrupt trap */
   signal (SIGINT, INThandler);
 
-  /* Read through input sequence file */
-  while (1)
+  memset (&stats, 0, sizeof (kmer_stats));
+  if ((p->flag & KMER_HIST) &&
+      ((stats.hist = (unsigned long long *) calloc (KMER_HIST_SIZE,
+						    sizeof (unsigned long long)))
+       == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer "
+	     "histogram.\n\n", stderr);
+      abort ();
+    }
+  if (p->flag & KMER_DB)
+    {
+      kdb_init (&db, p->kmer_size);
+      stats.db = &db;
+    }
+
+  /* A histogram alongside merged databases is of the merged counts */
+  if (p->kmer_ndbs > 0)
+    {
+      hist = stats.hist;
+      stats.hist = NULL;
+    }
+
+  /* Sketch the k-mers when an estimate will do, and count by minimizer
+     partition when they need not all fit in one table-- without an
+     input there are only databases to merge */
+  if ((input_fastq != NULL) && (p->flag & KMER_ESTIMATE))
+    kmer_count_sketch (p, input_fastq, &stats);
+  else if ((input_fastq != NULL) && (p->kmer_parts > 0))
+    kmer_count_partitioned (p, input_fastq, dump, &stats);
+  else if (input_fastq != NULL)
     {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
+      if ((p->flag & KMER_BLOOM) || (p->threads > 1))
+	est = kmer_estimate (p, p->seqfile_name1);
 
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
+      /* Size the Bloom filter at 16 bits for each distinct k-mer
+	 estimated, which lets few k-mers seen once through */
+      if (p->flag & KMER_BLOOM)
 	{
-	  /* Get line from the fastQ input stream */
-	  if (gzgets
-	      (input_fastq, io_buffer[input_buffer_count],
-	       MAX_LINE_LENGTH) == Z_NULL)
-	    break;
-
-	  /* Iterate the counter for the number of lines currently
-	     in the buffer */
-	  ++input_buffer_count;
+	  bf_init (&bloom, (est > 0) ? est * 2 : (size_t) BF_MEM << 20);
+	  filter = &bloom;
 	}
 
-      /* Tally scores along each position in the sequence */
-      for (i = 0; i < input_buffer_count; ++i)
+      /* Pick the width of the table once-- k-mers longer than a word
+	 are counted serially in a table of their own */
+      if (p->kmer_size > KT_MAX_K)
+	kmer_count_wide (p, input_fastq, filter, dump, &stats);
+      else if ((p->threads > 1) && (est > 0))
+	kmer_count_shared (p, input_fastq, est, filter, &stats, &table);
+      else
 	{
-	  /* TODO: implement kmer counting algorithm */
+	  fq_batch_init (&batch, FQ_BLOCK_SIZE);
+	  kt_init (&table, KT_INIT_SIZE);
+
+	  /* Read through input sequence file */
+	  while (fq_read (input_fastq, &batch, FQ_BATCH_RECORDS) > 0)
+	    {
+	      /* Count the k-mers of each sequence */
+	      for (i = 0; i < batch.n; ++i)
+		stats.total += kt_count_seq (&table, batch.rec[i].seq,
+					     batch.rec[i].qual,
+					     kt_rec_len (&batch.rec[i]),
+					     p->kmer_size,
+					     p->kmer_qual + KT_PHRED, filter);
+	    }
+
+	  fq_batch_free (&batch);
 	}
 
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-	break;
+      if (filter != NULL)
+	bf_free (filter);
+      if (p->kmer_size <= KT_MAX_K)
+	{
+	  stats.distinct = table.n;
+	  if (dump != NULL)
+	    kmer_dump (&table, p->kmer_size, dump);
+	  if (stats.hist != NULL)
+	    kmer_hist_table (&table, stats.hist, p->threads);
+	  if (stats.db != NULL)
+	    kdb_add_table (stats.db, &table);
+	  kt_free (&table);
+	}
     }
 
   /* Close the fastQ input stream */
-  gzclose (input_fastq);
+  if (input_fastq != NULL)
+    fq_close (input_fastq);
+
+  /* Write the sorted database, merged with those named */
+  if (stats.db != NULL)
+    {
+      if ((db_name = (char *) malloc (strlen (p->outfile_prefix)
+				      + sizeof (KDB_SUFFIX))) == NULL)
+	{
+	  fputs ("\n\nError: memory allocation failure for k-mer "
+		 "database.\n\n", stderr);
+	  abort ();
+	}
+      sprintf (db_name, "%s%s", p->outfile_prefix, KDB_SUFFIX);
+      if (p->kmer_ndbs > 0)
+	{
+	  stats.hist = hist;
+	  stats.distinct = kdb_merge (stats.db, dbs, p->kmer_ndbs,
+				      p->kmer_size, db_name, stats.hist);
+	  for (i = 0; i < (size_t) p->kmer_ndbs; ++i)
+	    kdb_close (dbs[i]);
+	}
+      else
+	kdb_write (stats.db, p->kmer_size, db_name);
+      kdb_free (stats.db);
+      free (db_name);
+    }
+
+  if (stats.hist != NULL)
+    kmer_hist_write (stats.hist, output_kmers);
+  if (output_kmers != NULL)
+    bgzf_close (output_kmers);
+
+  fprintf (report, "k-mer size:\t%d\n", p->kmer_size);
+  fprintf (report, "total k-mers:\t%llu\n", stats.total);
+  if (p->kmer_ndbs > 0)
+    fprintf (report, "merged databases:\t%d\n", p->kmer_ndbs);
+  if (p->flag & KMER_ESTIMATE)
+    {
+      fprintf (report, "distinct k-mers (estimate):\t%llu\n",
+	       stats.distinct);
+      if (p->flag & KMER_COUNT_MIN)
+	fprintf (report, "repeated k-mers (estimate):\t%llu\n", stats.solid);
+    }
+  else if (p->flag & KMER_BLOOM)
+    fprintf (report, "repeated k-mers:\t%llu\n", stats.distinct);
+  else
+    fprintf (report, "distinct k-mers:\t%llu\n", stats.distinct);
+  if (stats.hist != NULL)
+    {
+      kmer_hist_summary (stats.hist, p->kmer_size, report);
+      free (stats.hist);
+    }
 
   return 0;
 }
@@ -0,0 +1,68 @@
+/* kmer - Counting modes shared by the k-mer commands
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef KMER_H
+#define KMER_H
+
+#include "ngscmd.h"
+#include "bgzf.h"
+#include "fastq.h"
+#include "kmertab.h"
+#include "kmerdb.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define KMER_MINIMIZER 11      /* length of the minimizers of super-k-mers */
+#define KMER_PARTITIONS 256    /* default number of super-k-mer partitions */
+#define KMER_HIST_SIZE 10001   /* histogram bins, the last for the rest */
+#define KMER_MAX_K 127         /* longest k-mer of the widest table */
+#define KMER_SAMPLE_SIZE 0x2000000  /* bytes of reads sketched for an estimate */
+#define KMER_MIN_SHARE 0x1000  /* fewest bytes of -M for one partition */
+#define KMER_RUN_CHUNK 0x10000 /* bytes of spilled run records at a time */
+
+  /* Totals over all k-mers counted */
+  typedef struct _kmer_stats
+  {
+    unsigned long long total;     /* number of k-mers */
+    unsigned long long distinct;  /* number of distinct k-mers */
+    unsigned long long solid;     /* distinct k-mers seen more than once */
+    unsigned long long *hist;     /* abundance histogram, NULL for none */
+    kdb_builder *db;              /* database to fill, NULL for none */
+  } kmer_stats;
+
+
+/* Function prototypes */
+  extern void kmer_dump (kmer_table *, int, bgzf_writer *);
+  extern void kmer_count_partitioned (ngs_params *, fq_reader *,
+                                      bgzf_writer *, kmer_stats *);
+  extern void kmer_hist_table (const kmer_table *, unsigned long long *, int);
+  extern void kmer_hist_write (const unsigned long long *, bgzf_writer *);
+  extern void kmer_hist_summary (const unsigned long long *, int, FILE *);
+  extern void kmer_count_sketch (ngs_params *, fq_reader *, kmer_stats *);
+  extern size_t kmer_estimate (ngs_params *, const char *);
+  extern size_t kmer_mem_cap (void);
+  extern void kmer_count_wide (ngs_params *, fq_reader *, bloom_filter *,
+                               bgzf_writer *, kmer_stats *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* KMER_H */
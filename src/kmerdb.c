@@ -0,0 +1,643 @@
+/* kmerdb - Sorted, memory-mappable database of k-mer counts
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ngscmd.h"
+#include "kmer.h"
+#include "spill.h"
+
+/* Define constants */
+#define KDB_RADIX_BITS 16
+#define KDB_MIN_BLOCK 0x100          /* fewest k-mers read from a run at once */
+
+static const char kdb_magic[8] = { 'N', 'G', 'S', 'K', 'D', 'B', '\0', '\1' };
+
+/* One sorted run of a merge-- a database, or a run of a builder read
+   from its file a block at a time */
+typedef struct _kdb_run
+{
+  const unsigned long long *keys;
+  const unsigned int *counts;  /* NULL for a database */
+  const kmer_db *db;
+  size_t n;
+  size_t i;
+  FILE *file;                  /* NULL for a database */
+  unsigned long long keys_off; /* of the next block */
+  unsigned long long counts_off;
+  unsigned long long left;     /* k-mers after this block */
+  size_t block;
+  unsigned long long *key_buf;
+  unsigned int *count_buf;
+} kdb_run;
+
+static void kdb_sort (unsigned long long *, unsigned int *, size_t, int);
+static void kdb_spill (kdb_builder *, unsigned long long *, unsigned int *,
+                       size_t);
+static void kdb_fill (kdb_run *);
+static void kdb_header_init (kdb_header *, int, size_t, unsigned int);
+static void kdb_sift (kdb_run **, int, int);
+static void kdb_check_host (void);
+static void kdb_put (FILE *, const void *, size_t, const char *);
+
+/* Initialize an empty builder of k-mers of size k */
+
+void
+kdb_init (kdb_builder *b, int k)
+{
+  memset (b, 0, sizeof (kdb_builder));
+  b->k = k;
+}
+
+/* Sort the k-mers of a count table and spill them to the file of a
+   builder, as runs of at most KDB_RUN_SIZE k-mers so that a large table
+   is not held twice */
+
+void
+kdb_add_table (kdb_builder *b, const kmer_table *t)
+{
+  size_t i = 0;
+  size_t n = 0;
+  size_t m = (t->n < KDB_RUN_SIZE) ? t->n : KDB_RUN_SIZE;
+  unsigned long long *keys = NULL;
+  unsigned int *counts = NULL;
+
+  if (t->n == 0)
+    return;
+  keys = (unsigned long long *) malloc (m * sizeof (unsigned long long));
+  counts = (unsigned int *) malloc (m * sizeof (unsigned int));
+  if ((keys == NULL) || (counts == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer "
+             "database.\n\n", stderr);
+      abort ();
+    }
+
+  for (i = 0; i < t->size; ++i)
+    {
+      if (t->keys[i] == KT_EMPTY)
+        continue;
+      keys[n] = t->keys[i];
+      counts[n++] = t->counts[i];
+      if (n == m)
+        {
+          kdb_spill (b, keys, counts, n);
+          n = 0;
+        }
+    }
+  if (n > 0)
+    kdb_spill (b, keys, counts, n);
+
+  free (keys);
+  free (counts);
+}
+
+/* Write the k-mers of a builder as a database-- a merge of its runs
+   alone */
+
+void
+kdb_write (kdb_builder *b, int k, const char *name)
+{
+  kdb_merge (b, NULL, 0, k, name, NULL);
+}
+
+/* Merge the sorted runs of a builder with the k-mers of databases of
+   the same k into a new database, adding the counts of a k-mer found in
+   more than one-- the runs and databases are read once, front to back,
+   through a heap of their next k-mers, and only the index and a block
+   of each run are held in memory.  The new
+   database is written under a temporary name and renamed when whole,
+   so it may replace one of the databases merged.  Fills hist, if not
+   NULL, with the merged counts and returns the number of k-mers */
+
+unsigned long long
+kdb_merge (kdb_builder *b, kmer_db **dbs, int ndbs, int k, const char *name,
+           unsigned long long *hist)
+{
+  int i = 0;
+  int nheap = 0;
+  int nruns = 0;
+  size_t j = 0;
+  size_t block = 0;
+  size_t nkeys = 0;
+  size_t nindex = 0;
+  size_t mindex = 0;
+  unsigned int c = 0;
+  unsigned int max = 0;
+  unsigned int count = 0;
+  unsigned long long n = 0;
+  unsigned long long key = 0;
+  unsigned long long *index = NULL;
+  unsigned long long *keys = NULL;
+  unsigned int *counts = NULL;
+  unsigned char *buf = NULL;
+  char *tmp_name = NULL;
+  kdb_run *runs = NULL;
+  kdb_run **heap = NULL;
+  kdb_run *r = NULL;
+  kdb_header h;
+  FILE *fp = NULL;
+  FILE *spill = NULL;
+
+  kdb_check_host ();
+
+  nruns = b->nruns + ndbs;
+  runs = (kdb_run *) calloc (nruns + 1, sizeof (kdb_run));
+  heap = (kdb_run **) malloc ((nruns + 1) * sizeof (kdb_run *));
+  keys = (unsigned long long *) malloc (KT_INIT_SIZE
+                                        * sizeof (unsigned long long));
+  counts = (unsigned int *) malloc (KT_INIT_SIZE * sizeof (unsigned int));
+  tmp_name = (char *) malloc (strlen (name) + 5);
+  if ((runs == NULL) || (heap == NULL) || (keys == NULL) ||
+      (counts == NULL) || (tmp_name == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer database.\n\n",
+             stderr);
+      abort ();
+    }
+
+  /* The runs of the builder share a block of k-mers as big as the one
+     written at a time, and each database is a run-- all in the heap
+     while they have k-mers left */
+  if ((b->file != NULL) && (fflush (b->file) != 0))
+    {
+      fputs ("\n\nError: cannot write to a temporary file.\n\n", stderr);
+      abort ();
+    }
+  block = (b->nruns > 0) ? KT_INIT_SIZE / b->nruns : 0;
+  block = (block < KDB_MIN_BLOCK) ? KDB_MIN_BLOCK : block;
+  for (i = 0; i < b->nruns; ++i)
+    {
+      r = &runs[i];
+      r->file = b->file;
+      r->keys_off = b->runs[i].off;
+      r->counts_off = r->keys_off + b->runs[i].n
+        * sizeof (unsigned long long);
+      r->left = b->runs[i].n;
+      r->block = (r->left < block) ? (size_t) r->left : block;
+      r->key_buf = (unsigned long long *) malloc (r->block
+                                                  * sizeof (unsigned long long));
+      r->count_buf = (unsigned int *) malloc (r->block
+                                              * sizeof (unsigned int));
+      if ((r->key_buf == NULL) || (r->count_buf == NULL))
+        {
+          fputs ("\n\nError: memory allocation failure for k-mer "
+                 "database.\n\n", stderr);
+          abort ();
+        }
+      kdb_fill (r);
+    }
+  for (i = 0; i < ndbs; ++i)
+    {
+      r = &runs[b->nruns + i];
+      r->keys = dbs[i]->keys;
+      r->db = dbs[i];
+      r->n = (size_t) dbs[i]->h->n;
+      posix_madvise (dbs[i]->map, dbs[i]->map_len, POSIX_MADV_SEQUENTIAL);
+    }
+  for (i = 0; i < nruns; ++i)
+    if (runs[i].n > 0)
+      heap[nheap++] = &runs[i];
+  for (i = nheap / 2 - 1; i >= 0; --i)
+    kdb_sift (heap, nheap, i);
+
+  /* The k-mers go straight to the database after room for the header,
+     and the counts to a temporary file until their width is known */
+  sprintf (tmp_name, "%s.tmp", name);
+  if ((fp = fopen (tmp_name, "wb")) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the k-mer database: %s.\n\n",
+               tmp_name);
+      abort ();
+    }
+  memset (&h, 0, sizeof (kdb_header));
+  kdb_put (fp, &h, sizeof (kdb_header), tmp_name);
+  spill = spill_open ();
+
+  while (nheap > 0)
+    {
+      r = heap[0];
+      key = r->keys[r->i];
+      c = (r->counts != NULL) ? r->counts[r->i] : kdb_count (r->db, r->i);
+      if ((++r->i == r->n) && (r->left > 0))
+        kdb_fill (r);
+      else if (r->i == r->n)
+        heap[0] = heap[--nheap];
+      kdb_sift (heap, nheap, 0);
+
+      /* Add to the count of the k-mer before, or start a new one */
+      if ((n > 0) && (key == keys[nkeys - 1]))
+        {
+          counts[nkeys - 1] = (counts[nkeys - 1] > KT_MAX_COUNT - c) ?
+            KT_MAX_COUNT : counts[nkeys - 1] + c;
+          continue;
+        }
+      if (nkeys == KT_INIT_SIZE)
+        {
+          /* Hold the last k-mer back, as it may have counts to come */
+          for (j = 0; j < nkeys - 1; ++j)
+            {
+              count = counts[j];
+              max = (count > max) ? count : max;
+              if (hist != NULL)
+                ++hist[(count < KMER_HIST_SIZE - 1) ?
+                       count : KMER_HIST_SIZE - 1];
+            }
+          kdb_put (fp, keys, (nkeys - 1) * sizeof (unsigned long long),
+                   tmp_name);
+          spill_write (spill, counts, (nkeys - 1) * sizeof (unsigned int));
+          keys[0] = keys[nkeys - 1];
+          counts[0] = counts[nkeys - 1];
+          nkeys = 1;
+        }
+      if ((n & ((1ULL << KDB_INDEX_SHIFT) - 1)) == 0)
+        {
+          if (nindex == mindex)
+            {
+              mindex = mindex ? mindex << 1 : KT_MIN_SIZE;
+              if ((index = (unsigned long long *)
+                   realloc (index, mindex * sizeof (unsigned long long)))
+                  == NULL)
+                {
+                  fputs ("\n\nError: memory allocation failure for k-mer "
+                         "database.\n\n", stderr);
+                  abort ();
+                }
+            }
+          index[nindex++] = key;
+        }
+      keys[nkeys] = key;
+      counts[nkeys++] = c;
+      ++n;
+    }
+  for (j = 0; j < nkeys; ++j)
+    {
+      count = counts[j];
+      max = (count > max) ? count : max;
+      if (hist != NULL)
+        ++hist[(count < KMER_HIST_SIZE - 1) ? count : KMER_HIST_SIZE - 1];
+    }
+  kdb_put (fp, keys, nkeys * sizeof (unsigned long long), tmp_name);
+  spill_write (spill, counts, nkeys * sizeof (unsigned int));
+  kdb_put (fp, index, nindex * sizeof (unsigned long long), tmp_name);
+
+  /* Narrow the counts a block at a time */
+  kdb_header_init (&h, k, (size_t) n, max);
+  buf = (unsigned char *) keys;
+  rewind (spill);
+  for (key = 0; key < n; key += j)
+    {
+      j = (n - key < KT_INIT_SIZE) ? (size_t) (n - key) : KT_INIT_SIZE;
+      spill_read (spill, counts, j * sizeof (unsigned int));
+      for (nkeys = 0; nkeys < j; ++nkeys)
+        memcpy (buf + nkeys * h.count_width, &counts[nkeys], h.count_width);
+      kdb_put (fp, buf, j * h.count_width, tmp_name);
+    }
+  fclose (spill);
+
+  /* Then the header, now that the counts are known */
+  if ((fseek (fp, 0, SEEK_SET) != 0) ||
+      (fwrite (&h, 1, sizeof (kdb_header), fp) != sizeof (kdb_header)) ||
+      (fclose (fp) != 0) || (rename (tmp_name, name) != 0))
+    {
+      fprintf (stderr, "\n\nError: cannot write the k-mer database: "
+               "%s.\n\n", name);
+      abort ();
+    }
+
+  for (i = 0; i < b->nruns; ++i)
+    {
+      free (runs[i].key_buf);
+      free (runs[i].count_buf);
+    }
+  free (runs);
+  free (heap);
+  free (keys);
+  free (counts);
+  free (index);
+  free (tmp_name);
+
+  return n;
+}
+
+/* Free the memory held by a builder */
+
+void
+kdb_free (kdb_builder *b)
+{
+  if (b->file != NULL)
+    fclose (b->file);
+  free (b->runs);
+  memset (b, 0, sizeof (kdb_builder));
+}
+
+/* Map a database into memory-- NULL if it cannot be opened, and fatal
+   if it is not a whole database */
+
+kmer_db *
+kdb_open (const char *name)
+{
+  int fd = 0;
+  struct stat st;
+  kmer_db *db = NULL;
+  const kdb_header *h = NULL;
+
+  kdb_check_host ();
+  if ((fd = open (name, O_RDONLY)) < 0)
+    return NULL;
+  if ((fstat (fd, &st) != 0) || (st.st_size < (off_t) sizeof (kdb_header)))
+    {
+      close (fd);
+      fprintf (stderr, "\n\nError: not a k-mer database: %s.\n\n", name);
+      abort ();
+    }
+
+  if ((db = (kmer_db *) calloc (1, sizeof (kmer_db))) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer database.\n\n",
+             stderr);
+      abort ();
+    }
+  db->map_len = (size_t) st.st_size;
+  db->map = mmap (NULL, db->map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (db->map == MAP_FAILED)
+    {
+      fprintf (stderr, "\n\nError: cannot map the k-mer database: %s.\n\n",
+               name);
+      abort ();
+    }
+  posix_madvise (db->map, db->map_len, POSIX_MADV_RANDOM);
+
+  /* Every section has to lie within the file */
+  h = db->h = (const kdb_header *) db->map;
+  if ((memcmp (h->magic, kdb_magic, sizeof (kdb_magic)) != 0) ||
+      (h->k < 1) || (h->k > 32) ||
+      ((h->count_width != 1) && (h->count_width != 2) &&
+       (h->count_width != 4)) ||
+      (h->nindex != (h->n + (1ULL << h->index_shift) - 1) >> h->index_shift)
+      || (h->keys_off != sizeof (kdb_header)) ||
+      (h->index_off != h->keys_off + h->n * sizeof (unsigned long long)) ||
+      (h->counts_off != h->index_off + h->nindex
+       * sizeof (unsigned long long)) ||
+      (h->counts_off + h->n * h->count_width != db->map_len))
+    {
+      fprintf (stderr, "\n\nError: not a k-mer database: %s.\n\n", name);
+      abort ();
+    }
+  db->keys = (const unsigned long long *) ((const char *) db->map
+                                           + h->keys_off);
+  db->index = (const unsigned long long *) ((const char *) db->map
+                                            + h->index_off);
+  db->counts = (const unsigned char *) db->map + h->counts_off;
+
+  return db;
+}
+
+/* Return the count of a packed canonical k-mer, zero if it is absent--
+   a binary search of the index picks the block of k-mers to search */
+
+unsigned int
+kdb_get (const kmer_db *db, unsigned long long kmer)
+{
+  size_t lo = 0;
+  size_t hi = (size_t) db->h->nindex;
+  size_t mid = 0;
+
+  /* Find the last index entry at or below the k-mer */
+  if ((hi == 0) || (kmer < db->index[0]))
+    return 0;
+  while (hi - lo > 1)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (db->index[mid] <= kmer)
+        lo = mid;
+      else
+        hi = mid;
+    }
+
+  /* Then the k-mer within its block */
+  hi = (lo + 1) << db->h->index_shift;
+  if (hi > db->h->n)
+    hi = (size_t) db->h->n;
+  lo <<= db->h->index_shift;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (db->keys[mid] < kmer)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return ((lo < db->h->n) && (db->keys[lo] == kmer)) ? kdb_count (db, lo) : 0;
+}
+
+/* Unmap a database */
+
+void
+kdb_close (kmer_db *db)
+{
+  munmap (db->map, db->map_len);
+  free (db);
+}
+
+/* Sort n k-mers and their counts in place by k-mer, a 16-bit digit at
+   a time from the lowest of the 2k bits of a k-mer */
+
+static void
+kdb_sort (unsigned long long *keys, unsigned int *counts, size_t n, int k)
+{
+  int shift = 0;
+  size_t i = 0;
+  size_t sum = 0;
+  size_t digit = 0;
+  size_t *pos = NULL;
+  unsigned long long *from_keys = keys;
+  unsigned int *from_counts = counts;
+  unsigned long long *to_keys = NULL;
+  unsigned int *to_counts = NULL;
+  unsigned long long *tk = NULL;
+  unsigned int *tc = NULL;
+
+  pos = (size_t *) malloc (sizeof (size_t) << KDB_RADIX_BITS);
+  to_keys = (unsigned long long *) malloc ((n ? n : 1)
+                                           * sizeof (unsigned long long));
+  to_counts = (unsigned int *) malloc ((n ? n : 1) * sizeof (unsigned int));
+  if ((pos == NULL) || (to_keys == NULL) || (to_counts == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer database.\n\n",
+             stderr);
+      abort ();
+    }
+  tk = to_keys;
+  tc = to_counts;
+
+  for (shift = 0; shift < 2 * k; shift += KDB_RADIX_BITS)
+    {
+      memset (pos, 0, sizeof (size_t) << KDB_RADIX_BITS);
+      for (i = 0; i < n; ++i)
+        ++pos[(from_keys[i] >> shift) & ((1 << KDB_RADIX_BITS) - 1)];
+      for (sum = 0, i = 0; i < ((size_t) 1 << KDB_RADIX_BITS); ++i)
+        {
+          digit = pos[i];
+          pos[i] = sum;
+          sum += digit;
+        }
+      for (i = 0; i < n; ++i)
+        {
+          digit = pos[(from_keys[i] >> shift) & ((1 << KDB_RADIX_BITS) - 1)]++;
+          to_keys[digit] = from_keys[i];
+          to_counts[digit] = from_counts[i];
+        }
+      from_keys = to_keys;
+      from_counts = to_counts;
+      to_keys = (to_keys == keys) ? tk : keys;
+      to_counts = (to_counts == counts) ? tc : counts;
+    }
+
+  /* An odd number of digits leaves the sorted k-mers in the copy */
+  if (from_keys != keys)
+    {
+      memcpy (keys, from_keys, n * sizeof (unsigned long long));
+      memcpy (counts, from_counts, n * sizeof (unsigned int));
+    }
+
+  free (pos);
+  free (tk);
+  free (tc);
+}
+
+/* Sort n k-mers and their counts and append them to the file of a
+   builder as a run */
+
+static void
+kdb_spill (kdb_builder *b, unsigned long long *keys, unsigned int *counts,
+           size_t n)
+{
+  kdb_span *run = NULL;
+
+  if (b->nruns == b->mruns)
+    {
+      b->mruns = b->mruns ? b->mruns << 1 : 16;
+      if ((b->runs = (kdb_span *) realloc (b->runs, b->mruns
+                                           * sizeof (kdb_span))) == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for k-mer "
+                 "database.\n\n", stderr);
+          abort ();
+        }
+    }
+  kdb_sort (keys, counts, n, b->k);
+
+  if (b->file == NULL)
+    b->file = spill_open ();
+  run = &b->runs[b->nruns++];
+  run->off = b->len;
+  run->n = n;
+  spill_write (b->file, keys, n * sizeof (unsigned long long));
+  spill_write (b->file, counts, n * sizeof (unsigned int));
+  b->len += n * (sizeof (unsigned long long) + sizeof (unsigned int));
+}
+
+/* Read the next block of a run of a builder */
+
+static void
+kdb_fill (kdb_run *r)
+{
+  r->n = (r->left < r->block) ? (size_t) r->left : r->block;
+  r->i = 0;
+  spill_pread (r->file, r->key_buf, r->n * sizeof (unsigned long long),
+               r->keys_off);
+  spill_pread (r->file, r->count_buf, r->n * sizeof (unsigned int),
+               r->counts_off);
+  r->keys_off += r->n * sizeof (unsigned long long);
+  r->counts_off += r->n * sizeof (unsigned int);
+  r->left -= r->n;
+  r->keys = r->key_buf;
+  r->counts = r->count_buf;
+}
+
+/* Fill in the header of a database of n k-mers, the largest count max */
+
+static void
+kdb_header_init (kdb_header *h, int k, size_t n, unsigned int max)
+{
+  memset (h, 0, sizeof (kdb_header));
+  memcpy (h->magic, kdb_magic, sizeof (kdb_magic));
+  h->k = (unsigned int) k;
+  h->flags = KDB_CANONICAL;
+  h->count_width = (max < 0x100) ? 1 : ((max < 0x10000) ? 2 : 4);
+  h->index_shift = KDB_INDEX_SHIFT;
+  h->n = n;
+  h->nindex = (n + (1 << KDB_INDEX_SHIFT) - 1) >> KDB_INDEX_SHIFT;
+  h->keys_off = sizeof (kdb_header);
+  h->index_off = h->keys_off + h->n * sizeof (unsigned long long);
+  h->counts_off = h->index_off + h->nindex * sizeof (unsigned long long);
+}
+
+/* Move a run down a heap of n runs until its next k-mer is no greater
+   than those of its children */
+
+static void
+kdb_sift (kdb_run **heap, int n, int i)
+{
+  int child = 0;
+  kdb_run *r = heap[i];
+
+  while ((child = 2 * i + 1) < n)
+    {
+      if ((child + 1 < n) && (heap[child + 1]->keys[heap[child + 1]->i]
+                              < heap[child]->keys[heap[child]->i]))
+        ++child;
+      if (r->keys[r->i] <= heap[child]->keys[heap[child]->i])
+        break;
+      heap[i] = heap[child];
+      i = child;
+    }
+  heap[i] = r;
+}
+
+/* Databases are little-endian and mapped as they are */
+
+static void
+kdb_check_host (void)
+{
+  unsigned int one = 1;
+
+  if (*(unsigned char *) &one != 1)
+    {
+      fputs ("\n\nError: k-mer databases need a little-endian host.\n\n",
+             stderr);
+      abort ();
+    }
+}
+
+/* Write len bytes to a database */
+
+static void
+kdb_put (FILE *fp, const void *s, size_t len, const char *name)
+{
+  if (fwrite (s, 1, len, fp) != len)
+    {
+      fprintf (stderr, "\n\nError: cannot write the k-mer database: "
+               "%s.\n\n", name);
+      abort ();
+    }
+}
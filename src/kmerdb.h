@@ -0,0 +1,122 @@
+/* kmerdb - Sorted, memory-mappable database of k-mer counts
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef KMERDB_H
+#define KMERDB_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "kmertab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define KDB_SUFFIX ".kdb"            /* appended to the output prefix */
+#define KDB_CANONICAL 0x1            /* k-mers are the lesser strand */
+#define KDB_INDEX_SHIFT 8            /* one index entry per 256 k-mers */
+#define KDB_RUN_SIZE KT_INIT_SIZE    /* most k-mers sorted into one run */
+
+  /* The 64-byte header of a database file, which is little-endian--
+     the packed k-mers follow in ascending order, then every
+     2^index_shift-th k-mer as an index, then the counts in the same
+     order as the k-mers, count_width bytes each */
+  typedef struct _kdb_header
+  {
+    char magic[8];
+    unsigned int k;
+    unsigned int flags;
+    unsigned int count_width;    /* 1, 2 or 4 */
+    unsigned int index_shift;
+    unsigned long long n;        /* number of k-mers */
+    unsigned long long nindex;   /* number of index entries */
+    unsigned long long keys_off;
+    unsigned long long index_off;
+    unsigned long long counts_off;
+  } kdb_header;
+
+  /* A database mapped into memory */
+  typedef struct _kmer_db
+  {
+    const kdb_header *h;
+    const unsigned long long *keys;
+    const unsigned long long *index;
+    const unsigned char *counts;
+    void *map;
+    size_t map_len;
+  } kmer_db;
+
+  /* A sorted run of k-mers in the temporary file of a builder, their
+     counts following in the same order */
+  typedef struct _kdb_span
+  {
+    unsigned long long off;
+    size_t n;
+  } kdb_span;
+
+  /* K-mers and counts gathered a count table at a time for a new
+     database-- each table is sorted on its own and spilled as a run */
+  typedef struct _kdb_builder
+  {
+    int k;
+    FILE *file;                  /* the runs, NULL if none */
+    unsigned long long len;      /* bytes written to the file */
+    kdb_span *runs;
+    int nruns;
+    int mruns;
+  } kdb_builder;
+
+
+/* Inline functions */
+
+/* Return the count of the i-th k-mer of a database */
+  static inline unsigned int
+  kdb_count (const kmer_db *db, size_t i)
+  {
+    const unsigned char *c = db->counts + i * db->h->count_width;
+
+    switch (db->h->count_width)
+      {
+      case 1:
+        return c[0];
+      case 2:
+        return c[0] | ((unsigned int) c[1] << 8);
+      default:
+        return c[0] | ((unsigned int) c[1] << 8) |
+          ((unsigned int) c[2] << 16) | ((unsigned int) c[3] << 24);
+      }
+  }
+
+
+/* Function prototypes */
+  extern void kdb_init (kdb_builder *, int);
+  extern void kdb_add_table (kdb_builder *, const kmer_table *);
+  extern void kdb_write (kdb_builder *, int, const char *);
+  extern unsigned long long kdb_merge (kdb_builder *, kmer_db **, int, int,
+                                       const char *, unsigned long long *);
+  extern void kdb_free (kdb_builder *);
+  extern kmer_db *kdb_open (const char *);
+  extern unsigned int kdb_get (const kmer_db *, unsigned long long);
+  extern void kdb_close (kmer_db *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* KMERDB_H */
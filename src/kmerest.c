@@ -0,0 +1,267 @@
+/* kmerest - Estimates of the number of distinct k-mers in small memory
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kmer.h"
+#include "pipeline.h"
+#include "sketch.h"
+
+/* The sketches of the whole input-- each batch is sketched on its own
+   and folded in by kmer_sketch_emit, except for the count-min sketch,
+   which the workers share */
+typedef struct _kmer_sketch
+{
+  hll_sketch all;              /* every k-mer */
+  hll_sketch solid;            /* k-mers counted more than once */
+  cm_sketch cm;
+  int use_cm;
+  unsigned long long total;
+} kmer_sketch;
+
+static void kmer_sketch_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                               fq_buf *, fq_buf *);
+static unsigned long long kmer_sketch_seq (kmer_sketch *, const char *,
+                                           const char *, size_t, int, int,
+                                           hll_sketch *, hll_sketch *);
+static void kmer_sketch_emit (void *, fq_buf *, fq_buf *);
+static size_t kmer_cm_mem (ngs_params *);
+
+/* Estimate the number of distinct k-mers with a HyperLogLog sketch of
+   their hashes, in a fixed 16K whatever the size of the input.  With
+   KMER_COUNT_MIN, k-mers are also counted in a count-min sketch and the
+   ones it has seen twice go into a second HyperLogLog sketch-- an
+   estimate of the k-mers that are not sequencing errors.  A sketch
+   that fills past CM_MAX_FILL anyway takes most new k-mers for repeated
+   ones, and then no estimate of those is made */
+
+void
+kmer_count_sketch (ngs_params *p, fq_reader *in, kmer_stats *stats)
+{
+  kmer_sketch sk;
+  ngs_pipeline pl;
+
+  memset (&sk, 0, sizeof (kmer_sketch));
+  hll_init (&sk.all);
+  hll_init (&sk.solid);
+  if ((sk.use_cm = (p->flag & KMER_COUNT_MIN) != 0))
+    cm_init (&sk.cm, kmer_cm_mem (p));
+
+  pl.p = p;
+  pl.in1 = in;
+  pl.in2 = NULL;
+  pl.out1 = NULL;
+  pl.out2 = NULL;
+  pl.work = kmer_sketch_batch;
+  pl.emit = kmer_sketch_emit;
+  pl.arg = &sk;
+  pipeline_run (&pl);
+
+  stats->total = sk.total;
+  stats->distinct = (unsigned long long) (hll_estimate (&sk.all) + 0.5);
+  if (sk.use_cm)
+    {
+      stats->solid = (unsigned long long) (hll_estimate (&sk.solid) + 0.5);
+
+      /* A new k-mer looks repeated when all its counters are taken */
+      if (cm_fill (&sk.cm) > CM_MAX_FILL)
+        {
+          fprintf (stderr, "Warning: the count-min sketch is %.0f%% full, "
+                   "so the repeated k-mers are not estimated-- raise -M.\n",
+                   100.0 * cm_fill (&sk.cm));
+          p->flag &= ~KMER_COUNT_MIN;
+        }
+      cm_free (&sk.cm);
+    }
+}
+
+/* Estimate the number of distinct k-mers in a fastQ file from a
+   HyperLogLog sketch of its first KMER_SAMPLE_SIZE bytes of reads,
+   scaled up to the size of the file-- gzipped fastQ is taken to inflate
+   four fold, and half of fastQ to be bases.  Repeated k-mers only grow
+   more common further into a file, so this overstates the count, but
+   never past one k-mer for each base.  k-mers longer than a word are
+   sketched by their first KT_MAX_K bases.  Returns 0 if the file is
+   the standard input or cannot be read */
+
+size_t
+kmer_estimate (ngs_params *p, const char *name)
+{
+  size_t i = 0;
+  size_t n = 0;
+  int k = (p->kmer_size < KT_MAX_K) ? p->kmer_size : KT_MAX_K;
+  unsigned char magic[2] = { 0, 0 };
+  unsigned long long size = 0;
+  unsigned long long seen = 0;
+  double est = 0.0;
+  FILE *fp = NULL;
+  fq_reader *in = NULL;
+  fq_record *r = NULL;
+  fq_batch batch;
+  kmer_sketch sk;
+  struct stat st;
+
+  if ((strcmp (name, "-") == 0) || (stat (name, &st) != 0) ||
+      !S_ISREG (st.st_mode) || ((fp = fopen (name, "rb")) == NULL))
+    return 0;
+  if (fread (magic, 1, 2, fp) != 2)
+    magic[0] = 0;
+  fclose (fp);
+  size = (unsigned long long) st.st_size;
+  if ((magic[0] == 0x1f) && (magic[1] == 0x8b))
+    size *= 4;
+  if ((in = fq_open (name, 1, 0)) == NULL)
+    return 0;
+
+  memset (&sk, 0, sizeof (kmer_sketch));
+  hll_init (&sk.all);
+  fq_batch_init (&batch, FQ_BLOCK_SIZE);
+  while ((seen < KMER_SAMPLE_SIZE) &&
+         ((n = fq_read (in, &batch, FQ_BATCH_RECORDS)) > 0))
+    {
+      for (i = 0; i < batch.n; ++i)
+        {
+          r = &batch.rec[i];
+          kmer_sketch_seq (&sk, r->seq, r->qual, kt_rec_len (r), k,
+                           p->kmer_qual + KT_PHRED, &sk.all, NULL);
+          seen += r->id_len + r->seq_len + r->plus_len + r->qual_len + 4;
+        }
+    }
+  fq_batch_free (&batch);
+  fq_close (in);
+
+  est = hll_estimate (&sk.all);
+  if ((n > 0) && (seen > 0) && (seen < size))
+    est *= (double) size / (double) seen;
+  if (est > (double) (size / 2))
+    est = (double) (size / 2);
+
+  return (size_t) est;
+}
+
+/* Return the memory a table or sketch sized from an estimate may take--
+   half of the physical memory, or no limit if that is unknown */
+
+size_t
+kmer_mem_cap (void)
+{
+  long pages = sysconf (_SC_PHYS_PAGES);
+  long page_size = sysconf (_SC_PAGESIZE);
+
+  if ((pages <= 0) || (page_size <= 0))
+    return (size_t) -1;
+
+  return (size_t) pages / 2 * (size_t) page_size;
+}
+
+/* Return the bytes of the count-min sketch-- CM_MEM megabytes, or more
+   if -M asks for it.  The sketch stays the same size whatever the input,
+   and warns rather than counts once it fills past CM_MAX_FILL */
+
+static size_t
+kmer_cm_mem (ngs_params *p)
+{
+  if (p->mem_limit > CM_MEM)
+    return (size_t) p->mem_limit << 20;
+
+  return (size_t) CM_MEM << 20;
+}
+
+/* Sketch a batch of reads-- out1 receives the HyperLogLog sketch of
+   the batch followed by its k-mer count, and out2 the sketch of the
+   k-mers seen more than once */
+
+static void
+kmer_sketch_batch (ngs_params *p, void *arg, fq_batch *in1, fq_batch *in2,
+                   fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  unsigned long long total = 0;
+  kmer_sketch *sk = (kmer_sketch *) arg;
+  hll_sketch *all = NULL;
+  hll_sketch *solid = NULL;
+
+  (void) in2;
+  all = (hll_sketch *) fq_buf_reserve (out1, sizeof (hll_sketch));
+  hll_init (all);
+  if (sk->use_cm)
+    {
+      solid = (hll_sketch *) fq_buf_reserve (out2, sizeof (hll_sketch));
+      hll_init (solid);
+    }
+  for (i = 0; i < in1->n; ++i)
+    total += kmer_sketch_seq (sk, in1->rec[i].seq, in1->rec[i].qual,
+                              kt_rec_len (&in1->rec[i]), p->kmer_size,
+                              p->kmer_qual + KT_PHRED, all, solid);
+  fq_buf_put (out1, (const char *) &total, sizeof (total));
+}
+
+/* Add the hashes of the canonical k-mers of a sequence to the sketches
+   and return the number of k-mers */
+
+static unsigned long long
+kmer_sketch_seq (kmer_sketch *sk, const char *seq, const char *qual,
+                 size_t len, int k, int qmin, hll_sketch *all,
+                 hll_sketch *solid)
+{
+  size_t i = 0;
+  int c = 0;
+  int valid = 0;
+  int shift = 2 * (k - 1);
+  unsigned long long fwd = 0;
+  unsigned long long rev = 0;
+  unsigned long long h = 0;
+  unsigned long long total = 0;
+  unsigned long long mask = (k < 32) ? (1ULL << (2 * k)) - 1 : ~0ULL;
+
+  for (i = 0; i < len; ++i)
+    {
+      if ((c = kt_base (seq, qual, i, qmin)) == 0)
+        {
+          valid = 0;
+          continue;
+        }
+      --c;
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((unsigned long long) (3 - c) << shift);
+      if (++valid >= k)
+        {
+          h = kt_hash ((fwd < rev) ? fwd : rev);
+          hll_add (all, h);
+          if ((solid != NULL) && (cm_sync_add (&sk->cm, h) > 1))
+            hll_add (solid, h);
+          ++total;
+        }
+    }
+
+  return total;
+}
+
+/* Fold the sketches of a batch into those of the whole input */
+
+static void
+kmer_sketch_emit (void *arg, fq_buf *out1, fq_buf *out2)
+{
+  unsigned long long total = 0;
+  kmer_sketch *sk = (kmer_sketch *) arg;
+
+  hll_merge (&sk->all, (const hll_sketch *) out1->s);
+  memcpy (&total, out1->s + sizeof (hll_sketch), sizeof (total));
+  sk->total += total;
+  if (sk->use_cm)
+    hll_merge (&sk->solid, (const hll_sketch *) out2->s);
+}
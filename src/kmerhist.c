@@ -0,0 +1,244 @@
+/* kmerhist - Abundance histogram of counted k-mers and what it implies
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <math.h>
+#include <pthread.h>
+
+#include "kmer.h"
+
+/* A slice of a table for one histogram thread */
+typedef struct _kmer_hist_job
+{
+  const kmer_table *t;
+  size_t start;
+  size_t end;
+  unsigned long long *hist;     /* shared histogram */
+  pthread_mutex_t *lock;
+} kmer_hist_job;
+
+static void kmer_hist_range (const kmer_table *, size_t, size_t,
+                             unsigned long long *);
+static void *kmer_hist_thread (void *);
+static size_t kmer_hist_peak (const unsigned long long *, size_t, size_t);
+
+/* Add the counts of a table to a histogram of KMER_HIST_SIZE bins-- the
+   number of k-mers seen once, twice and so on, with the last bin for
+   everything more abundant.  The slots are split between nthreads
+   threads that each fill a histogram of their own */
+
+void
+kmer_hist_table (const kmer_table *t, unsigned long long *hist, int nthreads)
+{
+  int i = 0;
+  size_t slice = 0;
+  pthread_t *threads = NULL;
+  kmer_hist_job *jobs = NULL;
+  pthread_mutex_t lock;
+
+  if ((nthreads < 2) || (t->size < (size_t) nthreads * KT_INIT_SIZE))
+    {
+      kmer_hist_range (t, 0, t->size, hist);
+      return;
+    }
+
+  threads = (pthread_t *) malloc (nthreads * sizeof (pthread_t));
+  jobs = (kmer_hist_job *) malloc (nthreads * sizeof (kmer_hist_job));
+  if ((threads == NULL) || (jobs == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer "
+             "histogram.\n\n", stderr);
+      abort ();
+    }
+  pthread_mutex_init (&lock, NULL);
+  slice = t->size / nthreads;
+  for (i = 0; i < nthreads; ++i)
+    {
+      jobs[i].t = t;
+      jobs[i].start = i * slice;
+      jobs[i].end = (i == nthreads - 1) ? t->size : (i + 1) * slice;
+      jobs[i].hist = hist;
+      jobs[i].lock = &lock;
+      if (pthread_create (&threads[i], NULL, kmer_hist_thread, &jobs[i]) != 0)
+        {
+          fputs ("\n\nError: cannot create a k-mer histogram thread.\n\n",
+                 stderr);
+          abort ();
+        }
+    }
+  for (i = 0; i < nthreads; ++i)
+    pthread_join (threads[i], NULL);
+  pthread_mutex_destroy (&lock);
+
+  free (threads);
+  free (jobs);
+}
+
+/* Write every bin of a histogram that holds k-mers as a tab-delimited
+   line of abundance and number of k-mers */
+
+void
+kmer_hist_write (const unsigned long long *hist, bgzf_writer *out)
+{
+  size_t i = 0;
+  fq_buf o;
+
+  fq_buf_init (&o);
+  for (i = 1; i < KMER_HIST_SIZE; ++i)
+    {
+      if (hist[i] == 0)
+        continue;
+      o.l -= 48 - sprintf (fq_buf_reserve (&o, 48), "%lu\t%llu\n",
+                           (unsigned long) i, hist[i]);
+    }
+  bgzf_write (out, o.s, o.l);
+  fq_buf_free (&o);
+}
+
+/* Summarize a histogram-- k-mers below the first trough are taken for
+   sequencing errors, the highest peak past it for the coverage of
+   homozygous k-mers, and genome size as the solid k-mers over that
+   coverage.  A peak at half that coverage holds the k-mers of the two
+   alleles of heterozygous sites, each site spoiling k k-mers */
+
+void
+kmer_hist_summary (const unsigned long long *hist, int k, FILE *fp)
+{
+  size_t i = 0;
+  size_t trough = 0;
+  size_t peak = 0;
+  size_t half = 0;
+  unsigned long long distinct = 0;
+  unsigned long long errors = 0;
+  unsigned long long het = 0;
+  double solid = 0.0;
+  double genome = 0.0;
+  double rate = 0.0;
+
+  for (i = 1; i < KMER_HIST_SIZE; ++i)
+    distinct += hist[i];
+  if (distinct == 0)
+    return;
+
+  /* Walk down from the error k-mers to the first trough-- past the
+     empty bins of k-mers a Bloom filter kept out */
+  for (trough = 1; (trough < KMER_HIST_SIZE - 1) && (hist[trough] == 0);
+       ++trough)
+    ;
+  for (; (trough + 1 < KMER_HIST_SIZE - 1) &&
+       (hist[trough + 1] < hist[trough]); ++trough)
+    ;
+  if ((trough + 1 >= KMER_HIST_SIZE - 1) ||
+      ((peak = kmer_hist_peak (hist, trough, KMER_HIST_SIZE - 1)) == 0))
+    {
+      fputs ("Warning: the k-mer histogram has no peak past the error "
+             "k-mers.\n", stderr);
+      return;
+    }
+  for (i = 1; i < trough; ++i)
+    errors += hist[i];
+
+  /* The highest peak may be the heterozygous one-- prefer a peak near
+     twice its coverage that is too high to be one of repeats */
+  i = kmer_hist_peak (hist, (size_t) (1.7 * peak), (size_t) (2.3 * peak) + 1);
+  if ((i > 0) && (hist[i] >= hist[peak] / 4))
+    peak = i;
+  half = kmer_hist_peak (hist, trough, (size_t) (0.75 * peak));
+
+  for (i = trough; i < KMER_HIST_SIZE; ++i)
+    {
+      solid += (double) i * hist[i];
+      if ((half > 0) && (i < 0.75 * peak))
+        het += hist[i];
+    }
+  genome = solid / peak;
+  if (het > 0)
+    rate = 1.0 - pow (1.0 - fmin (1.0, het / 2.0 / genome), 1.0 / k);
+
+  fprintf (fp, "error k-mer cutoff:\t%lu\n", (unsigned long) trough);
+  fprintf (fp, "error k-mers:\t%.2f%%\n", 100.0 * errors / distinct);
+  fprintf (fp, "peak coverage:\t%lu\n", (unsigned long) peak);
+  fprintf (fp, "genome size:\t%.0f\n", genome);
+  fprintf (fp, "heterozygosity:\t%.3f%%\n", 100.0 * rate);
+}
+
+/* Add the counts of slots start..end-1 of a table to a histogram */
+
+static void
+kmer_hist_range (const kmer_table *t, size_t start, size_t end,
+                 unsigned long long *hist)
+{
+  size_t i = 0;
+
+  for (i = start; i < end; ++i)
+    {
+      if (t->keys[i] == KT_EMPTY)
+        continue;
+      ++hist[(t->counts[i] < KMER_HIST_SIZE - 1) ?
+             t->counts[i] : KMER_HIST_SIZE - 1];
+    }
+}
+
+/* Fill a histogram of one slice of a table and fold it into the
+   shared one */
+
+static void *
+kmer_hist_thread (void *arg)
+{
+  size_t i = 0;
+  kmer_hist_job *job = (kmer_hist_job *) arg;
+  unsigned long long *hist = NULL;
+
+  if ((hist = (unsigned long long *) calloc (KMER_HIST_SIZE,
+                                             sizeof (unsigned long long)))
+      == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer "
+             "histogram.\n\n", stderr);
+      abort ();
+    }
+  kmer_hist_range (job->t, job->start, job->end, hist);
+
+  pthread_mutex_lock (job->lock);
+  for (i = 0; i < KMER_HIST_SIZE; ++i)
+    job->hist[i] += hist[i];
+  pthread_mutex_unlock (job->lock);
+  free (hist);
+
+  return NULL;
+}
+
+/* Return the highest local maximum among bins start..end-1, short of
+   the overflow bin-- 0 if there is none */
+
+static size_t
+kmer_hist_peak (const unsigned long long *hist, size_t start, size_t end)
+{
+  size_t i = 0;
+  size_t peak = 0;
+
+  if (start < 1)
+    start = 1;
+  if (end > KMER_HIST_SIZE - 1)
+    end = KMER_HIST_SIZE - 1;
+  for (i = start; i < end; ++i)
+    {
+      if ((hist[i] > hist[i - 1]) && (hist[i] >= hist[i + 1]) &&
+          ((peak == 0) || (hist[i] > hist[peak])))
+        peak = i;
+    }
+
+  return peak;
+}
@@ -0,0 +1,610 @@
+/* kmerpart - Two-phase k-mer counting over minimizer partitions
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <pthread.h>
+
+#include "kmer.h"
+#include "arena.h"
+#include "pipeline.h"
+#include "spill.h"
+
+/* Reads are cut into super-k-mers-- maximal runs of overlapping k-mers
+   that share a minimizer, the canonical m-mer of smallest hash.  A k-mer
+   and its reverse complement have the same minimizer, so every canonical
+   k-mer falls in exactly one partition and each partition is counted on
+   its own.  A super-k-mer is binned as its base count followed by its
+   bases packed four to a byte.
+
+   Under a memory cap each bin takes an even share of it at once and,
+   when the share is full, appends it as a run to one temporary file
+   shared by all partitions.  The cap also holds the count tables of
+   the partitions being counted-- each sized for its share of the
+   distinct k-mers the input is estimated to hold, and never for more
+   than its k-mers.  Fewer threads count when the largest table would
+   not fit once for each, and the bins still held are spilled when they
+   and the tables would not fit together */
+
+/* A run of super-k-mers of one partition in the temporary file */
+typedef struct _kmer_run
+{
+  unsigned long long off;
+  size_t len;
+  struct _kmer_run *next;
+} kmer_run;
+
+/* The super-k-mer bins of every partition */
+typedef struct _kmer_bins
+{
+  int nparts;
+  int k;
+  int bloom;                   /* count through a Bloom filter */
+  int sort;                    /* sort each table into database runs */
+  fq_buf *mem;                 /* super-k-mers held in memory */
+  char *block;                 /* the shares of every bin, NULL for no cap */
+  kmer_run **runs;             /* spilled runs of each partition */
+  unsigned long long *spilled; /* bytes spilled from each partition */
+  unsigned long long *nkmers;  /* k-mers binned in each partition */
+  unsigned long long total;    /* k-mers binned in all partitions */
+  size_t distinct;             /* estimated distinct k-mers, 0 if unknown */
+  FILE *file;                  /* the runs of every partition, NULL if none */
+  unsigned long long file_len;
+  ngs_arena arena;             /* the runs */
+  size_t share;                /* bytes a bin holds, 0 for no cap */
+  size_t mem_limit;            /* bytes held in all, 0 for no cap */
+} kmer_bins;
+
+/* State shared by the partition counting threads */
+typedef struct _kmer_phase2
+{
+  kmer_bins *bins;
+  int next;                    /* next partition to count */
+  kmer_stats *stats;
+  bgzf_writer *out;
+  pthread_mutex_t lock;
+} kmer_phase2;
+
+static void kmer_split_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                              fq_buf *, fq_buf *);
+static void kmer_split_seq (ngs_params *, const char *, const char *,
+                            size_t, fq_buf *, fq_buf *);
+static void kmer_put_super (fq_buf *, unsigned int, const char *,
+                            unsigned int);
+static void kmer_bin (void *, fq_buf *, fq_buf *);
+static void kmer_spill_bin (kmer_bins *, int);
+static void kmer_spill_run (kmer_bins *, int, const char *, size_t);
+static unsigned long long kmer_part_kmers (const kmer_bins *, int);
+static size_t kmer_part_slots (const kmer_bins *, int);
+static size_t kmer_part_mem (const kmer_bins *, int);
+static void *kmer_count_parts (void *);
+static unsigned long long kmer_count_super (kmer_table *, bloom_filter *,
+                                            const unsigned char *,
+                                            unsigned int, int, fq_buf *);
+
+/* Count k-mers in two phases-- bin the super-k-mers of every read by
+   partition, in memory or in a temporary file past the memory cap, then
+   count each partition in its own table on p->threads threads */
+
+void
+kmer_count_partitioned (ngs_params *p, fq_reader *in, bgzf_writer *out,
+                        kmer_stats *stats)
+{
+  int i = 0;
+  int nthreads = p->threads;
+  size_t table = 0;
+  size_t largest = 0;
+  size_t held = 0;
+  kmer_bins bins;
+  kmer_phase2 st;
+  ngs_pipeline pl;
+  pthread_t *threads = NULL;
+
+  memset (&bins, 0, sizeof (kmer_bins));
+  bins.nparts = p->kmer_parts;
+  bins.k = p->kmer_size;
+  bins.bloom = (p->flag & KMER_BLOOM) != 0;
+  bins.sort = (p->flag & KMER_DB) != 0;
+  bins.mem_limit = (size_t) p->mem_limit << 20;
+  bins.share = bins.mem_limit / bins.nparts;
+  if ((bins.mem_limit > 0) && (bins.share < KMER_MIN_SHARE))
+    {
+      fprintf (stderr, "\n\nError: -M gives each of the %d partitions less "
+               "than %d bytes-- raise -M or lower -P.\n\n", bins.nparts,
+               KMER_MIN_SHARE);
+      abort ();
+    }
+  arena_init (&bins.arena, KMER_RUN_CHUNK);
+  bins.mem = (fq_buf *) calloc (bins.nparts, sizeof (fq_buf));
+  bins.runs = (kmer_run **) calloc (bins.nparts, sizeof (kmer_run *));
+  bins.spilled = (unsigned long long *) calloc (bins.nparts,
+                                                sizeof (unsigned long long));
+  bins.nkmers = (unsigned long long *) calloc (bins.nparts,
+                                               sizeof (unsigned long long));
+  bins.block = NULL;
+  if (bins.share > 0)
+    bins.block = (char *) malloc (bins.share * bins.nparts);
+  if ((bins.mem == NULL) || (bins.runs == NULL) || (bins.spilled == NULL) ||
+      (bins.nkmers == NULL) || ((bins.share > 0) && (bins.block == NULL)))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer "
+             "partitions.\n\n", stderr);
+      abort ();
+    }
+
+  /* Under a cap the bins are one block, so that spilling them all
+     gives it back at once */
+  for (i = 0; (bins.share > 0) && (i < bins.nparts); ++i)
+    {
+      bins.mem[i].s = bins.block + (size_t) i * bins.share;
+      bins.mem[i].m = bins.share;
+    }
+
+  /* Phase one-- cut reads on the worker threads and bin the
+     super-k-mers in input order on the calling thread */
+  pl.p = p;
+  pl.in1 = in;
+  pl.in2 = NULL;
+  pl.out1 = NULL;
+  pl.out2 = NULL;
+  pl.work = kmer_split_batch;
+  pl.emit = kmer_bin;
+  pl.arg = &bins;
+  pipeline_run (&pl);
+  if ((bins.file != NULL) && (fflush (bins.file) != 0))
+    {
+      fputs ("\n\nError: cannot write to a temporary file.\n\n", stderr);
+      abort ();
+    }
+
+  /* Make room for the count tables-- spill the bins still held if they
+     and one table for each thread would go over the cap, and use fewer
+     threads if the tables alone would */
+  if (bins.mem_limit > 0)
+    {
+      bins.distinct = kmer_estimate (p, p->seqfile_name1);
+      for (i = 0; i < bins.nparts; ++i)
+        {
+          if ((table = kmer_part_mem (&bins, i)) > largest)
+            largest = table;
+          held += bins.mem[i].m;
+        }
+      largest += bins.share;   /* and the buffer its runs are read into */
+      if (largest > bins.mem_limit)
+        {
+          fprintf (stderr, "Warning: counting a partition takes %lu MB, "
+                   "more than -M-- raise -P.\n",
+                   (unsigned long) (largest >> 20) + 1);
+          nthreads = 1;
+        }
+      else if ((size_t) nthreads * largest > bins.mem_limit)
+        nthreads = (int) (bins.mem_limit / largest);
+      if (held + (size_t) nthreads * largest > bins.mem_limit)
+        {
+          for (i = 0; i < bins.nparts; ++i)
+            kmer_spill_bin (&bins, i);
+          free (bins.block);
+          bins.block = NULL;
+          memset (bins.mem, 0, bins.nparts * sizeof (fq_buf));
+          if ((bins.file != NULL) && (fflush (bins.file) != 0))
+            {
+              fputs ("\n\nError: cannot write to a temporary file.\n\n",
+                     stderr);
+              abort ();
+            }
+        }
+    }
+
+  /* Phase two-- count the partitions independently */
+  memset (&st, 0, sizeof (kmer_phase2));
+  st.bins = &bins;
+  st.stats = stats;
+  st.out = out;
+  pthread_mutex_init (&st.lock, NULL);
+  if (nthreads < 2)
+    kmer_count_parts (&st);
+  else
+    {
+      if ((threads = (pthread_t *) malloc (nthreads * sizeof (pthread_t)))
+          == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for k-mer "
+                 "partitions.\n\n", stderr);
+          abort ();
+        }
+      for (i = 0; i < nthreads; ++i)
+        {
+          if (pthread_create (&threads[i], NULL, kmer_count_parts, &st) != 0)
+            {
+              fputs ("\n\nError: cannot create a k-mer counting "
+                     "thread.\n\n", stderr);
+              abort ();
+            }
+        }
+      for (i = 0; i < nthreads; ++i)
+        pthread_join (threads[i], NULL);
+      free (threads);
+    }
+  pthread_mutex_destroy (&st.lock);
+
+  if (bins.file != NULL)
+    fclose (bins.file);
+  arena_free (&bins.arena);
+  free (bins.block);
+  free (bins.mem);
+  free (bins.runs);
+  free (bins.spilled);
+  free (bins.nkmers);
+}
+
+/* Cut a batch of reads into super-k-mers tagged with their partition--
+   out2 is scratch space for m-mer hashes */
+
+static void
+kmer_split_batch (ngs_params *p, void *arg, fq_batch *in1, fq_batch *in2,
+                  fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+
+  (void) arg;
+  (void) in2;
+  for (i = 0; i < in1->n; ++i)
+    kmer_split_seq (p, in1->rec[i].seq, in1->rec[i].qual,
+                    kt_rec_len (&in1->rec[i]), out1, out2);
+}
+
+/* Cut each run of unambiguous bases of a sequence, with qualities of
+   at least -Q, into super-k-mers */
+
+static void
+kmer_split_seq (ngs_params *p, const char *seq, const char *qual, size_t len,
+                fq_buf *out, fq_buf *scratch)
+{
+  size_t i = 0;
+  size_t j = 0;
+  size_t run = 0;
+  size_t nmers = 0;
+  size_t nkmers = 0;
+  size_t min_pos = 0;
+  size_t first = 0;
+  int c = 0;
+  int k = p->kmer_size;
+  int qmin = p->kmer_qual + KT_PHRED;
+  int m = (k < KMER_MINIMIZER) ? k : KMER_MINIMIZER;
+  size_t w = k - m + 1;        /* m-mers in a k-mer */
+  unsigned long long fwd = 0;
+  unsigned long long rev = 0;
+  unsigned long long mask = (1ULL << (2 * m)) - 1;
+  unsigned long long cur = 0;
+  unsigned long long *h = NULL;
+
+  while (len > 0)
+    {
+      /* Find the next run of unambiguous bases */
+      while ((len > 0) && (kt_base (seq, qual, 0, qmin) == 0))
+        {
+          ++seq;
+          ++qual;
+          --len;
+        }
+      for (run = 0; (run < len) && (kt_base (seq, qual, run, qmin) != 0);
+           ++run)
+        ;
+      if (run >= (size_t) k)
+        {
+          /* Hash the canonical m-mers of the run */
+          nmers = run - m + 1;
+          nkmers = run - k + 1;
+          scratch->l = 0;
+          h = (unsigned long long *)
+            fq_buf_reserve (scratch, nmers * sizeof (unsigned long long));
+          for (i = 0; i < run; ++i)
+            {
+              c = kt_code[(unsigned char) seq[i]] - 1;
+              fwd = ((fwd << 2) | c) & mask;
+              rev = (rev >> 2) | ((unsigned long long) (3 - c)
+                                  << (2 * (m - 1)));
+              if (i + 1 >= (size_t) m)
+                h[i + 1 - m] = kt_hash ((fwd < rev) ? fwd : rev);
+            }
+
+          /* Slide a window of w m-mers along the run, rescanning only
+             when the smallest hash drops out of it-- a super-k-mer ends
+             wherever the smallest hash changes */
+          first = 0;
+          for (i = 0; i < nkmers; ++i)
+            {
+              if ((i == 0) || (min_pos < i))
+                {
+                  for (min_pos = i, j = i + 1; j < i + w; ++j)
+                    if (h[j] < h[min_pos])
+                      min_pos = j;
+                }
+              else if (h[i + w - 1] < h[min_pos])
+                min_pos = i + w - 1;
+
+              if (i == 0)
+                cur = h[min_pos];
+              else if (h[min_pos] != cur)
+                {
+                  kmer_put_super (out, (unsigned int) (cur % p->kmer_parts),
+                                  seq + first,
+                                  (unsigned int) (i - 1 + k - first));
+                  first = i;
+                  cur = h[min_pos];
+                }
+            }
+          kmer_put_super (out, (unsigned int) (cur % p->kmer_parts),
+                          seq + first, (unsigned int) (run - first));
+        }
+      seq += run;
+      qual += run;
+      len -= run;
+    }
+}
+
+/* Append a super-k-mer of n bases to a batch as its partition, its base
+   count and its packed bases */
+
+static void
+kmer_put_super (fq_buf *out, unsigned int part, const char *seq,
+                unsigned int n)
+{
+  unsigned int i = 0;
+  unsigned char *s = NULL;
+
+  s = (unsigned char *) fq_buf_reserve (out, 2 * sizeof (unsigned int)
+                                        + (n + 3) / 4);
+  memcpy (s, &part, sizeof (unsigned int));
+  memcpy (s + sizeof (unsigned int), &n, sizeof (unsigned int));
+  s += 2 * sizeof (unsigned int);
+  memset (s, 0, (n + 3) / 4);
+  for (i = 0; i < n; ++i)
+    s[i >> 2] |= (kt_code[(unsigned char) seq[i]] - 1) << ((i & 3) << 1);
+}
+
+/* Move the super-k-mers of a batch into their partition bins-- called
+   on one thread in input order */
+
+static void
+kmer_bin (void *arg, fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  size_t len = 0;
+  unsigned int part = 0;
+  unsigned int n = 0;
+  fq_buf *bin = NULL;
+  kmer_bins *bins = (kmer_bins *) arg;
+
+  (void) out2;
+  while (i < out1->l)
+    {
+      memcpy (&part, out1->s + i, sizeof (unsigned int));
+      memcpy (&n, out1->s + i + sizeof (unsigned int), sizeof (unsigned int));
+      len = sizeof (unsigned int) + (n + 3) / 4;
+      i += sizeof (unsigned int);
+      bins->nkmers[part] += n - bins->k + 1;
+      bins->total += n - bins->k + 1;
+      bin = &bins->mem[part];
+      if (bins->share == 0)
+        fq_buf_put (bin, out1->s + i, len);
+      else
+        {
+          /* A bin spills when its share is full-- a super-k-mer longer
+             than the share goes straight out */
+          if (bin->l + len > bin->m)
+            kmer_spill_bin (bins, (int) part);
+          if (len > bin->m)
+            kmer_spill_run (bins, (int) part, out1->s + i, len);
+          else
+            {
+              memcpy (bin->s + bin->l, out1->s + i, len);
+              bin->l += len;
+            }
+        }
+      i += len;
+    }
+}
+
+/* Append the super-k-mers of a bin held in memory to the temporary
+   file as a run */
+
+static void
+kmer_spill_bin (kmer_bins *bins, int part)
+{
+  fq_buf *bin = &bins->mem[part];
+
+  if (bin->l == 0)
+    return;
+  kmer_spill_run (bins, part, bin->s, bin->l);
+  bin->l = 0;
+}
+
+/* Append len bytes of whole super-k-mers of a partition to the
+   temporary file, and note where they went */
+
+static void
+kmer_spill_run (kmer_bins *bins, int part, const char *s, size_t len)
+{
+  kmer_run *run = NULL;
+
+  if (bins->file == NULL)
+    bins->file = spill_open ();
+  run = (kmer_run *) arena_alloc (&bins->arena, sizeof (kmer_run));
+  run->off = bins->file_len;
+  run->len = len;
+  run->next = bins->runs[part];
+  bins->runs[part] = run;
+  spill_write (bins->file, s, len);
+  bins->file_len += len;
+  bins->spilled[part] += len;
+}
+
+/* Return the distinct k-mers a partition is expected to hold-- its
+   share of the estimate, and at most all its k-mers */
+
+static unsigned long long
+kmer_part_kmers (const kmer_bins *bins, int part)
+{
+  if ((bins->distinct > 0) && (bins->total > 0) &&
+      ((double) bins->distinct < (double) bins->total))
+    return (unsigned long long) ((double) bins->nkmers[part]
+                                 * bins->distinct / bins->total) + 1;
+
+  return bins->nkmers[part];
+}
+
+/* Return the number of slots of the table that counts a partition--
+   enough for its k-mers below the load at which a table grows */
+
+static size_t
+kmer_part_slots (const kmer_bins *bins, int part)
+{
+  size_t n = KT_MIN_SIZE;
+  unsigned long long want = kmer_part_kmers (bins, part);
+
+  while ((unsigned long long) n * 7 / 10 < want)
+    n <<= 1;
+
+  return n;
+}
+
+/* Return the bytes that counting a partition takes-- its table, its
+   Bloom filter and the two copies of a run of its k-mers sorted for a
+   database */
+
+static size_t
+kmer_part_mem (const kmer_bins *bins, int part)
+{
+  unsigned long long sort = kmer_part_kmers (bins, part);
+  size_t mem = kmer_part_slots (bins, part)
+    * (sizeof (unsigned long long) + sizeof (unsigned int));
+
+  if (bins->bloom)
+    mem += (size_t) (bins->spilled[part] + bins->mem[part].l) * 2;
+  if (bins->sort)
+    mem += (size_t) ((sort < KDB_RUN_SIZE) ? sort : KDB_RUN_SIZE) * 2
+      * (sizeof (unsigned long long) + sizeof (unsigned int));
+
+  return mem;
+}
+
+/* Take partitions from the shared counter until none are left-- count
+   the spilled runs and then the in-memory super-k-mers of each in a
+   table of its own, and fold the table into the totals, histogram and
+   dump */
+
+static void *
+kmer_count_parts (void *arg)
+{
+  int i = 0;
+  int k = 0;
+  size_t j = 0;
+  unsigned int n = 0;
+  unsigned long long total = 0;
+  kmer_phase2 *st = (kmer_phase2 *) arg;
+  kmer_bins *bins = st->bins;
+  kmer_table t;
+  fq_buf packed;
+  fq_buf seq;
+  fq_buf *mem = NULL;
+  kmer_run *run = NULL;
+  bloom_filter bloom;
+  bloom_filter *filter = NULL;
+
+  k = bins->k;
+  fq_buf_init (&packed);
+  fq_buf_init (&seq);
+  while (1)
+    {
+      pthread_mutex_lock (&st->lock);
+      i = st->next++;
+      pthread_mutex_unlock (&st->lock);
+      if (i >= bins->nparts)
+        break;
+
+      kt_init (&t, (bins->distinct > 0) ? kmer_part_slots (bins, i) :
+               KT_MIN_SIZE);
+      total = 0;
+
+      /* Four bits for each base of the partition, packed four
+         to a byte */
+      if (bins->bloom)
+        {
+          bf_init (&bloom, (size_t) (bins->spilled[i] + bins->mem[i].l) * 2);
+          filter = &bloom;
+        }
+
+      /* Runs are read by offset, so threads share the file */
+      for (run = bins->runs[i]; run != NULL; run = run->next)
+        {
+          packed.l = 0;
+          spill_pread (bins->file, fq_buf_reserve (&packed, run->len),
+                       run->len, run->off);
+          for (j = 0; j < run->len; j += sizeof (unsigned int) + (n + 3) / 4)
+            {
+              memcpy (&n, packed.s + j, sizeof (unsigned int));
+              total += kmer_count_super (&t, filter, (unsigned char *)
+                                         packed.s + j + sizeof (unsigned int),
+                                         n, k, &seq);
+            }
+        }
+
+      mem = &bins->mem[i];
+      for (j = 0; j < mem->l; j += sizeof (unsigned int) + (n + 3) / 4)
+        {
+          memcpy (&n, mem->s + j, sizeof (unsigned int));
+          total += kmer_count_super (&t, filter, (unsigned char *) mem->s
+                                     + j + sizeof (unsigned int), n, k,
+                                     &seq);
+        }
+      if (bins->block == NULL)
+        fq_buf_free (mem);
+      if (filter != NULL)
+        bf_free (filter);
+
+      pthread_mutex_lock (&st->lock);
+      st->stats->total += total;
+      st->stats->distinct += t.n;
+      if (st->stats->hist != NULL)
+        kmer_hist_table (&t, st->stats->hist, 1);
+      if (st->stats->db != NULL)
+        kdb_add_table (st->stats->db, &t);
+      if (st->out != NULL)
+        kmer_dump (&t, k, st->out);
+      pthread_mutex_unlock (&st->lock);
+
+      kt_free (&t);
+    }
+  fq_buf_free (&packed);
+  fq_buf_free (&seq);
+
+  return NULL;
+}
+
+/* Unpack a super-k-mer of n bases and count its k-mers */
+
+static unsigned long long
+kmer_count_super (kmer_table *t, bloom_filter *b, const unsigned char *s,
+                  unsigned int n, int k, fq_buf *seq)
+{
+  unsigned int i = 0;
+
+  seq->l = 0;
+  fq_buf_reserve (seq, n);
+  for (i = 0; i < n; ++i)
+    seq->s[i] = "ACGT"[(s[i >> 2] >> ((i & 3) << 1)) & 3];
+
+  return kt_count_seq (t, seq->s, seq->s, n, k, 0, b);
+}
@@ -0,0 +1,240 @@
+/* kmerquery - Looks up k-mers and reads in a k-mer database
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ngscmd.h"
+#include "bgzf.h"
+#include "fastq.h"
+#include "kmerdb.h"
+#include "pipeline.h"
+
+/* Define constants */
+#define QUERY_LINE 0x10000      /* initial length of a line of text */
+
+static int query_is_fastq (const char *);
+static void query_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                         fq_buf *, fq_buf *);
+static void query_put (fq_buf *, const kmer_db *, const char *, size_t,
+                       const char *, size_t, int);
+static void query_text (const kmer_db *, const char *, bgzf_writer *);
+
+int
+ngs_kmer_query (ngs_params *p)
+{
+  kmer_db *db = NULL;
+  fq_reader *input_fastq = NULL;
+  bgzf_writer *output = NULL;
+  ngs_pipeline pl;
+
+  /* Map the database */
+  if ((db = kdb_open (p->seqfile_name1)) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the k-mer database: "
+               "%s.\n\n", p->seqfile_name1);
+      abort ();
+    }
+
+  /* Open the output stream */
+  if ((output = bgzf_open (p->outfile_name1, p->output_format,
+                           p->compress_level, p->threads)) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the output file: %s.\n\n",
+               p->outfile_name1);
+      abort ();
+    }
+
+  /* Set up interrupt trap */
+  signal (SIGINT, INThandler);
+
+  /* Reads are looked up on the worker threads, lines of text serially */
+  if (query_is_fastq (p->seqfile_name2))
+    {
+      if ((input_fastq = fq_open (p->seqfile_name2, p->threads,
+                                  p->first_record)) == NULL)
+        {
+          fprintf (stderr, "\n\nError: cannot open the input fastQ file: "
+                   "%s.\n\n", p->seqfile_name2);
+          abort ();
+        }
+      pl.p = p;
+      pl.in1 = input_fastq;
+      pl.in2 = NULL;
+      pl.out1 = output;
+      pl.out2 = NULL;
+      pl.work = query_batch;
+      pl.emit = NULL;
+      pl.arg = db;
+      pipeline_run (&pl);
+      fq_close (input_fastq);
+    }
+  else
+    query_text (db, p->seqfile_name2, output);
+
+  bgzf_close (output);
+  kdb_close (db);
+
+  return 0;
+}
+
+/* Tell a fastQ file from text by its first character-- the standard
+   input is taken to be fastQ */
+
+static int
+query_is_fastq (const char *name)
+{
+  int c = 0;
+  gzFile in = NULL;
+
+  if (strcmp (name, "-") == 0)
+    return 1;
+  if ((in = gzopen (name, "rb")) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the query file: %s.\n\n",
+               name);
+      abort ();
+    }
+  while (((c = gzgetc (in)) != -1) && isspace (c))
+    ;
+  gzclose (in);
+
+  return c == '@';
+}
+
+/* Look up the reads of a batch, named by their identifiers */
+
+static void
+query_batch (ngs_params *p, void *arg, fq_batch *in1, fq_batch *in2,
+             fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  size_t name_len = 0;
+  const fq_record *r = NULL;
+
+  (void) p;
+  (void) in2;
+  (void) out2;
+  for (i = 0; i < in1->n; ++i)
+    {
+      r = &in1->rec[i];
+      for (name_len = 1; (name_len < r->id_len) &&
+           !isspace ((unsigned char) r->id[name_len]); ++name_len)
+        ;
+      query_put (out1, (const kmer_db *) arg, r->id + 1, name_len - 1,
+                 r->seq, r->seq_len, 0);
+    }
+}
+
+/* Append the result of looking up a sequence-- a single k-mer with its
+   count if one is asked for, or else the number of k-mers, the number
+   found and their mean count */
+
+static void
+query_put (fq_buf *o, const kmer_db *db, const char *name, size_t name_len,
+           const char *seq, size_t len, int single)
+{
+  size_t i = 0;
+  int c = 0;
+  int valid = 0;
+  int k = (int) db->h->k;
+  int shift = 2 * (k - 1);
+  unsigned int count = 0;
+  unsigned long long fwd = 0;
+  unsigned long long rev = 0;
+  unsigned long long nkmers = 0;
+  unsigned long long found = 0;
+  unsigned long long sum = 0;
+  unsigned long long mask = (k < 32) ? (1ULL << (2 * k)) - 1 : ~0ULL;
+
+  for (i = 0; i < len; ++i)
+    {
+      if ((c = kt_code[(unsigned char) seq[i]]) == 0)
+        {
+          valid = 0;
+          continue;
+        }
+      --c;
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((unsigned long long) (3 - c) << shift);
+      if (++valid >= k)
+        {
+          count = kdb_get (db, (fwd < rev) ? fwd : rev);
+          ++nkmers;
+          found += (count > 0);
+          sum += count;
+        }
+    }
+
+  fq_buf_put (o, name, name_len);
+  if (single && (len == (size_t) k) && (nkmers == 1))
+    o->l -= 24 - sprintf (fq_buf_reserve (o, 24), "\t%u\n", count);
+  else
+    o->l -= 72 - sprintf (fq_buf_reserve (o, 72), "\t%llu\t%llu\t%.2f\n",
+                          nkmers, found,
+                          nkmers ? (double) sum / nkmers : 0.0);
+}
+
+/* Look up each line of a text file of k-mers or sequences */
+
+static void
+query_text (const kmer_db *db, const char *name, bgzf_writer *out)
+{
+  size_t len = 0;
+  size_t cap = QUERY_LINE;
+  char *line = NULL;
+  gzFile in = NULL;
+  fq_buf o;
+
+  if (((in = gzopen (name, "rb")) == NULL) ||
+      ((line = (char *) malloc (cap)) == NULL))
+    {
+      fprintf (stderr, "\n\nError: cannot open the query file: %s.\n\n",
+               name);
+      abort ();
+    }
+  fq_buf_init (&o);
+
+  while (gzgets (in, line + len, (int) (cap - len)) != NULL)
+    {
+      len += strlen (line + len);
+
+      /* Grow the buffer until it holds the whole line */
+      if ((len == cap - 1) && (line[len - 1] != '\n'))
+        {
+          if ((line = (char *) realloc (line, cap <<= 1)) == NULL)
+            {
+              fputs ("\n\nError: memory allocation failure for query "
+                     "line.\n\n", stderr);
+              abort ();
+            }
+          continue;
+        }
+      while ((len > 0) && isspace ((unsigned char) line[len - 1]))
+        --len;
+      if (len > 0)
+        query_put (&o, db, line, len, line, len, 1);
+      len = 0;
+
+      if (o.l >= BGZF_BLOCK_SIZE * 16)
+        {
+          bgzf_write (out, o.s, o.l);
+          o.l = 0;
+        }
+    }
+  bgzf_write (out, o.s, o.l);
+
+  fq_buf_free (&o);
+  free (line);
+  gzclose (in);
+}
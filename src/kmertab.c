@@ -0,0 +1,349 @@
+/* kmertab - Open-addressing count table of 2-bit packed k-mers
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "ngscmd.h"
+#include "kmertab.h"
+
+static void kt_alloc (kmer_table *, size_t);
+static void kt_grow (kmer_table *);
+
+/* 2-bit code of each base plus one-- zero for anything but A, C, G, T */
+const unsigned char kt_code[256] = {
+  ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+  ['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4
+};
+
+/* Write the k bases of a packed k-mer to s, which is not terminated */
+
+void
+kt_decode (unsigned long long kmer, int k, char *s)
+{
+  int i = 0;
+
+  for (i = k - 1; i >= 0; --i)
+    {
+      s[i] = "ACGT"[kmer & 3];
+      kmer >>= 2;
+    }
+}
+
+/* Count the canonical k-mers of a sequence-- the forward and reverse
+   complement strands are rolled together, and windows holding anything
+   but A, C, G or T, or a quality character below qmin, are skipped.
+   With a Bloom filter, a k-mer is only entered in the table on its
+   second sighting.  Returns the number of k-mers seen */
+
+unsigned long long
+kt_count_seq (kmer_table *t, const char *seq, const char *qual, size_t len,
+              int k, int qmin, bloom_filter *b)
+{
+  size_t i = 0;
+  int c = 0;
+  int valid = 0;
+  int shift = 2 * (k - 1);
+  unsigned long long fwd = 0;
+  unsigned long long rev = 0;
+  unsigned long long kmer = 0;
+  unsigned long long total = 0;
+  unsigned long long mask = (k < 32) ? (1ULL << (2 * k)) - 1 : ~0ULL;
+
+  for (i = 0; i < len; ++i)
+    {
+      if ((c = kt_base (seq, qual, i, qmin)) == 0)
+        {
+          valid = 0;
+          continue;
+        }
+      --c;
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((unsigned long long) (3 - c) << shift);
+      if (++valid >= k)
+        {
+          kmer = (fwd < rev) ? fwd : rev;
+          if (b == NULL)
+            kt_add (t, kmer);
+          else if (bf_add (b, kt_hash (kmer)))
+            kt_promote (t, kmer);
+          ++total;
+        }
+    }
+
+  return total;
+}
+
+/* Count the canonical k-mers of a sequence in a shared table, through
+   a shared Bloom filter if b is not NULL-- k-mers that find the table
+   full are appended to missed.  Returns the number of k-mers seen */
+
+unsigned long long
+kt_sync_count_seq (kmer_table *t, const char *seq, const char *qual,
+                   size_t len, int k, int qmin, bloom_filter *b,
+                   fq_buf *missed)
+{
+  size_t i = 0;
+  int c = 0;
+  int valid = 0;
+  int shift = 2 * (k - 1);
+  unsigned long long fwd = 0;
+  unsigned long long rev = 0;
+  unsigned long long kmer = 0;
+  unsigned long long total = 0;
+  unsigned long long mask = (k < 32) ? (1ULL << (2 * k)) - 1 : ~0ULL;
+
+  for (i = 0; i < len; ++i)
+    {
+      if ((c = kt_base (seq, qual, i, qmin)) == 0)
+        {
+          valid = 0;
+          continue;
+        }
+      --c;
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((unsigned long long) (3 - c) << shift);
+      if (++valid >= k)
+        {
+          kmer = (fwd < rev) ? fwd : rev;
+          if (b == NULL)
+            {
+              if (!kt_sync_add (t, kmer, 1))
+                fq_buf_put (missed, (const char *) &kmer, sizeof (kmer));
+            }
+          else if (bf_sync_add (b, kt_hash (kmer)) && !kt_sync_add (t, kmer, 2))
+            fq_buf_put (missed, (const char *) &kmer, sizeof (kmer));
+          ++total;
+        }
+    }
+
+  return total;
+}
+
+/* Initialize an empty table with room for at least size slots */
+
+void
+kt_init (kmer_table *t, size_t size)
+{
+  size_t n = KT_MIN_SIZE;
+
+  while (n < size)
+    n <<= 1;
+  kt_alloc (t, n);
+  t->n = 0;
+}
+
+/* Count one occurrence of a k-mer */
+
+void
+kt_add (kmer_table *t, unsigned long long kmer)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) kt_hash (kmer) & mask;
+
+  while (1)
+    {
+      if (t->keys[i] == kmer)
+        {
+          if (t->counts[i] < KT_MAX_COUNT)
+            ++t->counts[i];
+          return;
+        }
+      if (t->keys[i] == KT_EMPTY)
+        break;
+      i = (i + 1) & mask;
+    }
+
+  t->keys[i] = kmer;
+  t->counts[i] = 1;
+
+  /* Keep the load under 0.7 so probe runs stay short */
+  if (++t->n > t->size / 10 * 7)
+    kt_grow (t);
+}
+
+/* Count an occurrence of a k-mer that a Bloom filter has seen-- a
+   k-mer new to the table enters with its first sighting as well */
+
+void
+kt_promote (kmer_table *t, unsigned long long kmer)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) kt_hash (kmer) & mask;
+
+  while (1)
+    {
+      if (t->keys[i] == kmer)
+        {
+          if (t->counts[i] < KT_MAX_COUNT)
+            ++t->counts[i];
+          return;
+        }
+      if (t->keys[i] == KT_EMPTY)
+        break;
+      i = (i + 1) & mask;
+    }
+
+  t->keys[i] = kmer;
+  t->counts[i] = 2;
+  if (++t->n > t->size / 10 * 7)
+    kt_grow (t);
+}
+
+/* Add count occurrences of a k-mer */
+
+void
+kt_add_count (kmer_table *t, unsigned long long kmer, unsigned int count)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) kt_hash (kmer) & mask;
+
+  while (1)
+    {
+      if (t->keys[i] == kmer)
+        {
+          t->counts[i] = (t->counts[i] > KT_MAX_COUNT - count) ?
+            KT_MAX_COUNT : t->counts[i] + count;
+          return;
+        }
+      if (t->keys[i] == KT_EMPTY)
+        break;
+      i = (i + 1) & mask;
+    }
+
+  t->keys[i] = kmer;
+  t->counts[i] = count;
+  if (++t->n > t->size / 10 * 7)
+    kt_grow (t);
+}
+
+/* Count one occurrence of a k-mer in a table shared between threads--
+   an empty slot is claimed by compare-and-swap, so a racing thread
+   adding the same k-mer either wins the slot or finds it taken by the
+   k-mer.  A new k-mer enters with a count of first.  Returns 0, and
+   counts nothing, if the k-mer is new and the table is full */
+
+int
+kt_sync_add (kmer_table *t, unsigned long long kmer, unsigned int first)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) kt_hash (kmer) & mask;
+  unsigned long long key = 0;
+  unsigned int count = 0;
+
+  while (1)
+    {
+      key = __atomic_load_n (&t->keys[i], __ATOMIC_ACQUIRE);
+      if (key == KT_EMPTY)
+        {
+          /* Stop short of filling every slot so probes still end */
+          if (__atomic_load_n (&t->n, __ATOMIC_RELAXED)
+              >= t->size / 10 * KT_SYNC_LOAD)
+            return 0;
+          if (__atomic_compare_exchange_n (&t->keys[i], &key, kmer, 0,
+                                           __ATOMIC_ACQ_REL,
+                                           __ATOMIC_ACQUIRE))
+            {
+              __atomic_fetch_add (&t->n, 1, __ATOMIC_RELAXED);
+              __atomic_fetch_add (&t->counts[i], first, __ATOMIC_RELAXED);
+              return 1;
+            }
+        }
+      if (key == kmer)
+        break;
+      i = (i + 1) & mask;
+    }
+
+  /* Saturate rather than wrap the count */
+  count = __atomic_load_n (&t->counts[i], __ATOMIC_RELAXED);
+  while ((count < KT_MAX_COUNT) &&
+         !__atomic_compare_exchange_n (&t->counts[i], &count, count + 1, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  return 1;
+}
+
+/* Return the count of a k-mer, zero if it is absent */
+
+unsigned int
+kt_get (const kmer_table *t, unsigned long long kmer)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) kt_hash (kmer) & mask;
+
+  while (t->keys[i] != KT_EMPTY)
+    {
+      if (t->keys[i] == kmer)
+        return t->counts[i];
+      i = (i + 1) & mask;
+    }
+
+  return 0;
+}
+
+/* Free the memory held by a table */
+
+void
+kt_free (kmer_table *t)
+{
+  free (t->keys);
+  free (t->counts);
+  memset (t, 0, sizeof (kmer_table));
+}
+
+/* Allocate size empty slots */
+
+static void
+kt_alloc (kmer_table *t, size_t size)
+{
+  t->size = size;
+  t->keys = (unsigned long long *) malloc (size * sizeof (unsigned long long));
+  t->counts = (unsigned int *) calloc (size, sizeof (unsigned int));
+  if ((t->keys == NULL) || (t->counts == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer table.\n\n",
+             stderr);
+      abort ();
+    }
+  memset (t->keys, 0xff, size * sizeof (unsigned long long));
+}
+
+/* Double the number of slots and reinsert every k-mer */
+
+static void
+kt_grow (kmer_table *t)
+{
+  size_t i = 0;
+  size_t j = 0;
+  size_t mask = 0;
+  size_t old_size = t->size;
+  unsigned long long *old_keys = t->keys;
+  unsigned int *old_counts = t->counts;
+
+  kt_alloc (t, old_size << 1);
+  mask = t->size - 1;
+  for (i = 0; i < old_size; ++i)
+    {
+      if (old_keys[i] == KT_EMPTY)
+        continue;
+      j = (size_t) kt_hash (old_keys[i]) & mask;
+      while (t->keys[j] != KT_EMPTY)
+        j = (j + 1) & mask;
+      t->keys[j] = old_keys[i];
+      t->counts[j] = old_counts[i];
+    }
+
+  free (old_keys);
+  free (old_counts);
+}
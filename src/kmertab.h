@@ -0,0 +1,108 @@
+/* kmertab - Open-addressing count table of 2-bit packed k-mers
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef KMERTAB_H
+#define KMERTAB_H
+
+#include <stddef.h>
+
+#include "fastq.h"
+#include "sketch.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define KT_EMPTY (~0ULL)        /* never a canonical k-mer for k <= 32 */
+#define KT_INIT_SIZE 0x100000   /* initial number of slots */
+#define KT_MIN_SIZE 0x400       /* smallest number of slots */
+#define KT_MAX_COUNT 0xffffffffU
+#define KT_MAX_K 32             /* longest k-mer packed in one word */
+#define KT_PHRED 33             /* offset of Phred scores, as in ngs_trim */
+#define KT_SYNC_LOAD 9          /* tenths of a shared table that fill it */
+
+  /* A table of canonical k-mers and their counts-- keys and counts are
+     kept in separate arrays, 12 bytes per slot, and probed linearly.
+     The kt_sync functions share one table between threads without a
+     lock-- slots are claimed by compare-and-swap and the table never
+     grows, so it is sized up front */
+  typedef struct _kmer_table
+  {
+    unsigned long long *keys;
+    unsigned int *counts;
+    size_t size;         /* number of slots, a power of two */
+    size_t n;            /* number of distinct k-mers */
+  } kmer_table;
+
+  extern const unsigned char kt_code[256];
+
+
+/* Inline functions */
+
+/* Mix the bits of a packed k-mer-- the MurmurHash3 finalizer */
+  static inline unsigned long long
+  kt_hash (unsigned long long x)
+  {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+/* Return the 2-bit code plus one of base i of a read, or zero if the
+   base cannot be part of a k-mer-- anything but A, C, G or T, or a
+   quality character below qmin.  A qmin of 0 masks nothing */
+  static inline int
+  kt_base (const char *seq, const char *qual, size_t i, int qmin)
+  {
+    return ((unsigned char) qual[i] < qmin) ? 0 :
+      kt_code[(unsigned char) seq[i]];
+  }
+
+/* Return the number of bases of a record to roll k-mers over-- a
+   quality line short of the sequence masks the rest */
+  static inline size_t
+  kt_rec_len (const fq_record *r)
+  {
+    return (r->qual_len < r->seq_len) ? r->qual_len : r->seq_len;
+  }
+
+
+/* Function prototypes */
+  extern void kt_decode (unsigned long long, int, char *);
+  extern unsigned long long kt_count_seq (kmer_table *, const char *,
+                                          const char *, size_t, int, int,
+                                          bloom_filter *);
+  extern void kt_init (kmer_table *, size_t);
+  extern void kt_add (kmer_table *, unsigned long long);
+  extern void kt_promote (kmer_table *, unsigned long long);
+  extern void kt_add_count (kmer_table *, unsigned long long, unsigned int);
+  extern int kt_sync_add (kmer_table *, unsigned long long, unsigned int);
+  extern unsigned long long kt_sync_count_seq (kmer_table *, const char *,
+                                               const char *, size_t, int, int,
+                                               bloom_filter *, fq_buf *);
+  extern unsigned int kt_get (const kmer_table *, unsigned long long);
+  extern void kt_free (kmer_table *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* KMERTAB_H */
@@ -0,0 +1,41 @@
+/* kmerwide - Counting of k-mers longer than one word
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "kmer.h"
+
+/* Two words for k up to 63 */
+#define KW 2
+#include "kmerwide.h"
+#undef KW
+
+/* Four words for k up to KMER_MAX_K */
+#define KW 4
+#include "kmerwide.h"
+#undef KW
+
+/* Count k-mers longer than KT_MAX_K in a table of the narrowest width
+   that holds them-- picked once here, so the rolling loop of each width
+   is compiled for it and k-mers of one word never pay for the wider */
+
+void
+kmer_count_wide (ngs_params *p, fq_reader *in, bloom_filter *b,
+                 bgzf_writer *dump, kmer_stats *stats)
+{
+  if (p->kmer_size < 64)
+    kmer_count_w2 (p, in, b, dump, stats);
+  else
+    kmer_count_w4 (p, in, b, dump, stats);
+}
@@ -0,0 +1,295 @@
+/* kmerwide - Count table of k-mers packed in KW 64-bit words
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* This file is a template-- it is included by kmerwide.c once for each
+   width, with KW defined as the number of words, and every type and
+   function it defines carries the suffix _wKW.  The words of a k-mer
+   are stored least significant first, two bits per base, with the
+   last base in the lowest bits.  The top word of a k-mer never fills
+   up, so a top word of all ones marks an empty slot */
+
+#ifndef KW
+#error "KW must be defined before including kmerwide.h"
+#endif
+
+#define KW_PASTE(name, w) name##_w##w
+#define KW_EXPAND(name, w) KW_PASTE (name, w)
+#define KW_FN(name) KW_EXPAND (name, KW)
+
+/* A k-mer of up to 32 * KW - 1 bases */
+typedef struct
+{
+  unsigned long long w[KW];
+} KW_FN (kmer);
+
+/* A table of canonical k-mers and their counts, as kmer_table */
+typedef struct
+{
+  KW_FN (kmer) * keys;
+  unsigned int *counts;
+  size_t size;
+  size_t n;
+} KW_FN (kmer_table);
+
+/* Mix the words of a k-mer into one hash */
+
+static inline unsigned long long
+KW_FN (kw_hash) (const KW_FN (kmer) * x)
+{
+  int i = 0;
+  unsigned long long h = 0;
+
+  for (i = 0; i < KW; ++i)
+    h = kt_hash (h ^ x->w[i]);
+
+  return h;
+}
+
+/* Compare two k-mers from the top word down */
+
+static inline int
+KW_FN (kw_less) (const KW_FN (kmer) * a, const KW_FN (kmer) * b)
+{
+  int i = 0;
+
+  for (i = KW - 1; i >= 0; --i)
+    if (a->w[i] != b->w[i])
+      return a->w[i] < b->w[i];
+
+  return 0;
+}
+
+static inline int
+KW_FN (kw_equal) (const KW_FN (kmer) * a, const KW_FN (kmer) * b)
+{
+  int i = 0;
+
+  for (i = 0; i < KW; ++i)
+    if (a->w[i] != b->w[i])
+      return 0;
+
+  return 1;
+}
+
+/* Allocate size empty slots */
+
+static void
+KW_FN (kw_alloc) (KW_FN (kmer_table) * t, size_t size)
+{
+  t->size = size;
+  t->keys = (KW_FN (kmer) *) malloc (size * sizeof (KW_FN (kmer)));
+  t->counts = (unsigned int *) calloc (size, sizeof (unsigned int));
+  if ((t->keys == NULL) || (t->counts == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for k-mer table.\n\n",
+             stderr);
+      abort ();
+    }
+  memset (t->keys, 0xff, size * sizeof (KW_FN (kmer)));
+}
+
+/* Double the number of slots and reinsert every k-mer */
+
+static void
+KW_FN (kw_grow) (KW_FN (kmer_table) * t)
+{
+  size_t i = 0;
+  size_t j = 0;
+  size_t mask = 0;
+  size_t old_size = t->size;
+  KW_FN (kmer) * old_keys = t->keys;
+  unsigned int *old_counts = t->counts;
+
+  KW_FN (kw_alloc) (t, old_size << 1);
+  mask = t->size - 1;
+  for (i = 0; i < old_size; ++i)
+    {
+      if (old_keys[i].w[KW - 1] == KT_EMPTY)
+        continue;
+      j = (size_t) KW_FN (kw_hash) (&old_keys[i]) & mask;
+      while (t->keys[j].w[KW - 1] != KT_EMPTY)
+        j = (j + 1) & mask;
+      t->keys[j] = old_keys[i];
+      t->counts[j] = old_counts[i];
+    }
+
+  free (old_keys);
+  free (old_counts);
+}
+
+/* Count one occurrence of a k-mer-- a k-mer new to the table enters
+   with a count of first */
+
+static inline void
+KW_FN (kw_add) (KW_FN (kmer_table) * t, const KW_FN (kmer) * kmer,
+                unsigned int first)
+{
+  size_t mask = t->size - 1;
+  size_t i = (size_t) KW_FN (kw_hash) (kmer) & mask;
+
+  while (t->keys[i].w[KW - 1] != KT_EMPTY)
+    {
+      if (KW_FN (kw_equal) (&t->keys[i], kmer))
+        {
+          if (t->counts[i] < KT_MAX_COUNT)
+            ++t->counts[i];
+          return;
+        }
+      i = (i + 1) & mask;
+    }
+
+  t->keys[i] = *kmer;
+  t->counts[i] = first;
+  if (++t->n > t->size / 10 * 7)
+    KW_FN (kw_grow) (t);
+}
+
+/* Count the canonical k-mers of a sequence, as kt_count_seq-- both
+   strands are rolled a word at a time and the lesser one counted */
+
+static unsigned long long
+KW_FN (kw_count_seq) (KW_FN (kmer_table) * t, const char *seq,
+                      const char *qual, size_t len, int k, int qmin,
+                      bloom_filter * b)
+{
+  size_t i = 0;
+  int j = 0;
+  int c = 0;
+  int valid = 0;
+  int shift = 2 * (k - 1);
+  unsigned long long total = 0;
+  unsigned long long mask[KW];
+  KW_FN (kmer) fwd;
+  KW_FN (kmer) rev;
+  const KW_FN (kmer) * kmer = NULL;
+
+  /* Keep 2k bits of the forward strand */
+  for (j = 0; j < KW; ++j)
+    {
+      mask[j] = (2 * k >= 64 * (j + 1)) ? ~0ULL :
+        ((2 * k > 64 * j) ? (1ULL << (2 * k - 64 * j)) - 1 : 0);
+      fwd.w[j] = 0;
+      rev.w[j] = 0;
+    }
+
+  for (i = 0; i < len; ++i)
+    {
+      if ((c = kt_base (seq, qual, i, qmin)) == 0)
+        {
+          valid = 0;
+          continue;
+        }
+      --c;
+      for (j = KW - 1; j > 0; --j)
+        fwd.w[j] = ((fwd.w[j] << 2) | (fwd.w[j - 1] >> 62)) & mask[j];
+      fwd.w[0] = (fwd.w[0] << 2) | c;
+      for (j = 0; j < KW - 1; ++j)
+        rev.w[j] = (rev.w[j] >> 2) | (rev.w[j + 1] << 62);
+      rev.w[KW - 1] >>= 2;
+      rev.w[shift >> 6] |= (unsigned long long) (3 - c) << (shift & 63);
+      if (++valid >= k)
+        {
+          kmer = KW_FN (kw_less) (&rev, &fwd) ? &rev : &fwd;
+          if (b == NULL)
+            KW_FN (kw_add) (t, kmer, 1);
+          else if (bf_add (b, KW_FN (kw_hash) (kmer)))
+            KW_FN (kw_add) (t, kmer, 2);
+          ++total;
+        }
+    }
+
+  return total;
+}
+
+/* Write every k-mer and its count as a tab-delimited line */
+
+static void
+KW_FN (kw_dump) (const KW_FN (kmer_table) * t, int k, bgzf_writer * out)
+{
+  size_t i = 0;
+  int j = 0;
+  int pos = 0;
+  char *s = NULL;
+  fq_buf o;
+
+  fq_buf_init (&o);
+  for (i = 0; i < t->size; ++i)
+    {
+      if (t->keys[i].w[KW - 1] == KT_EMPTY)
+        continue;
+      s = fq_buf_reserve (&o, k + 12);
+      for (j = 0; j < k; ++j)
+        {
+          pos = 2 * (k - 1 - j);
+          s[j] = "ACGT"[(t->keys[i].w[pos >> 6] >> (pos & 63)) & 3];
+        }
+      o.l -= 12 - sprintf (s + k, "\t%u\n", t->counts[i]);
+      if (o.l >= BGZF_BLOCK_SIZE * 16)
+        {
+          bgzf_write (out, o.s, o.l);
+          o.l = 0;
+        }
+    }
+  bgzf_write (out, o.s, o.l);
+  fq_buf_free (&o);
+}
+
+/* Count the k-mers of a fastQ stream in one table of this width, then
+   dump them and fill the histogram as asked */
+
+static void
+KW_FN (kmer_count) (ngs_params * p, fq_reader * in, bloom_filter * b,
+                    bgzf_writer * dump, kmer_stats * stats)
+{
+  size_t i = 0;
+  fq_batch batch;
+  KW_FN (kmer_table) t;
+
+  KW_FN (kw_alloc) (&t, KT_INIT_SIZE);
+  t.n = 0;
+  fq_batch_init (&batch, FQ_BLOCK_SIZE);
+  while (fq_read (in, &batch, FQ_BATCH_RECORDS) > 0)
+    {
+      for (i = 0; i < batch.n; ++i)
+        stats->total += KW_FN (kw_count_seq) (&t, batch.rec[i].seq,
+                                              batch.rec[i].qual,
+                                              kt_rec_len (&batch.rec[i]),
+                                              p->kmer_size,
+                                              p->kmer_qual + KT_PHRED, b);
+    }
+  fq_batch_free (&batch);
+
+  stats->distinct = t.n;
+  if (dump != NULL)
+    KW_FN (kw_dump) (&t, p->kmer_size, dump);
+  if (stats->hist != NULL)
+    {
+      for (i = 0; i < t.size; ++i)
+        {
+          if (t.keys[i].w[KW - 1] == KT_EMPTY)
+            continue;
+          ++stats->hist[(t.counts[i] < KMER_HIST_SIZE - 1) ?
+                        t.counts[i] : KMER_HIST_SIZE - 1];
+        }
+    }
+
+  free (t.keys);
+  free (t.counts);
+}
+
+#undef KW_FN
+#undef KW_EXPAND
+#undef KW_PASTE
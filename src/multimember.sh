@@ -0,0 +1,27 @@
+#!/bin/sh
+# Inflate a gzip file of two members-- a small one, then one too large
+# to split-- on one thread and on four, and compare the reads
+
+set -e
+tmp=multimember.tmp
+rm -rf $tmp
+mkdir $tmp
+awk 'BEGIN {
+  srand (1);
+  for (i = 0; i < 300000; ++i)
+    {
+      s = ""; q = "";
+      for (j = 0; j < 100; ++j)
+        {
+          s = s substr ("ACGT", int (rand () * 4) + 1, 1);
+          q = q substr ("#+5?I", int (rand () * 5) + 1, 1);
+        }
+      printf ("@r%d\n%s\n+\n%s\n", i, s, q);
+    }
+}' > $tmp/reads.fq
+head -n 40000 $tmp/reads.fq | gzip -c > $tmp/reads.fq.gz
+gzip -c $tmp/reads.fq >> $tmp/reads.fq.gz
+./ngscmd trim -t 1 -o plain -p $tmp/t1 $tmp/reads.fq.gz
+./ngscmd trim -t 4 -o plain -p $tmp/t4 $tmp/reads.fq.gz
+cmp $tmp/t1.1.fq $tmp/t4.1.fq
+rm -rf $tmp
@@ -19,14 +19,18 @@
 #include <getopt.h>
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "gzindex.h"
+#include "kmer.h"
+#include "rmdup.h"
 
 /* Define constants */
 #define VERSION 0.2
-#define NFUNCTIONS 7
+#define NFUNCTIONS 9
 
 enum FUNC
 {
-  FILTER, TRIM, PAIR, SCORE, RMDUP, KMER, JOIN
+  FILTER, TRIM, PAIR, SCORE, RMDUP, KMER, JOIN, INDEX, KMERQUERY
 };
 
 
@@ -77,6 +81,12 @@ main (int argc, char **argv)
            case JOIN:
              ngs_join (p);
              break;
+           case INDEX:
+             ngs_index (p);
+             break;
+           case KMERQUERY:
+             ngs_kmer_query (p);
+             break;
  
           default:
              return main_usage ();
@@ -114,6 +124,20 @@ read_params (int argc, char **argv)
   p->min_read_length = 25;
   p->trim_quality = 13;
   p->gap_size = 0;      /*AJG ADDED */
+  p->threads = 1;
+  p->compress_level = Z_DEFAULT_COMPRESSION;
+  p->index_span = GZI_SPAN;
+  p->output_format = -1;        /* chosen from the output below */
+  p->kmer_parts = 0;
+  p->mem_limit = 0;
+  p->kmer_ndbs = 0;
+  p->kmer_qual = 0;
+  p->mismatches = 0;
+  p->umi_bases = 0;
+  p->umi_mismatches = 0;
+  p->first_record = 0;
+  p->outfile_prefix[0] = '\0';
+  p->seqfile_name1[0] = '\0';
 
   /* Assign the function */
   if (strcmp (argv[1], "filter") == 0)
@@ -130,6 +154,10 @@ read_params (int argc, char **argv)
     p->func = KMER;
   else if (strcmp (argv[1], "join") == 0)
     p->func = JOIN;
+  else if (strcmp (argv[1], "index") == 0)
+    p->func = INDEX;
+  else if (strcmp (argv[1], "kmer-query") == 0)
+    p->func = KMERQUERY;
   else
     {
       printf ("Error: the function \"%s\" is not recognized\n", argv[1]);
@@ -153,12 +181,33 @@ read_params (int argc, char **argv)
           {"ascii", no_argument, 0, 'a'},
           {"illumina", no_argument, 0, 'i'},
           {"number", no_argument, 0, 'n'},
+          {"dump", no_argument, 0, 'd'},
+          {"estimate", no_argument, 0, 'e'},
+          {"count-min", no_argument, 0, 'c'},
+          {"histogram", no_argument, 0, 'H'},
+          {"bloom", no_argument, 0, 'b'},
+          {"database", no_argument, 0, 'D'},
+          {"add", required_argument, 0, 'A'},
+          {"min-kmer-qual", required_argument, 0, 'Q'},
+          {"best-quality", no_argument, 0, 'B'},
+          {"mismatches", required_argument, 0, 'x'},
+          {"approx", no_argument, 0, 'X'},
+          {"umi-bases", required_argument, 0, 'u'},
+          {"umi-header", no_argument, 0, 'U'},
+          {"umi-mismatches", required_argument, 0, 'E'},
           {"prefix", required_argument, 0, 'p'},
           {"allowed-N", required_argument, 0, 'w'},
           {"kmer-size", required_argument, 0, 'k'},
           {"trim-quality", required_argument, 0, 'q'},
           {"min-length", required_argument, 0, 'm'},
           {"gap-length", required_argument, 0, 'g'},
+          {"threads", required_argument, 0, 't'},
+          {"compress-level", required_argument, 0, 'z'},
+          {"span", required_argument, 0, 's'},
+          {"output-format", required_argument, 0, 'o'},
+          {"partitions", required_argument, 0, 'P'},
+          {"mem", required_argument, 0, 'M'},
+          {"skip", required_argument, 0, 'S'},
           {0, 0, 0, 0}
         };
       int option_index = 0;
@@ -170,7 +219,7 @@ read_params (int argc, char **argv)
           abort ();
         }
 
-      c = getopt_long (argc, argv, "ainp:w:k:q:m:g:",
+      c = getopt_long (argc, argv, "abBcdDeHinUXp:w:k:q:m:g:t:z:s:o:P:M:A:Q:x:u:E:S:",
                        long_options, &option_index);
 
       if (c == -1)
@@ -192,14 +241,112 @@ read_params (int argc, char **argv)
 
         case 'p':
           strcpy (p->outfile_prefix, optarg);
-          strcpy (p->outfile_name1, p->outfile_prefix);
-          strcpy (p->outfile_name2, p->outfile_prefix);
-          strcat (p->outfile_name1, ".1.gz");
-          strcat (p->outfile_name2, ".2.gz");
+          break;
+
+        case 'o':
+          if (strcmp (optarg, "plain") == 0)
+            p->output_format = BGZF_FORMAT_PLAIN;
+          else if (strcmp (optarg, "gz") == 0)
+            p->output_format = BGZF_FORMAT_GZ;
+          else if (strcmp (optarg, "bgzf") == 0)
+            p->output_format = BGZF_FORMAT_BGZF;
+          else
+            {
+              fputs ("Error: -o needs to be plain, gz or bgzf", stderr);
+              abort ();
+            }
           break;
 
         case 'k':
           p->kmer_size = atoi (optarg);
+          if ((p->kmer_size < 1) || (p->kmer_size > KMER_MAX_K))
+            {
+              fputs ("Error: -k needs to be between 1 and 127", stderr);
+              abort ();
+            }
+          break;
+
+        case 'd':
+          p->flag |= KMER_DUMP;
+          break;
+
+        case 'e':
+          p->flag |= KMER_ESTIMATE;
+          break;
+
+        case 'c':
+          p->flag |= KMER_COUNT_MIN | KMER_ESTIMATE;
+          break;
+
+        case 'H':
+          p->flag |= KMER_HIST;
+          break;
+
+        case 'b':
+          p->flag |= KMER_BLOOM;
+          break;
+
+        case 'D':
+          p->flag |= KMER_DB;
+          break;
+
+        case 'B':
+          p->flag |= RMDUP_BEST;
+          break;
+
+        case 'x':
+          p->mismatches = atoi (optarg);
+          if ((p->mismatches < 0) || (p->mismatches > RMDUP_MAX_MISMATCHES))
+            {
+              fputs ("Error: -x needs to be between 0 and 16", stderr);
+              abort ();
+            }
+          break;
+
+        case 'u':
+          p->umi_bases = atoi (optarg);
+          if ((p->umi_bases < 1) || (p->umi_bases > RMDUP_MAX_UMI))
+            {
+              fputs ("Error: -u needs to be between 1 and 32", stderr);
+              abort ();
+            }
+          break;
+
+        case 'U':
+          p->flag |= RMDUP_UMI;
+          break;
+
+        case 'X':
+          p->flag |= RMDUP_APPROX;
+          break;
+
+        case 'E':
+          p->umi_mismatches = atoi (optarg);
+          if ((p->umi_mismatches < 0) ||
+              (p->umi_mismatches > RMDUP_MAX_UMI_MISMATCHES))
+            {
+              fputs ("Error: -E needs to be between 0 and 3", stderr);
+              abort ();
+            }
+          break;
+
+        case 'A':
+          if (p->kmer_ndbs == KMER_MAX_DBS)
+            {
+              fputs ("Error: -A can name at most 64 databases", stderr);
+              abort ();
+            }
+          p->kmer_dbs[p->kmer_ndbs++] = optarg;
+          p->flag |= KMER_DB;
+          break;
+
+        case 'Q':
+          p->kmer_qual = atoi (optarg);
+          if ((p->kmer_qual < 0) || (p->kmer_qual > 93))
+            {
+              fputs ("Error: -Q needs to be between 0 and 93", stderr);
+              abort ();
+            }
           break;
 
         case 'w':
@@ -228,6 +375,55 @@ read_params (int argc, char **argv)
           p->gap_size = atoi (optarg);
           break;
 
+        case 't':
+          p->threads = atoi (optarg);
+          if (p->threads < 1)
+            {
+              fputs ("Error: -t needs to be greater than 0", stderr);
+              abort ();
+            }
+          break;
+
+        case 'z':
+          p->compress_level = atoi (optarg);
+          if ((p->compress_level < 0) || (p->compress_level > 9))
+            {
+              fputs ("Error: -z needs to be between 0 and 9", stderr);
+              abort ();
+            }
+          break;
+
+        case 's':
+          p->index_span = atoi (optarg);
+          if (p->index_span < 1)
+            {
+              fputs ("Error: -s needs to be greater than 0", stderr);
+              abort ();
+            }
+          break;
+
+        case 'P':
+          p->kmer_parts = atoi (optarg);
+          if (p->kmer_parts < 1)
+            {
+              fputs ("Error: -P needs to be greater than 0", stderr);
+              abort ();
+            }
+          break;
+
+        case 'S':
+          p->first_record = strtoull (optarg, NULL, 10);
+          break;
+
+        case 'M':
+          p->mem_limit = atoi (optarg);
+          if (p->mem_limit < 1)
+            {
+              fputs ("Error: -M needs to be greater than 0", stderr);
+              abort ();
+            }
+          break;
+
         case '?':
           if (optopt == 'o')
             printf ("Error: the option -%c requires an argument.\n", optopt);
@@ -254,7 +450,7 @@ read_params (int argc, char **argv)
           p->flag |= TWO_INPUTS;
         }
     }
-  else
+  else if ((p->func != KMER) || (p->kmer_ndbs == 0))
     {
       puts ("Error: need the input fastQ sequence file name as mandatory "
             "argument.\n");
@@ -262,6 +458,134 @@ read_params (int argc, char **argv)
       abort ();
     }
 
+  /* Name the output files-- without a prefix, or with the prefix "-",
+     the output goes to the standard output, and is plain unless -o says
+     otherwise.  Named files are BGZF by default */
+  if ((p->outfile_prefix[0] == '\0') || (strcmp (p->outfile_prefix, "-") == 0))
+    {
+      if (p->output_format < 0)
+        p->output_format = BGZF_FORMAT_PLAIN;
+      strcpy (p->outfile_name1, "-");
+      strcpy (p->outfile_name2, "-");
+    }
+  else
+    {
+      if (p->output_format < 0)
+        p->output_format = BGZF_FORMAT_BGZF;
+      strcpy (p->outfile_name1, p->outfile_prefix);
+      strcpy (p->outfile_name2, p->outfile_prefix);
+      strcat (p->outfile_name1, (p->output_format == BGZF_FORMAT_PLAIN) ?
+              ".1.fq" : ".1.gz");
+      strcat (p->outfile_name2, (p->output_format == BGZF_FORMAT_PLAIN) ?
+              ".2.fq" : ".2.gz");
+    }
+
+  /* A memory cap alone counts k-mers over the default partitions */
+  if ((p->func == KMER) && (p->mem_limit > 0) && (p->kmer_parts == 0) &&
+      !(p->flag & KMER_ESTIMATE))
+    p->kmer_parts = KMER_PARTITIONS;
+  if ((p->flag & KMER_ESTIMATE) && (p->flag & (KMER_DUMP | KMER_HIST)))
+    {
+      fputs ("Error: -d and -H need exact counts and cannot be used with "
+             "-e\n", stderr);
+      abort ();
+    }
+  if ((p->flag & KMER_DB) && ((p->flag & KMER_ESTIMATE) ||
+                                (strcmp (p->outfile_name1, "-") == 0)))
+    {
+      fputs ("Error: -D needs exact counts and a prefix other than \"-\"\n",
+             stderr);
+      abort ();
+    }
+  if ((p->kmer_size > KT_MAX_K) &&
+      ((p->flag & (KMER_ESTIMATE | KMER_DB)) || (p->kmer_parts > 0)))
+    {
+      fputs ("Error: -e, -c, -D, -P and -M need -k of 32 or less\n", stderr);
+      abort ();
+    }
+  if ((p->kmer_ndbs > 0) && (p->flag & KMER_DUMP))
+    {
+      fputs ("Error: -d cannot be used with -A\n", stderr);
+      abort ();
+    }
+  if ((p->func == RMDUP) && (p->flag & RMDUP_APPROX) &&
+      ((p->flag & (RMDUP_BEST | RMDUP_UMI)) || (p->mismatches > 0) ||
+       (p->umi_bases > 0) || (p->kmer_parts > 0)))
+    {
+      fputs ("Error: -X cannot be used with -P, -B, -x, -u or -U\n", stderr);
+      abort ();
+    }
+  if ((p->func == RMDUP) && !(p->flag & RMDUP_APPROX) &&
+      ((p->mem_limit > 0) || (p->flag & RMDUP_BEST)) &&
+      ((strcmp (p->seqfile_name1, "-") == 0) ||
+          ((p->flag & TWO_INPUTS) && (strcmp (p->seqfile_name2, "-") == 0))))
+    {
+      fputs ("Error: -M and -B read the input twice and need it in a file\n",
+             stderr);
+      abort ();
+    }
+  if ((p->mismatches > 0) && ((p->mem_limit > 0) || (p->flag & RMDUP_BEST)))
+    {
+      fputs ("Error: -x cannot be used with -M or -B\n", stderr);
+      abort ();
+    }
+  if ((p->umi_bases > 0) && (p->flag & RMDUP_UMI))
+    {
+      fputs ("Error: -u and -U cannot be used together\n", stderr);
+      abort ();
+    }
+  if (p->umi_bases > 0)
+    p->flag |= RMDUP_UMI;
+  if ((p->umi_mismatches > 0) && !(p->flag & RMDUP_UMI))
+    {
+      fputs ("Error: -E needs -u or -U\n", stderr);
+      abort ();
+    }
+  if ((p->flag & RMDUP_UMI) &&
+      ((p->mem_limit > 0) || (p->flag & RMDUP_BEST) || (p->mismatches > 0)))
+    {
+      fputs ("Error: -u and -U cannot be used with -M, -B or -x\n", stderr);
+      abort ();
+    }
+  if ((p->flag & RMDUP_BEST) && (p->mem_limit > 0))
+    {
+      fputs ("Error: -B keeps every fingerprint in memory and cannot be "
+             "used with -M\n", stderr);
+      abort ();
+    }
+  if ((p->func == KMERQUERY) && !(p->flag & TWO_INPUTS))
+    {
+      fputs ("Error: need a k-mer database and a file of queries\n", stderr);
+      function_usage (p->func);
+      abort ();
+    }
+  if ((p->flag & KMER_DUMP) && (p->flag & KMER_HIST))
+    {
+      fputs ("Error: only one of -d and -H can write the output file\n",
+             stderr);
+      abort ();
+    }
+
+  /* Only one stream can be the standard input or output */
+  if ((p->flag & TWO_INPUTS) && (strcmp (p->seqfile_name1, "-") == 0) &&
+      (strcmp (p->seqfile_name2, "-") == 0))
+    {
+      fputs ("Error: only one input fastQ file can be the standard input\n",
+             stderr);
+      abort ();
+    }
+  if ((p->func == PAIR) || (((p->func == FILTER) || (p->func == RMDUP)) &&
+                            (p->flag & TWO_INPUTS)))
+    {
+      if (strcmp (p->outfile_name1, "-") == 0)
+        {
+          fputs ("Error: two output fastQ files need a prefix other than "
+                 "\"-\"\n", stderr);
+          function_usage (p->func);
+          abort ();
+        }
+    }
+
   /* For the FILTER, PAIR, RMDUP and JOIN functions
      make sure there was second non-optioned argument */
   if ((p->func == FILTER) || (p->func == PAIR) || (p->func == RMDUP) || (p->func == JOIN))
@@ -305,6 +629,11 @@ main_usage (void)
   puts ("  rmdup    remove duplicate reads");
   puts ("  kmer     count number of unique k-mers in fastQ file");
   puts ("  join     aligned mated pairs joined");
+  puts ("  index    index a gzip fastQ file for parallel decompression");
+  puts ("  kmer-query  look up k-mers or reads in a k-mer database");
+  putchar ('\n');
+  puts ("A file name of \"-\" reads the standard input, and a prefix of \"-\" or no");
+  puts ("prefix writes the standard output.");
   putchar ('\n');
   return 1;
 }
@@ -327,6 +656,14 @@ function_usage (int f)
       puts
      ("  -w, --allowed-N         number of IUPAC ambiguity characters (N)");
      ("                          tolerated in a read [default: 0]");
+      puts
+     ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts
+     ("  -t, --threads=Number    number of worker and compression threads [default: 1]");
+      puts
+     ("  -z, --compress-level=Level  gzip compression level 0-9 [default: 6]");
+      puts
+     ("  -o, --output-format=Format  plain, gz or bgzf [default: bgzf, plain on stdout]");
       break;
     case TRIM:
       puts ("Usage: ngscmd trim [OPTION]... [FILE]...");
@@ -340,6 +677,14 @@ function_usage (int f)
      ("  -m, --min-length=Length    minimum read length to retain after trimming [default: 25]");
       puts
      ("  -q, --trim-quality=Score   quality parameter [default: 13]");
+      puts
+     ("  -S, --skip=Number          skip this many records of each input [default: 0]");
+      puts
+     ("  -t, --threads=Number       number of worker and compression threads [default: 1]");
+      puts
+     ("  -z, --compress-level=Level gzip compression level 0-9 [default: 6]");
+      puts
+     ("  -o, --output-format=Format plain, gz or bgzf [default: bgzf, plain on stdout]");
       break;
     case PAIR:
       puts ("Usage: ngscmd pair [OPTION]... [FILE]...");
@@ -348,6 +693,10 @@ function_usage (int f)
       puts
      ("Mandatory arguments to long options are mandatory for short options too.");
       puts ("  -p, --prefix=Name       prefix string for name of fastQ output files");
+      puts ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts ("  -t, --threads=Number    number of compression threads [default: 1]");
+      puts ("  -z, --compress-level=Level  gzip compression level 0-9 [default: 6]");
+      puts ("  -o, --output-format=Format  plain, gz or bgzf [default: bgzf, plain on stdout]");
       break;
     case SCORE:
       puts ("Usage: ngscmd score [OPTION]... [FILE]");
@@ -360,15 +709,69 @@ function_usage (int f)
       puts ("                          [default: 64-126 to 33-126 scale]");
       puts ("  -a, --ascii             convert from numerical scores to ASCII");
       puts ("  -n, --number            convert from ASCII scores to numerical");
+      puts ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts ("  -t, --threads=Number    number of worker and compression threads [default: 1]");
+      puts ("  -z, --compress-level=Level  gzip compression level 0-9 [default: 6]");
+      puts ("  -o, --output-format=Format  plain, gz or bgzf [default: bgzf, plain on stdout]");
       break;
     case RMDUP:
       puts ("Usage: ngscmd rmdup [OPTION]... [FILE]...");
-      puts ("Remove duplicate reads");
+      puts ("Remove duplicate reads, or pairs of reads, keeping the first of each");
       putchar ('\n');
       puts
      ("Mandatory arguments to long options are mandatory for short options too.");
       puts
      ("Options: -p, --prefix=Name   prefix string for name of fastQ output file(s)");
+      puts
+     ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts
+     ("  -t, --threads=Number    number of fingerprinting and compression threads [default: 1]");
+      puts
+     ("  -M, --mem=MB            memory for fingerprints before spilling them to temporary");
+      puts
+     ("                          files, which are screened apart and in parallel, as many");
+      puts
+     ("                          at once as their tables fit in MB");
+      puts
+     ("  -P, --partitions=Number number of fingerprint partitions for -M, each holding a");
+      puts
+     ("                          temporary file open once it spills [default: 256]");
+      puts
+     ("  -B, --best-quality      keep the copy with the highest sum of quality scores,");
+      puts
+     ("                          rather than the first");
+      puts
+     ("  -x, --mismatches=N      also remove reads, or pairs, of the same length within N");
+      puts
+     ("                          mismatches of a kept one [default: 0]");
+      puts
+     ("  -u, --umi-bases=N       move the first N bases of the first read, its UMI, to the");
+      puts
+     ("                          end of the first word of the read IDs, and remove reads,");
+      puts
+     ("                          or pairs, of the same UMI and first 50 bases-- every");
+      puts
+     ("                          distinct UMI and prefix is held in memory, and -M does");
+      puts
+     ("                          not apply");
+      puts
+     ("  -U, --umi-header        as -u, with the UMI already the last colon-separated field");
+      puts
+     ("                          of the first word of the read IDs-- reads whose field is");
+      puts
+     ("                          not made of A, C, G, T, N and + are kept and counted");
+      puts
+     ("  -E, --umi-mismatches=N  count UMIs within N mismatches as the same [default: 0]");
+      puts
+     ("  -X, --approx            remove duplicates in one pass through a cuckoo filter of -M");
+      puts
+     ("                          MB [default: 256], which may take a few reads for");
+      puts
+     ("                          duplicates-- the expected number is reported");
+      puts
+     ("  -z, --compress-level=Level  gzip compression level 0-9 [default: 6]");
+      puts
+     ("  -o, --output-format=Format  plain, gz or bgzf [default: bgzf, plain on stdout]");
       break;
     case KMER:
       puts ("Usage: ngscmd kmer [OPTION]... [FILE]...");
@@ -376,7 +779,30 @@ function_usage (int f)
       putchar ('\n');
       puts
      ("Mandatory arguments to long options are mandatory for short options too.");
-      puts ("  -k, --kmer-size=Size    Length in base pairs of k-mers to count [default: 31]");
+      puts ("  -k, --kmer-size=Size    Length in base pairs of k-mers to count, up to 127 [default: 31]");
+      puts ("  -d, --dump              write every k-mer and its count to the output file");
+      puts ("  -Q, --min-kmer-qual=Q   skip k-mers holding a base of Phred+33 quality below Q");
+      puts ("                          [default: 0]");
+      puts ("  -p, --prefix=Name       prefix string for name of the k-mer output file");
+      puts ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts ("  -t, --threads=Number    number of decompression and counting threads-- more than one");
+      puts ("                          counts a file into a table shared by all threads [default: 1]");
+      puts ("  -P, --partitions=Number count k-mers in this many minimizer partitions");
+      puts ("  -M, --mem=MB            memory for the partitions and their count tables, past");
+      puts ("                          which partitions spill to a temporary file and fewer");
+      puts ("                          threads count them, or for the count-min sketch of -c");
+      puts ("                          [default: 4]");
+      puts ("  -H, --histogram         write the number of k-mers seen once, twice and so on to the");
+      puts ("                          output file, and estimate genome size and heterozygosity");
+      puts ("  -D, --database          also write the counts as a sorted k-mer database for");
+      puts ("                          kmer-query, named with the prefix and .kdb");
+      puts ("  -A, --add=DB            merge the counts of a k-mer database into the new one--");
+      puts ("                          may be repeated, and without a fastQ file only merges;");
+      puts ("                          -H then describes the merged counts");
+      puts ("  -b, --bloom             keep k-mers seen only once out of the count table with a");
+      puts ("                          Bloom filter");
+      puts ("  -e, --estimate          estimate the number of distinct k-mers in 16K of memory");
+      puts ("  -c, --count-min         with -e, also estimate the k-mers seen more than once");
       break;
     case JOIN:
       puts ("Usage: ngscmd join [OPTION]... [FILE]...");
@@ -386,6 +812,36 @@ function_usage (int f)
      ("Mandatory arguments to long options are mandatory for short options too.");
       puts ("  -p, --prefix=Name       prefix string for name of fastQ output files");
       puts ("  -g, --gap-size          the number of ambigous characters to insert between mate pairs");
+      puts ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts ("  -t, --threads=Number    number of compression threads [default: 1]");
+      puts ("  -z, --compress-level=Level  gzip compression level 0-9 [default: 6]");
+      puts ("  -o, --output-format=Format  plain, gz or bgzf [default: bgzf, plain on stdout]");
+      break;
+    case INDEX:
+      puts ("Usage: ngscmd index [OPTION]... [FILE]");
+      puts ("Write a checkpoint index next to a single-member gzip fastQ file, so that");
+      puts ("it can be decompressed in parallel by the other commands");
+      putchar ('\n');
+      puts
+     ("Mandatory arguments to long options are mandatory for short options too.");
+      puts ("  -s, --span=MB           uncompressed megabytes between checkpoints [default: 4]");
+      putchar ('\n');
+      puts ("The checkpoints also let -S of the other commands start reading near the");
+      puts ("record it asks for, rather than inflate the file up to it");
+      break;
+    case KMERQUERY:
+      puts ("Usage: ngscmd kmer-query [OPTION]... DATABASE FILE");
+      puts ("Look up the k-mers of the reads in a fastQ file, or of the sequences in a");
+      puts ("text file with one per line, in a database written by kmer -D.  A k-mer is");
+      puts ("printed with its count, and a longer sequence with its number of k-mers,");
+      puts ("the number found and their mean count");
+      putchar ('\n');
+      puts
+     ("Mandatory arguments to long options are mandatory for short options too.");
+      puts ("  -p, --prefix=Name       prefix string for name of the output file");
+      puts ("  -S, --skip=Number       skip this many records of each input [default: 0]");
+      puts ("  -t, --threads=Number    number of worker and compression threads [default: 1]");
+      puts ("  -o, --output-format=Format  plain, gz or bgzf [default: bgzf, plain on stdout]");
       break;
     default:
       puts ("Error: unrecognized function");
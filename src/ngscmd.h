@@ -33,14 +33,20 @@ extern "C"
 #endif
 
 /* Define constants */
-#ifndef MAX_LINE_LENGTH
-#define MAX_LINE_LENGTH 400
-#endif
-#define BUFFSIZE 2000
 #define TWO_INPUTS 0x1
 #define SCORE_NUM 0x8
 #define SCORE_ASCII 0x10
 #define SCORE_ILLUMINA 0x20
+#define KMER_DUMP 0x40
+#define KMER_ESTIMATE 0x80
+#define KMER_COUNT_MIN 0x100
+#define KMER_HIST 0x200
+#define KMER_BLOOM 0x400
+#define KMER_DB 0x800
+#define RMDUP_BEST 0x1000
+#define RMDUP_UMI 0x2000
+#define RMDUP_APPROX 0x4000
+#define KMER_MAX_DBS 64
 
   typedef struct _ngs_params
   {
@@ -51,6 +57,19 @@ extern "C"
     int trim_quality;
     int kmer_size;
     int gap_size;
+    int threads;
+    int compress_level;
+    int index_span;
+    int output_format;
+    int kmer_parts;
+    int mem_limit;
+    int kmer_ndbs;
+    int kmer_qual;
+    int mismatches;
+    int umi_bases;
+    int umi_mismatches;
+    unsigned long long first_record;
+    char *kmer_dbs[KMER_MAX_DBS];
     char outfile_prefix[FILENAME_MAX-5];
     char seqfile_name1[FILENAME_MAX];
     char seqfile_name2[FILENAME_MAX];
@@ -96,6 +115,8 @@ extern "C"
   extern int ngs_kmer (ngs_params *);
   extern int ngs_score (ngs_params *);
   extern int ngs_join (ngs_params *);
+  extern int ngs_index (ngs_params *);
+  extern int ngs_kmer_query (ngs_params *);
   extern void INThandler (int);
 
 #ifdef __cplusplus
@@ -17,6 +17,9 @@
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "fastq.h"
+#include "arena.h"
 #include "uthash.h"
 
 typedef struct _entry
@@ -24,26 +27,54 @@ typedef struct _entry
   const char *fqid;     /* key */
   const char *seq;      /* sequence string */
   const char *qual;     /* quality string */
+  size_t fqid_len;
+  size_t seq_len;
+  size_t qual_len;
   UT_hash_handle hh;    /* makes this structure hashable */
 } entry;
 
+/* Serialize one mate of a pair into an output buffer, with the mate
+   number appended to its key */
+
+static void
+pair_put (fq_buf *o, const char *id, size_t id_len, char mate,
+          const char *seq, size_t seq_len, const char *qual,
+          size_t qual_len)
+{
+  char *s = fq_buf_reserve (o, id_len + seq_len + qual_len + 6);
+
+  memcpy (s, id, id_len);
+  s += id_len;
+  *s++ = mate;
+  *s++ = '\n';
+  memcpy (s, seq, seq_len);
+  s += seq_len;
+  memcpy (s, "\n+\n", 3);
+  s += 3;
+  memcpy (s, qual, qual_len);
+  s[qual_len] = '\n';
+}
+
 int
 ngs_pair (ngs_params * p)
 {
-  int i = 0;
-  int input_buffer_count = 0;
-  char input_buffer1[BUFFSIZE][MAX_LINE_LENGTH];
-  char input_buffer2[BUFFSIZE][MAX_LINE_LENGTH];
+  size_t i = 0;
+  size_t key_len = 0;
+  char *s = NULL;
+  fq_batch batch;
+  fq_buf out1;
+  fq_buf out2;
+  ngs_arena records;
   entry *e = NULL;
-  entry *tmp = NULL;
   entry *hash_fastq2 = NULL;
-  gzFile input_fastq1;
-  gzFile input_fastq2;
-  gzFile output_fastq1;
-  gzFile output_fastq2;
+  fq_reader *input_fastq1 = NULL;
+  fq_reader *input_fastq2 = NULL;
+  bgzf_writer *output_fastq1;
+  bgzf_writer *output_fastq2;
 
   /* Open the first fastQ input stream */
-  if ((input_fastq1 = gzopen (p->seqfile_name1, "rb")) == Z_NULL)
+  if ((input_fastq1 = fq_open (p->seqfile_name1, p->threads,
+                               p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: %s.\n\n",
                p->seqfile_name1);
@@ -51,7 +82,8 @@ ngs_pair (ngs_params * p)
     }
 
   /* Open the second fastQ input stream */
-  if ((input_fastq2 = gzopen (p->seqfile_name2, "rb")) == Z_NULL)
+  if ((input_fastq2 = fq_open (p->seqfile_name2, p->threads,
+                               p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the second input "
                "fastQ file: %s.\n\n", p->seqfile_name2);
@@ -59,7 +91,8 @@ ngs_pair (ngs_params * p)
     }
 
   /* Open the first fastQ output stream */
-  if ((output_fastq1 = gzopen (p->outfile_name1, "wb")) == Z_NULL)
+  if ((output_fastq1 = bgzf_open (p->outfile_name1, p->output_format,
+                                  p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the output fastQ file: "
                "%s.\n", p->outfile_name1);
@@ -67,7 +100,8 @@ ngs_pair (ngs_params * p)
     }
 
   /* Open the second fastQ output stream */
-  if ((output_fastq2 = gzopen (p->outfile_name2, "wb")) == Z_NULL)
+  if ((output_fastq2 = bgzf_open (p->outfile_name2, p->output_format,
+                                  p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the second output fastQ file: "
                "%s.\n", p->outfile_name2);
@@ -77,107 +111,80 @@ ngs_pair (ngs_params * p)
   /* Set up interrupt trap */
   signal (SIGINT, INThandler);
 
+  fq_batch_init (&batch, FQ_BLOCK_SIZE);
+  fq_buf_init (&out1);
+  fq_buf_init (&out2);
+  arena_init (&records, ARENA_CHUNK_SIZE);
+
   /* Enter data from the second fastQ input file
      into a hash table */
-  while (1)
+  while (fq_read (input_fastq2, &batch, FQ_BATCH_RECORDS) > 0)
     {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
-        {
-          /* Get line from the second fastQ input stream */
-          if (gzgets (input_fastq2, input_buffer2[input_buffer_count], MAX_LINE_LENGTH)
-              == Z_NULL)
-            break;
-
-          /* Iterate the counter for the number of lines
-             currently in the input buffer */
-          ++input_buffer_count;
-        }
-
-      for (i = 0; i < input_buffer_count; ++i)
+      for (i = 0; i < batch.n; ++i)
         {
-          if (i % 4 == 3)
-            {
-               e = (entry *) malloc (sizeof (entry));
-               chomp (input_buffer2[i-3]);
-               input_buffer2[i-3][strlen (input_buffer2[i-3]) - 1] = '\0';
-               e->fqid = input_buffer2[i-3];
-               e->seq = input_buffer2[i-2];
-               e->qual = input_buffer2[i];
-               HASH_ADD_KEYPTR (hh, hash_fastq2, e->fqid, strlen (e->fqid), e);
-            }
+          const fq_record *r = &batch.rec[i];
+
+          /* Copy the record out of the batch, which is reused */
+          key_len = fq_mate_key_len (r);
+          e = (entry *) arena_alloc (&records, sizeof (entry) + key_len
+                                     + r->seq_len + r->qual_len);
+          s = (char *) (e + 1);
+          memcpy (s, r->id, key_len);
+          e->fqid = s;
+          e->fqid_len = key_len;
+          s += key_len;
+          memcpy (s, r->seq, r->seq_len);
+          e->seq = s;
+          e->seq_len = r->seq_len;
+          s += r->seq_len;
+          memcpy (s, r->qual, r->qual_len);
+          e->qual = s;
+          e->qual_len = r->qual_len;
+          HASH_ADD_KEYPTR (hh, hash_fastq2, e->fqid, e->fqid_len, e);
         }
-
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-        break;
     }
 
   /* Read through first fastQ input file
      and lookup IDs in hash table */
-  while (1)
+  while (fq_read (input_fastq1, &batch, FQ_BATCH_RECORDS) > 0)
     {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
+      out1.l = 0;
+      out2.l = 0;
+      for (i = 0; i < batch.n; ++i)
         {
-           /* Get line from the first fastQ input stream */
-           if (gzgets (input_fastq1, input_buffer1[input_buffer_count], MAX_LINE_LENGTH)
-               == Z_NULL)
-             break;
-
-           /* Iterate the counter for the number of lines
-              currently in the input buffer */
-           ++input_buffer_count;
-        }
+          const fq_record *r = &batch.rec[i];
 
-      for (i = 0; i < input_buffer_count; ++i)
-        {
-          if (i % 4 == 3)
+          key_len = fq_mate_key_len (r);
+          HASH_FIND (hh, hash_fastq2, r->id, key_len, e);
+          if (e)
             {
-              chomp (input_buffer1[i-3]);
-              input_buffer1[i-3][strlen (input_buffer1[i-3]) - 1] = '\0';
-              HASH_FIND_STR (hash_fastq2, input_buffer1[i-3], e);
-              if (e)
-                {
-                   gzputs (output_fastq1, input_buffer1[i-3]);
-                   gzputs (output_fastq1, "1\n");
-                   gzputs (output_fastq1, input_buffer1[i-2]);
-                   gzputs (output_fastq1, "+\n");
-                   gzputs (output_fastq1, input_buffer1[i]);
-                   gzputs (output_fastq2, e->fqid);
-                   gzputs (output_fastq2, "2\n");
-                   gzputs (output_fastq2, e->seq);
-                   gzputs (output_fastq2, "+\n");
-                   gzputs (output_fastq2, e->qual);
-                 }
+              pair_put (&out1, r->id, key_len, '1', r->seq, r->seq_len,
+                        r->qual, r->qual_len);
+              pair_put (&out2, e->fqid, e->fqid_len, '2', e->seq,
+                        e->seq_len, e->qual, e->qual_len);
             }
         }
 
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-        break;
+      /* Hand the whole batch to the compressors at once */
+      bgzf_write (output_fastq1, out1.s, out1.l);
+      bgzf_write (output_fastq2, out2.s, out2.l);
     }
 
-  /* Free the hash table contents */
-  HASH_ITER (hh, hash_fastq2, e, tmp)
-  {
-    HASH_DEL (hash_fastq2, e);
-    free (e);
-  }
+  fq_batch_free (&batch);
+  fq_buf_free (&out1);
+  fq_buf_free (&out2);
+
+  /* Free the hash table and the records it holds */
+  HASH_CLEAR (hh, hash_fastq2);
+  arena_free (&records);
 
   /* Close the fastQ input streams */
-  gzclose (input_fastq1);
-  gzclose (input_fastq2);
+  fq_close (input_fastq1);
+  fq_close (input_fastq2);
 
   /* Close the fastQ output streams */
-  gzclose (output_fastq1);
-  gzclose (output_fastq2);
+  bgzf_close (output_fastq1);
+  bgzf_close (output_fastq2);
 
   return 0;
 }
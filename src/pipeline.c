@@ -0,0 +1,307 @@
+/* pipeline - Multithreaded reader/worker/writer engine for
+   record-wise commands
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <pthread.h>
+
+#include "ngscmd.h"
+#include "pipeline.h"
+
+/* A batch on its way through the pipeline */
+typedef struct _pipe_job
+{
+  unsigned long long seq;    /* position of the batch in the input */
+  fq_batch in1;
+  fq_batch in2;
+  fq_buf out1;
+  fq_buf out2;
+  struct _pipe_job *next;
+} pipe_job;
+
+/* State shared by the reader, worker and writer threads */
+typedef struct _pipe_state
+{
+  ngs_pipeline *pl;
+  pthread_mutex_t lock;
+  pthread_cond_t free_cv;    /* a job was returned to the free list */
+  pthread_cond_t work_cv;    /* a job was queued for the workers */
+  pthread_cond_t done_cv;    /* a worker finished a job */
+  pipe_job *jobs;
+  pipe_job *free_list;
+  pipe_job *work_head;
+  pipe_job *work_tail;
+  pipe_job **done;           /* reorder buffer indexed by seq % njobs */
+  int njobs;
+  int eof;                   /* the reader has queued its last job */
+  unsigned long long total;  /* number of jobs queued by the reader */
+} pipe_state;
+
+static void *pipe_reader (void *);
+static void *pipe_worker (void *);
+static size_t pipe_read (ngs_pipeline *, pipe_job *);
+static void pipe_write (ngs_pipeline *, pipe_job *);
+static void pipe_serial (ngs_pipeline *);
+
+/* Run a record-wise command-- one reader thread fills batches, worker
+   threads process them and the calling thread writes the results
+   through a reorder buffer, so the output order matches the input */
+
+void
+pipeline_run (ngs_pipeline *pl)
+{
+  int i = 0;
+  int nworkers = pl->p->threads;
+  pipe_state st;
+  pipe_job *job = NULL;
+  pthread_t reader;
+  pthread_t *workers = NULL;
+  unsigned long long next = 0;
+
+  if (nworkers < 2)
+    {
+      pipe_serial (pl);
+      return;
+    }
+
+  /* Allocate enough jobs to keep every worker busy while
+     the reader and writer work on others */
+  memset (&st, 0, sizeof (pipe_state));
+  st.pl = pl;
+  st.njobs = 2 * nworkers + 2;
+  st.jobs = (pipe_job *) calloc (st.njobs, sizeof (pipe_job));
+  st.done = (pipe_job **) calloc (st.njobs, sizeof (pipe_job *));
+  workers = (pthread_t *) malloc (nworkers * sizeof (pthread_t));
+  if ((st.jobs == NULL) || (st.done == NULL) || (workers == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for the processing "
+             "pipeline.\n\n", stderr);
+      abort ();
+    }
+  for (i = 0; i < st.njobs; ++i)
+    {
+      fq_batch_init (&st.jobs[i].in1, FQ_BLOCK_SIZE);
+      fq_batch_init (&st.jobs[i].in2, FQ_BLOCK_SIZE);
+      fq_buf_init (&st.jobs[i].out1);
+      fq_buf_init (&st.jobs[i].out2);
+      st.jobs[i].next = st.free_list;
+      st.free_list = &st.jobs[i];
+    }
+  pthread_mutex_init (&st.lock, NULL);
+  pthread_cond_init (&st.free_cv, NULL);
+  pthread_cond_init (&st.work_cv, NULL);
+  pthread_cond_init (&st.done_cv, NULL);
+
+  /* Start the reader and worker threads */
+  if (pthread_create (&reader, NULL, pipe_reader, &st) != 0)
+    {
+      fputs ("\n\nError: cannot create the reader thread.\n\n", stderr);
+      abort ();
+    }
+  for (i = 0; i < nworkers; ++i)
+    {
+      if (pthread_create (&workers[i], NULL, pipe_worker, &st) != 0)
+        {
+          fputs ("\n\nError: cannot create a worker thread.\n\n", stderr);
+          abort ();
+        }
+    }
+
+  /* Write finished jobs in input order */
+  while (1)
+    {
+      pthread_mutex_lock (&st.lock);
+      while ((st.done[next % st.njobs] == NULL) &&
+             !(st.eof && (next == st.total)))
+        pthread_cond_wait (&st.done_cv, &st.lock);
+      if (st.eof && (next == st.total))
+        {
+          pthread_mutex_unlock (&st.lock);
+          break;
+        }
+      job = st.done[next % st.njobs];
+      st.done[next % st.njobs] = NULL;
+      pthread_mutex_unlock (&st.lock);
+
+      pipe_write (pl, job);
+
+      pthread_mutex_lock (&st.lock);
+      job->next = st.free_list;
+      st.free_list = job;
+      pthread_cond_signal (&st.free_cv);
+      pthread_mutex_unlock (&st.lock);
+      ++next;
+    }
+
+  pthread_join (reader, NULL);
+  for (i = 0; i < nworkers; ++i)
+    pthread_join (workers[i], NULL);
+
+  /* Release the jobs */
+  for (i = 0; i < st.njobs; ++i)
+    {
+      fq_batch_free (&st.jobs[i].in1);
+      fq_batch_free (&st.jobs[i].in2);
+      fq_buf_free (&st.jobs[i].out1);
+      fq_buf_free (&st.jobs[i].out2);
+    }
+  pthread_mutex_destroy (&st.lock);
+  pthread_cond_destroy (&st.free_cv);
+  pthread_cond_destroy (&st.work_cv);
+  pthread_cond_destroy (&st.done_cv);
+  free (st.jobs);
+  free (st.done);
+  free (workers);
+}
+
+/* Reader thread-- fill free jobs with batches and queue them */
+
+static void *
+pipe_reader (void *arg)
+{
+  pipe_state *st = (pipe_state *) arg;
+  pipe_job *job = NULL;
+
+  while (1)
+    {
+      pthread_mutex_lock (&st->lock);
+      while (st->free_list == NULL)
+        pthread_cond_wait (&st->free_cv, &st->lock);
+      job = st->free_list;
+      st->free_list = job->next;
+      pthread_mutex_unlock (&st->lock);
+
+      if (pipe_read (st->pl, job) == 0)
+        {
+          /* Tell the workers and the writer there is nothing more */
+          pthread_mutex_lock (&st->lock);
+          job->next = st->free_list;
+          st->free_list = job;
+          st->eof = 1;
+          pthread_cond_broadcast (&st->work_cv);
+          pthread_cond_broadcast (&st->done_cv);
+          pthread_mutex_unlock (&st->lock);
+          break;
+        }
+
+      pthread_mutex_lock (&st->lock);
+      job->seq = st->total++;
+      job->next = NULL;
+      if (st->work_tail != NULL)
+        st->work_tail->next = job;
+      else
+        st->work_head = job;
+      st->work_tail = job;
+      pthread_cond_signal (&st->work_cv);
+      pthread_mutex_unlock (&st->lock);
+    }
+
+  return NULL;
+}
+
+/* Worker thread-- process queued jobs and hand them to the writer */
+
+static void *
+pipe_worker (void *arg)
+{
+  pipe_state *st = (pipe_state *) arg;
+  ngs_pipeline *pl = st->pl;
+  pipe_job *job = NULL;
+
+  while (1)
+    {
+      pthread_mutex_lock (&st->lock);
+      while ((st->work_head == NULL) && !st->eof)
+        pthread_cond_wait (&st->work_cv, &st->lock);
+      if (st->work_head == NULL)
+        {
+          pthread_mutex_unlock (&st->lock);
+          break;
+        }
+      job = st->work_head;
+      st->work_head = job->next;
+      if (st->work_head == NULL)
+        st->work_tail = NULL;
+      pthread_mutex_unlock (&st->lock);
+
+      fq_batch_parse (pl->in1, &job->in1);
+      job->out1.l = 0;
+      job->out2.l = 0;
+      pl->work (pl->p, pl->arg, &job->in1, pl->in2 ? &job->in2 : NULL,
+                &job->out1, (pl->out2 || pl->emit) ? &job->out2 : NULL);
+
+      pthread_mutex_lock (&st->lock);
+      st->done[job->seq % st->njobs] = job;
+      pthread_cond_signal (&st->done_cv);
+      pthread_mutex_unlock (&st->lock);
+    }
+
+  return NULL;
+}
+
+/* Read the next batch of a job from the input stream(s)-- a single
+   mapped file is only cut into blocks, which the workers parse */
+
+static size_t
+pipe_read (ngs_pipeline *pl, pipe_job *job)
+{
+  if (pl->in2 != NULL)
+    return fq_read_pair (pl->in1, pl->in2, &job->in1, &job->in2,
+                         FQ_BATCH_RECORDS);
+  else
+    return fq_read_block (pl->in1, &job->in1, FQ_BATCH_RECORDS);
+}
+
+/* Write the output buffers of a job to the output stream(s) */
+
+static void
+pipe_write (ngs_pipeline *pl, pipe_job *job)
+{
+  if (pl->emit != NULL)
+    {
+      pl->emit (pl->arg, &job->out1, &job->out2);
+      return;
+    }
+  bgzf_write (pl->out1, job->out1.s, job->out1.l);
+  if (pl->out2 != NULL)
+    bgzf_write (pl->out2, job->out2.s, job->out2.l);
+}
+
+/* Run the pipeline on the calling thread alone */
+
+static void
+pipe_serial (ngs_pipeline *pl)
+{
+  pipe_job job;
+
+  memset (&job, 0, sizeof (pipe_job));
+  fq_batch_init (&job.in1, FQ_BLOCK_SIZE);
+  fq_batch_init (&job.in2, FQ_BLOCK_SIZE);
+
+  while (pipe_read (pl, &job) > 0)
+    {
+      fq_batch_parse (pl->in1, &job.in1);
+      job.out1.l = 0;
+      job.out2.l = 0;
+      pl->work (pl->p, pl->arg, &job.in1, pl->in2 ? &job.in2 : NULL,
+                &job.out1, (pl->out2 || pl->emit) ? &job.out2 : NULL);
+      pipe_write (pl, &job);
+    }
+
+  fq_batch_free (&job.in1);
+  fq_batch_free (&job.in2);
+  fq_buf_free (&job.out1);
+  fq_buf_free (&job.out2);
+}
@@ -0,0 +1,60 @@
+/* pipeline - Multithreaded reader/worker/writer engine for
+   record-wise commands
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "fastq.h"
+#include "bgzf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  /* Process one batch of records-- the second input batch and
+     output buffer are NULL for a single input stream */
+  typedef void (*pipe_fn) (ngs_params *, void *, fq_batch *, fq_batch *,
+                           fq_buf *, fq_buf *);
+
+  /* Consume the output buffers of a batch in input order, in place
+     of writing them to the output streams-- both buffers are always
+     handed to the work function and to emit */
+  typedef void (*pipe_out) (void *, fq_buf *, fq_buf *);
+
+  /* The streams and work function of a record-wise command */
+  typedef struct _ngs_pipeline
+  {
+    ngs_params *p;
+    fq_reader *in1;
+    fq_reader *in2;      /* NULL for a single input stream */
+    bgzf_writer *out1;
+    bgzf_writer *out2;   /* NULL for a single output stream */
+    pipe_fn work;
+    pipe_out emit;       /* NULL to write to the output streams */
+    void *arg;           /* passed to work and emit */
+  } ngs_pipeline;
+
+
+/* Function prototypes */
+  extern void pipeline_run (ngs_pipeline *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* PIPELINE_H */
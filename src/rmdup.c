@@ -16,26 +16,182 @@
 
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
-#include "ngscmd.h"
+#include "rmdup.h"
+#include "pipeline.h"
+#include "sketch.h"
+
+static int rmdup_keep_new (rmdup_out *, const fingerprint *,
+			   unsigned long long);
+static size_t rmdup_take (fq_buf *, size_t, fingerprint *, size_t *);
+
+/* Fingerprint each read of a batch, or each pair of reads-- a record
+   goes to out1 as its fingerprint, its length and the record itself,
+   and the second read of a pair goes to out2 as its length and itself */
+
+void
+rmdup_batch (ngs_params * p, void *arg, fq_batch * in1, fq_batch * in2,
+	     fq_buf * out1, fq_buf * out2)
+{
+  size_t i = 0;
+  fingerprint f;
+
+  (void) p;
+  (void) arg;
+  for (i = 0; i < in1->n; ++i)
+    {
+      rmdup_fingerprint (&f, in1, in2, i);
+      rmdup_put (out1, &f, &in1->rec[i]);
+      if (in2 != NULL)
+	rmdup_put (out2, NULL, &in2->rec[i]);
+    }
+}
+
+/* Keep the records of a batch that the keep function picks-- called on
+   one thread in input order.  The kept records are packed to the front
+   of the buffers and written at once */
+
+void
+rmdup_emit (void *arg, fq_buf * out1, fq_buf * out2)
+{
+  size_t r1 = 0;
+  size_t r2 = 0;
+  size_t w1 = 0;
+  size_t w2 = 0;
+  size_t len1 = 0;
+  size_t len2 = 0;
+  fingerprint f;
+  rmdup_out *st = (rmdup_out *) arg;
+
+  while (r1 < out1->l)
+    {
+      r1 = rmdup_take (out1, r1, &f, &len1);
+      if (st->out2 != NULL)
+	r2 = rmdup_take (out2, r2, NULL, &len2);
+      st->rec1 = out1->s + r1;
+      st->len1 = len1;
+      st->rec2 = (st->out2 != NULL) ? out2->s + r2 : NULL;
+      st->len2 = len2;
+      if (st->keep (st, &f, st->nreads++))
+	{
+	  memmove (out1->s + w1, out1->s + r1, len1);
+	  w1 += len1;
+	  if (st->out2 != NULL)
+	    {
+	      memmove (out2->s + w2, out2->s + r2, len2);
+	      w2 += len2;
+	    }
+	}
+      else
+	++st->ndup;
+      r1 += len1;
+      r2 += len2;
+    }
+
+  bgzf_write (st->out1, out1->s, w1);
+  if (st->out2 != NULL)
+    bgzf_write (st->out2, out2->s, w2);
+}
+
+/* Read the input files again from the start, writing the records that
+   the keep function of o picks */
+
+void
+rmdup_reread (ngs_params * p, rmdup_out * o)
+{
+  ngs_pipeline pl;
+
+  if ((pl.in1 = fq_open (p->seqfile_name1, p->threads,
+                         p->first_record)) == NULL)
+    {
+      fprintf (stderr, "\n\nError: cannot open the input fastQ file: "
+	       "%s.\n\n", p->seqfile_name1);
+      abort ();
+    }
+  pl.in2 = NULL;
+  if ((p->flag & TWO_INPUTS) &&
+      ((pl.in2 = fq_open (p->seqfile_name2, p->threads,
+                          p->first_record)) == NULL))
+    {
+      fprintf (stderr, "\n\nError: cannot open the second input fastQ "
+	       "file: %s.\n\n", p->seqfile_name2);
+      abort ();
+    }
+
+  pl.p = p;
+  pl.out1 = o->out1;
+  pl.out2 = o->out2;
+  pl.work = rmdup_batch;
+  pl.emit = rmdup_emit;
+  pl.arg = o;
+  pipeline_run (&pl);
+
+  fq_close (pl.in1);
+  if (pl.in2 != NULL)
+    fq_close (pl.in2);
+}
+
+/* Keep a read, or pair, whose fingerprint is not yet in the set-- so
+   the first occurrence is the one kept */
+
+static int
+rmdup_keep_new (rmdup_out * o, const fingerprint * f, unsigned long long ord)
+{
+  (void) ord;
+  return fp_add ((fp_table *) o->arg, f);
+}
+
+/* Append a record to a buffer after its fingerprint, if not NULL, and
+   its length */
+
+void
+rmdup_put (fq_buf * o, const fingerprint * f, const fq_record * rec)
+{
+  size_t start = 0;
+  unsigned int len = 0;
+
+  if (f != NULL)
+    fq_buf_put (o, (const char *) f, sizeof (fingerprint));
+  start = o->l;
+  fq_buf_put (o, (const char *) &len, sizeof (len));
+  fq_buf_record (o, rec);
+  len = (unsigned int) (o->l - start - sizeof (len));
+  memcpy (o->s + start, &len, sizeof (len));
+}
+
+/* Read the fingerprint, if f is not NULL, and the length of the record
+   at offset i of a buffer-- returns the offset of the record */
+
+static size_t
+rmdup_take (fq_buf * o, size_t i, fingerprint * f, size_t * len)
+{
+  unsigned int n = 0;
+
+  if (f != NULL)
+    {
+      memcpy (f, o->s + i, sizeof (fingerprint));
+      i += sizeof (fingerprint);
+    }
+  memcpy (&n, o->s + i, sizeof (n));
+  *len = n;
+
+  return i + sizeof (n);
+}
 
 int
 ngs_rmdup (ngs_params * p)
 {
-  int i = 0;
-  int j = 0;
-  int input_buffer_count = 0;
-  size_t k = 0;
-  size_t len = 0;
-  char input_buffer1[BUFFSIZE][MAX_LINE_LENGTH];
-  char input_buffer2[BUFFSIZE][MAX_LINE_LENGTH];
-  gzFile input_fastq1;
-  gzFile input_fastq2;
-  gzFile output_fastq1;
-  gzFile output_fastq2;
-
+  ngs_pipeline pl;
+  rmdup_out st;
+  fp_table seen;
+  fq_reader *input_fastq1 = NULL;
+  fq_reader *input_fastq2 = NULL;
+  bgzf_writer *output_fastq1;
+  bgzf_writer *output_fastq2 = NULL;
+  FILE *report = stdout;
 
   /* open the first fastQ input stream */
-  if ((input_fastq1 = gzopen (p->seqfile_name1, "rb")) == Z_NULL)
+  if ((input_fastq1 = fq_open (p->seqfile_name1, p->threads,
+                               p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: "
 	       "%s.\n\n", p->seqfile_name1);
@@ -45,7 +201,9 @@ ngs_rmdup (ngs_params * p)
   /* if specified-- open the second fastQ input stream */
   if (p->flag & TWO_INPUTS)
     {
-      if ((input_fastq2 = gzopen (p->seqfile_name2, "r")) == Z_NULL)
+      input_fastq2 = fq_open (p->seqfile_name2, p->threads,
+                              p->first_record);
+      if (input_fastq2 == NULL)
 	{
 	  fprintf (stderr, "\n\nError: cannot open the second input "
 		   "fastQ file: %s.\n\n", p->seqfile_name2);
@@ -54,7 +212,8 @@ ngs_rmdup (ngs_params * p)
     }
 
   /* open the first fastQ output stream */
-  if ((output_fastq1 = gzopen (p->outfile_name1, "wb")) == Z_NULL)
+  if ((output_fastq1 = bgzf_open (p->outfile_name1, p->output_format,
+				  p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the output fastQ file: "
 	       "%s.\n", p->outfile_name1);
@@ -64,7 +223,8 @@ ngs_rmdup (ngs_params * p)
   /* if specified-- open the second fastQ output stream */
   if (p->flag & TWO_INPUTS)
     {
-      if ((output_fastq2 = gzopen (p->outfile_name2, "w")) == Z_NULL)
+      if ((output_fastq2 = bgzf_open (p->outfile_name2, p->output_format,
+				      p->compress_level, p->threads)) == NULL)
 	{
 	  fprintf (stderr, "\n\nError: cannot open the second output "
 		   "fastQ file: %s.\n", p->outfile_name2);
@@ -75,54 +235,63 @@ ngs_rmdup (ngs_params * p)
   /* set up interrupt trap */
   signal (SIGINT, INThandler);
 
-  /* read through input fastQ files */
-  while (1)
+  /* keep the first occurrence of each read, or pair of reads, in
+     the order they come-- under a memory cap, through fingerprint
+     partitions spilled to temporary files-- or else the copy of best
+     quality, or the first of reads within a few mismatches, or of
+     reads of the same UMI-- or, in one pass and a fixed budget, the
+     first as far as a cuckoo filter of fingerprints can tell */
+  memset (&st, 0, sizeof (rmdup_out));
+  st.out1 = output_fastq1;
+  st.out2 = output_fastq2;
+  if (p->flag & RMDUP_BEST)
+    rmdup_best (p, input_fastq1, input_fastq2, &st);
+  else if (p->flag & RMDUP_APPROX)
+    rmdup_approx (p, input_fastq1, input_fastq2, &st,
+		  (size_t) ((p->mem_limit > 0) ? p->mem_limit : CF_MEM) << 20);
+  else if (p->flag & RMDUP_UMI)
+    rmdup_umi (p, input_fastq1, input_fastq2, &st);
+  else if (p->mismatches > 0)
+    rmdup_near (p, input_fastq1, input_fastq2, &st);
+  else if (p->mem_limit > 0)
+    rmdup_spill (p, input_fastq1, input_fastq2, &st);
+  else
     {
-      /* initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
-	{
-	  /* get line from first fastQ input stream */
-	  if (gzgets (input_fastq1, input_buffer1[input_buffer_count],
-		      MAX_LINE_LENGTH) == Z_NULL)
-	    break;
-
-	  /* get line from second fastQ input stream */
-	  if (p->flag & TWO_INPUTS)
-	    {
-	      if (gzgets (input_fastq2, input_buffer2[input_buffer_count],
-			  MAX_LINE_LENGTH) == Z_NULL)
-		break;
-	    }
-
-	  /* increment the counter for the number of lines
-	     currently in the input buffer */
-	  ++input_buffer_count;
-	}
-
-      /* reverse complement bases and reverse quality scores */
-      for (i = 0; i < input_buffer_count; ++i)
-	{
-	  /* TODO: Remove duplicates here-- use B-tree? */
-	}
-
-      /* if we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-	break;
+      fp_init (&seen, FP_INIT_SIZE, 0);
+      st.keep = rmdup_keep_new;
+      st.arg = &seen;
+      pl.p = p;
+      pl.in1 = input_fastq1;
+      pl.in2 = input_fastq2;
+      pl.out1 = output_fastq1;
+      pl.out2 = output_fastq2;
+      pl.work = rmdup_batch;
+      pl.emit = rmdup_emit;
+      pl.arg = &st;
+      pipeline_run (&pl);
+      fp_free (&seen);
     }
 
   /* close the first fastQ input and output streams */
-  gzclose (input_fastq1);
-  gzclose (output_fastq1);
+  fq_close (input_fastq1);
+  bgzf_close (output_fastq1);
 
   /* if specified-- close the second fastQ input and output streams */
   if (p->flag & TWO_INPUTS)
     {
-      gzclose (input_fastq2);
-      gzclose (output_fastq2);
+      fq_close (input_fastq2);
+      bgzf_close (output_fastq2);
     }
 
+  /* keep the summary out of reads on the standard output */
+  if (strcmp (p->outfile_name1, "-") == 0)
+    report = stderr;
+  fprintf (report, "%s:\t%llu\n", (p->flag & TWO_INPUTS) ? "read pairs" :
+	   "reads", st.nreads);
+  fprintf (report, "duplicates:\t%llu\n", st.ndup);
+  if (p->flag & RMDUP_APPROX)
+    fprintf (report, "expected false duplicates:\t%.1f (rate %.2g)\n",
+	     st.nfalse, (st.nreads > 0) ? st.nfalse / st.nreads : 0.0);
+
   return 0;
 }
@@ -0,0 +1,102 @@
+/* rmdup - Remove duplicate sequences in fastQ files
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef RMDUP_H
+#define RMDUP_H
+
+#include "ngscmd.h"
+#include "bgzf.h"
+#include "fastq.h"
+#include "fptab.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define RMDUP_PARTITIONS 256   /* default number of fingerprint partitions */
+#define RMDUP_MIN_SHARE 0x1000 /* least bytes of -M for each partition */
+#define RMDUP_ORD_BITS 40      /* bits of a read ordinal in a packed value */
+#define RMDUP_ORD_MASK ((1ULL << RMDUP_ORD_BITS) - 1)
+#define RMDUP_MAX_QUAL 0xffffff  /* largest quality sum packed above it */
+#define RMDUP_MAX_MISMATCHES 16
+#define RMDUP_MAX_UMI 32       /* longest UMI */
+#define RMDUP_MAX_UMI_MISMATCHES 3
+#define RMDUP_UMI_PREFIX 50    /* bases of each read keyed with its UMI */
+
+  typedef struct _rmdup_out rmdup_out;
+
+  /* Decide whether the read, or pair, of a fingerprint and ordinal is
+     kept-- called once for each in input order */
+  typedef int (*rmdup_keep_fn) (rmdup_out *, const fingerprint *,
+                                unsigned long long);
+
+  /* The streams the kept records go to, the decision that keeps them
+     and the tallies */
+  struct _rmdup_out
+  {
+    bgzf_writer *out1;
+    bgzf_writer *out2;   /* NULL for a single input stream */
+    rmdup_keep_fn keep;
+    void *arg;           /* state of keep */
+    const char *rec1;    /* serialized records being decided */
+    const char *rec2;
+    size_t len1;
+    size_t len2;
+    unsigned long long nreads;
+    unsigned long long ndup;
+    double nfalse;       /* duplicates expected to be false, under -X */
+  };
+
+
+/* Inline functions */
+
+/* Fingerprint the i-th read of a batch, with its mate if in2 is not
+   NULL */
+  static inline void
+  rmdup_fingerprint (fingerprint *f, const fq_batch *in1,
+                     const fq_batch *in2, size_t i)
+  {
+    fp_start (f);
+    fp_hash (f, in1->rec[i].seq, in1->rec[i].seq_len);
+    if (in2 != NULL)
+      fp_hash (f, in2->rec[i].seq, in2->rec[i].seq_len);
+  }
+
+
+/* Function prototypes */
+  extern void rmdup_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                           fq_buf *, fq_buf *);
+  extern void rmdup_emit (void *, fq_buf *, fq_buf *);
+  extern void rmdup_put (fq_buf *, const fingerprint *, const fq_record *);
+  extern void rmdup_reread (ngs_params *, rmdup_out *);
+  extern void rmdup_spill (ngs_params *, fq_reader *, fq_reader *,
+                           rmdup_out *);
+  extern void rmdup_best (ngs_params *, fq_reader *, fq_reader *,
+                          rmdup_out *);
+  extern void rmdup_near (ngs_params *, fq_reader *, fq_reader *,
+                          rmdup_out *);
+  extern void rmdup_umi (ngs_params *, fq_reader *, fq_reader *,
+                         rmdup_out *);
+  extern void rmdup_approx (ngs_params *, fq_reader *, fq_reader *,
+                            rmdup_out *, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* RMDUP_H */
@@ -0,0 +1,92 @@
+#!/bin/sh
+# Remove duplicate pairs in memory, through spilled partitions and on
+# several threads, which have to agree byte for byte and keep the first
+# copy of each pair-- then keep the copy of best quality of single reads
+# and compare with a brute-force search for it
+
+set -e
+tmp=rmdup.tmp
+rm -rf $tmp
+mkdir $tmp
+awk -v out1=$tmp/reads.1.fq -v out2=$tmp/reads.2.fq 'BEGIN {
+  srand (3);
+  for (t = 0; t < 24000; ++t)
+    {
+      s1 = s2 = "";
+      for (j = 0; j < 50; ++j)
+        {
+          s1 = s1 substr ("ACGT", int (rand () * 4) + 1, 1);
+          s2 = s2 substr ("ACGT", int (rand () * 4) + 1, 1);
+        }
+      tmpl1[t] = s1;
+      tmpl2[t] = s2;
+    }
+  for (i = 0; i < 60000; ++i)
+    {
+      t = int (rand () * 24000);
+
+      # Some copies share only the first read, and are not duplicates
+      s2 = tmpl2[t];
+      if (rand () < 0.1)
+        s2 = tmpl2[int (rand () * 24000)];
+      q1 = q2 = "";
+      for (j = 0; j < 50; ++j)
+        {
+          q1 = q1 substr ("#+5?DIJ", int (rand () * 7) + 1, 1);
+          q2 = q2 substr ("#+5?DIJ", int (rand () * 7) + 1, 1);
+        }
+      printf ("@r%d/1\n%s\n+\n%s\n", i, tmpl1[t], q1) > out1;
+      printf ("@r%d/2\n%s\n+\n%s\n", i, s2, q2) > out2;
+    }
+}'
+
+# The first copy of each pair
+awk -v in2=$tmp/reads.2.fq -v out1=$tmp/ref.1.fq -v out2=$tmp/ref.2.fq '{
+  id1 = $0; getline seq1; getline; getline qual1;
+  getline id2 < in2; getline seq2 < in2; getline < in2; getline qual2 < in2;
+  if (!seen[seq1 " " seq2]++)
+    {
+      printf ("%s\n%s\n+\n%s\n", id1, seq1, qual1) > out1;
+      printf ("%s\n%s\n+\n%s\n", id2, seq2, qual2) > out2;
+    }
+}' $tmp/reads.1.fq
+
+./ngscmd rmdup -o plain -p $tmp/mem $tmp/reads.1.fq $tmp/reads.2.fq > /dev/null
+cmp $tmp/mem.1.fq $tmp/ref.1.fq
+cmp $tmp/mem.2.fq $tmp/ref.2.fq
+for opts in "-M 1 -P 4" "-t 4" "-M 1 -P 4 -t 4"; do
+  ./ngscmd rmdup $opts -o plain -p $tmp/run $tmp/reads.1.fq $tmp/reads.2.fq \
+    > /dev/null
+  cmp $tmp/run.1.fq $tmp/mem.1.fq
+  cmp $tmp/run.2.fq $tmp/mem.2.fq
+done
+
+# The copy of each read with the highest sum of Phred scores, the first
+# of those tied, in input order
+awk 'BEGIN {
+  for (c = 33; c < 127; ++c)
+    phred[sprintf ("%c", c)] = c - 33;
+}
+NR % 4 == 2 { seq[n] = $0 }
+NR % 4 == 0 {
+  q = 0;
+  for (j = 1; j <= length ($0); ++j)
+    q += phred[substr ($0, j, 1)];
+  if (!(seq[n] in best) || (q > sum[seq[n]]))
+    {
+      best[seq[n]] = n;
+      sum[seq[n]] = q;
+    }
+  ++n;
+}
+END {
+  while ((getline id < ARGV[1]) > 0)
+    {
+      getline s < ARGV[1]; getline < ARGV[1]; getline qual < ARGV[1];
+      if (best[s] == i++)
+        printf ("%s\n%s\n+\n%s\n", id, s, qual);
+    }
+}' $tmp/reads.1.fq > $tmp/best.fq
+./ngscmd rmdup -B -o plain -p $tmp/best $tmp/reads.1.fq > /dev/null
+cmp $tmp/best.1.fq $tmp/best.fq
+rm -rf $tmp
@@ -0,0 +1,85 @@
+/* rmdupapprox - Single-pass duplicate removal in a fixed memory budget
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "rmdup.h"
+#include "pipeline.h"
+#include "sketch.h"
+
+/* Fingerprints are kept as 16-bit tags in a cuckoo filter sized once
+   from the memory budget, about 2 bytes for each distinct read, so the
+   input is read once and may be a stream.  A read new to the filter is
+   taken for a duplicate when its tag is already in one of its two
+   buckets-- the expected number of such false duplicates is summed as
+   reads are added, from the load of the filter at the time */
+
+/* The filter and the false duplicates expected so far */
+typedef struct _rmdup_approx_state
+{
+  cuckoo_filter seen;
+  double nfalse;
+} rmdup_approx_state;
+
+static int rmdup_keep_approx (rmdup_out *, const fingerprint *,
+                              unsigned long long);
+
+/* Remove duplicates in one pass, keeping the first of each read, or
+   pair, in mem bytes */
+
+void
+rmdup_approx (ngs_params *p, fq_reader *in1, fq_reader *in2, rmdup_out *o,
+              size_t mem)
+{
+  ngs_pipeline pl;
+  rmdup_approx_state st;
+
+  memset (&st, 0, sizeof (rmdup_approx_state));
+  cf_init (&st.seen, mem);
+
+  o->keep = rmdup_keep_approx;
+  o->arg = &st;
+  pl.p = p;
+  pl.in1 = in1;
+  pl.in2 = in2;
+  pl.out1 = o->out1;
+  pl.out2 = o->out2;
+  pl.work = rmdup_batch;
+  pl.emit = rmdup_emit;
+  pl.arg = o;
+  pipeline_run (&pl);
+
+  o->nfalse = st.nfalse;
+  if (st.seen.dropped > 0)
+    fprintf (stderr, "Warning: the filter filled and %llu fingerprints "
+             "were dropped-- some duplicates were kept.  Raise -M for "
+             "this input.\n", st.seen.dropped);
+  cf_free (&st.seen);
+}
+
+/* Keep a read, or pair, whose fingerprint the filter has not seen */
+
+static int
+rmdup_keep_approx (rmdup_out *o, const fingerprint *f, unsigned long long ord)
+{
+  rmdup_approx_state *st = (rmdup_approx_state *) o->arg;
+  double rate = cf_false_rate (&st->seen);
+
+  (void) ord;
+  if (cf_add (&st->seen, f->lo))
+    return 0;
+  st->nfalse += rate;
+
+  return 1;
+}
@@ -0,0 +1,153 @@
+/* rmdupbest - Duplicate removal keeping the copy of best quality
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "rmdup.h"
+#include "pipeline.h"
+
+/* The first pass keeps, for each fingerprint, the sum of Phred scores
+   of its best copy and that copy's ordinal, packed in one 64-bit value--
+   the sum in the top bits and the ordinal in the low RMDUP_ORD_BITS.
+   The second pass reads the input again and keeps each record whose
+   ordinal is the one kept for its fingerprint.  Of copies with the same
+   sum, the first is kept */
+
+/* The table of best copies and the ordinal of the next read */
+typedef struct _rmdup_best_state
+{
+  fp_table best;
+  unsigned long long nreads;
+} rmdup_best_state;
+
+static void rmdup_qual_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                              fq_buf *, fq_buf *);
+static unsigned int rmdup_qual_sum (const fq_record *);
+static void rmdup_rank (void *, fq_buf *, fq_buf *);
+static int rmdup_keep_best (rmdup_out *, const fingerprint *,
+                            unsigned long long);
+
+/* Remove duplicates in two passes, keeping the copy of each read, or
+   pair, with the highest sum of quality scores */
+
+void
+rmdup_best (ngs_params *p, fq_reader *in1, fq_reader *in2, rmdup_out *o)
+{
+  ngs_pipeline pl;
+  rmdup_best_state st;
+
+  /* Pass one-- fingerprint and score reads on the worker threads and
+     rank them in input order on the calling thread */
+  memset (&st, 0, sizeof (rmdup_best_state));
+  fp_init (&st.best, FP_INIT_SIZE, 1);
+  pl.p = p;
+  pl.in1 = in1;
+  pl.in2 = in2;
+  pl.out1 = NULL;
+  pl.out2 = NULL;
+  pl.work = rmdup_qual_batch;
+  pl.emit = rmdup_rank;
+  pl.arg = &st;
+  pipeline_run (&pl);
+
+  /* Pass two-- read the input again and keep the best copies */
+  o->keep = rmdup_keep_best;
+  o->arg = &st.best;
+  rmdup_reread (p, o);
+
+  fp_free (&st.best);
+}
+
+/* Write the fingerprint and quality sum of each read, or pair, of a
+   batch to out1 */
+
+static void
+rmdup_qual_batch (ngs_params *p, void *arg, fq_batch *in1, fq_batch *in2,
+                  fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  unsigned int q = 0;
+  fingerprint f;
+
+  (void) p;
+  (void) arg;
+  (void) out2;
+  for (i = 0; i < in1->n; ++i)
+    {
+      rmdup_fingerprint (&f, in1, in2, i);
+      q = rmdup_qual_sum (&in1->rec[i]);
+      if (in2 != NULL)
+        q += rmdup_qual_sum (&in2->rec[i]);
+      fq_buf_put (out1, (const char *) &f, sizeof (fingerprint));
+      fq_buf_put (out1, (const char *) &q, sizeof (q));
+    }
+}
+
+/* Return the sum of the Phred+33 scores of a read */
+
+static unsigned int
+rmdup_qual_sum (const fq_record *r)
+{
+  size_t i = 0;
+  unsigned int q = 0;
+
+  for (i = 0; i < r->qual_len; ++i)
+    q += (unsigned char) r->qual[i] - 33;
+
+  return q;
+}
+
+/* Number the reads of a batch and keep each that beats the best copy
+   of its fingerprint so far-- called on one thread in input order */
+
+static void
+rmdup_rank (void *arg, fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  unsigned int q = 0;
+  unsigned long long *v = NULL;
+  fingerprint f;
+  rmdup_best_state *st = (rmdup_best_state *) arg;
+
+  (void) out2;
+  for (i = 0; i < out1->l; i += sizeof (fingerprint) + sizeof (q))
+    {
+      memcpy (&f, out1->s + i, sizeof (fingerprint));
+      memcpy (&q, out1->s + i + sizeof (fingerprint), sizeof (q));
+      if (q > RMDUP_MAX_QUAL)
+        q = RMDUP_MAX_QUAL;
+      if (st->nreads > RMDUP_ORD_MASK)
+        {
+          fputs ("\n\nError: too many reads to rank by quality.\n\n",
+                 stderr);
+          abort ();
+        }
+      if ((v = fp_get (&st->best, &f)) == NULL)
+        fp_set (&st->best, &f, ((unsigned long long) q << RMDUP_ORD_BITS)
+                | st->nreads);
+      else if (q > (*v >> RMDUP_ORD_BITS))
+        *v = ((unsigned long long) q << RMDUP_ORD_BITS) | st->nreads;
+      ++st->nreads;
+    }
+}
+
+/* Keep a read, or pair, if it is the best copy of its fingerprint */
+
+static int
+rmdup_keep_best (rmdup_out *o, const fingerprint *f, unsigned long long ord)
+{
+  unsigned long long *v = fp_get ((const fp_table *) o->arg, f);
+
+  return (v != NULL) && ((*v & RMDUP_ORD_MASK) == ord);
+}
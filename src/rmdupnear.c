@@ -0,0 +1,242 @@
+/* rmdupnear - Removal of reads within a few mismatches of a kept read
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <stdint.h>
+
+#include "rmdup.h"
+#include "arena.h"
+#include "pipeline.h"
+
+/* A read, or pair, within N mismatches of another of the same lengths
+   matches it exactly over at least two of N + 2 segments-- so each
+   kept read is entered in a bucket for each pair of its segments,
+   keyed by the segment numbers, the read lengths and the bases of both
+   segments, and a new read is only compared base by base with the kept
+   reads in its own buckets.  Keying on one segment of N + 1 would do
+   as well, but a primer or adapter shared by every read fills one
+   segment and would put all reads in one bucket; a pair of segments
+   holds bases the reads do not all share.  Every kept read of a bucket
+   is compared, so a cap never drops a near duplicate.  For a pair of
+   reads the segments cut the two as one, and mismatches count over
+   both.  Comparisons stop at N + 1 mismatches.  A kept read takes
+   (N + 2) (N + 1) / 2 buckets-- 10 for N = 3 */
+
+/* A kept read, or pair, followed by its bases */
+typedef struct _rmdup_kept
+{
+  size_t len1;
+  size_t len2;
+} rmdup_kept;
+
+/* An entry in the list of kept reads of a bucket */
+typedef struct _rmdup_link
+{
+  const rmdup_kept *read;
+  struct _rmdup_link *next;
+} rmdup_link;
+
+/* The kept reads and their buckets */
+typedef struct _rmdup_near_state
+{
+  int mismatches;
+  int nseg;
+  int nkeys;                   /* pairs of segments */
+  fp_table exact;              /* fingerprints of every read seen */
+  fp_table buckets;            /* segment keys and the head of their list */
+  ngs_arena reads;
+} rmdup_near_state;
+
+static int rmdup_keep_near (rmdup_out *, const fingerprint *,
+                            unsigned long long);
+static const char *rmdup_rec_seq (const char *, size_t, size_t *);
+static void rmdup_pair_key (fingerprint *, int, int, int, const char *,
+                            size_t, const char *, size_t);
+static void rmdup_segment (fingerprint *, int, int, const char *, size_t,
+                           const char *, size_t);
+static int rmdup_within (const rmdup_kept *, const char *, size_t,
+                         const char *, size_t, int);
+
+/* Remove exact and near duplicates in one pass, keeping the first read
+   of each group */
+
+void
+rmdup_near (ngs_params *p, fq_reader *in1, fq_reader *in2, rmdup_out *o)
+{
+  ngs_pipeline pl;
+  rmdup_near_state st;
+
+  memset (&st, 0, sizeof (rmdup_near_state));
+  st.mismatches = p->mismatches;
+  st.nseg = p->mismatches + 2;
+  st.nkeys = st.nseg * (st.nseg - 1) / 2;
+  fp_init (&st.exact, FP_INIT_SIZE, 0);
+  fp_init (&st.buckets, FP_INIT_SIZE, 1);
+  arena_init (&st.reads, ARENA_CHUNK_SIZE);
+
+  o->keep = rmdup_keep_near;
+  o->arg = &st;
+  pl.p = p;
+  pl.in1 = in1;
+  pl.in2 = in2;
+  pl.out1 = o->out1;
+  pl.out2 = o->out2;
+  pl.work = rmdup_batch;
+  pl.emit = rmdup_emit;
+  pl.arg = o;
+  pipeline_run (&pl);
+
+  fp_free (&st.exact);
+  fp_free (&st.buckets);
+  arena_free (&st.reads);
+}
+
+/* Keep a read, or pair, unless it is a copy of a read seen before or
+   within the allowed mismatches of a kept one */
+
+static int
+rmdup_keep_near (rmdup_out *o, const fingerprint *f, unsigned long long ord)
+{
+  int a = 0;
+  int b = 0;
+  int j = 0;
+  size_t len1 = 0;
+  size_t len2 = 0;
+  const char *seq1 = NULL;
+  const char *seq2 = NULL;
+  char *s = NULL;
+  unsigned long long *v = NULL;
+  fingerprint keys[(RMDUP_MAX_MISMATCHES + 2) * (RMDUP_MAX_MISMATCHES + 1)
+                   / 2];
+  rmdup_kept *k = NULL;
+  rmdup_link *l = NULL;
+  rmdup_near_state *st = (rmdup_near_state *) o->arg;
+
+  (void) ord;
+  if (!fp_add (&st->exact, f))
+    return 0;
+
+  seq1 = rmdup_rec_seq (o->rec1, o->len1, &len1);
+  if (o->rec2 != NULL)
+    seq2 = rmdup_rec_seq (o->rec2, o->len2, &len2);
+
+  /* Compare with the kept reads that share a pair of segments */
+  for (a = 0, j = 0; a < st->nseg; ++a)
+    for (b = a + 1; b < st->nseg; ++b)
+      rmdup_pair_key (&keys[j++], a, b, st->nseg, seq1, len1, seq2, len2);
+  for (j = 0; j < st->nkeys; ++j)
+    {
+      if ((v = fp_get (&st->buckets, &keys[j])) == NULL)
+        continue;
+      for (l = (rmdup_link *) (uintptr_t) *v; l != NULL; l = l->next)
+        if (rmdup_within (l->read, seq1, len1, seq2, len2, st->mismatches))
+          return 0;
+    }
+
+  /* Keep the read and enter it in the bucket of each pair of segments */
+  k = (rmdup_kept *) arena_alloc (&st->reads, sizeof (rmdup_kept) + len1
+                                  + len2);
+  k->len1 = len1;
+  k->len2 = len2;
+  s = (char *) (k + 1);
+  memcpy (s, seq1, len1);
+  if (len2 > 0)
+    memcpy (s + len1, seq2, len2);
+  for (j = 0; j < st->nkeys; ++j)
+    {
+      l = (rmdup_link *) arena_alloc (&st->reads, sizeof (rmdup_link));
+      l->read = k;
+      v = fp_get (&st->buckets, &keys[j]);
+      l->next = (v != NULL) ? (rmdup_link *) (uintptr_t) *v : NULL;
+      fp_set (&st->buckets, &keys[j], (unsigned long long) (uintptr_t) l);
+    }
+
+  return 1;
+}
+
+/* Return the sequence line of a serialized record of n bytes and its
+   length */
+
+static const char *
+rmdup_rec_seq (const char *rec, size_t n, size_t *len)
+{
+  const char *seq = (const char *) memchr (rec, '\n', n) + 1;
+
+  *len = (size_t) ((const char *) memchr (seq, '\n', n - (seq - rec)) - seq);
+
+  return seq;
+}
+
+/* Key segments a and b of nseg of a read, or of a pair cut as one
+   read, by the segment numbers, the read lengths and the bases of both
+   segments */
+
+static void
+rmdup_pair_key (fingerprint *f, int a, int b, int nseg, const char *seq1,
+                size_t len1, const char *seq2, size_t len2)
+{
+  unsigned long long head[4];
+
+  head[0] = (unsigned long long) a;
+  head[1] = (unsigned long long) b;
+  head[2] = (unsigned long long) len1;
+  head[3] = (unsigned long long) len2;
+  fp_start (f);
+  fp_hash (f, (const char *) head, sizeof (head));
+  rmdup_segment (f, a, nseg, seq1, len1, seq2, len2);
+  rmdup_segment (f, b, nseg, seq1, len1, seq2, len2);
+}
+
+/* Hash the bases of segment j of nseg of a read, or of a pair cut as
+   one read, into a fingerprint */
+
+static void
+rmdup_segment (fingerprint *f, int j, int nseg, const char *seq1,
+               size_t len1, const char *seq2, size_t len2)
+{
+  size_t len = len1 + len2;
+  size_t from = len * j / nseg;
+  size_t to = len * (j + 1) / nseg;
+
+  if (from < len1)
+    fp_hash (f, seq1 + from, ((to < len1) ? to : len1) - from);
+  if (to > len1)
+    fp_hash (f, seq2 + ((from > len1) ? from - len1 : 0),
+             to - ((from > len1) ? from : len1));
+}
+
+/* Return 1 if a read, or pair, of the same lengths as a kept one has
+   no more than max mismatches with it, counting no further than that */
+
+static int
+rmdup_within (const rmdup_kept *k, const char *seq1, size_t len1,
+              const char *seq2, size_t len2, int max)
+{
+  size_t i = 0;
+  int mm = 0;
+  const char *s = (const char *) (k + 1);
+
+  if ((k->len1 != len1) || (k->len2 != len2))
+    return 0;
+  for (i = 0; i < len1; ++i)
+    if ((s[i] != seq1[i]) && (++mm > max))
+      return 0;
+  s += len1;
+  for (i = 0; i < len2; ++i)
+    if ((s[i] != seq2[i]) && (++mm > max))
+      return 0;
+
+  return 1;
+}
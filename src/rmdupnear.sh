@@ -0,0 +1,56 @@
+#!/bin/sh
+# Remove near duplicates from reads that all start with one primer, as
+# amplicon reads do, and compare with a brute-force search that keeps a
+# read unless it is within two mismatches of a kept one
+
+set -e
+tmp=rmdupnear.tmp
+rm -rf $tmp
+mkdir $tmp
+awk 'BEGIN {
+  srand (2);
+  primer = "ACGTTGCAAGGCTTACGATCGGATCCATGATGCACCTGAG";
+  for (t = 0; t < 500; ++t)
+    {
+      s = "";
+      for (j = 0; j < 60; ++j)
+        s = s substr ("ACGT", int (rand () * 4) + 1, 1);
+      tmpl[t] = s;
+    }
+  for (j = 0; j < 100; ++j)
+    qual = qual "I";
+  for (i = 0; i < 1200; ++i)
+    {
+      s = tmpl[int (rand () * 500)];
+      for (e = int (rand () * 4); e > 0; --e)
+        {
+          j = int (rand () * 60);
+          s = substr (s, 1, j) substr ("ACGT", int (rand () * 4) + 1, 1) \
+            substr (s, j + 2);
+        }
+      printf ("@r%d\n%s%s\n+\n%s\n", i, primer, s, qual);
+    }
+}' > $tmp/reads.fq
+awk 'NR % 4 == 1 { id = $0 }
+NR % 4 == 2 { seq = $0 }
+NR % 4 == 0 {
+  keep = 1;
+  for (k = 0; (k < n) && keep; ++k)
+    {
+      if (length (kept[k]) != length (seq))
+        continue;
+      mm = 0;
+      for (j = 1; (j <= length (seq)) && (mm <= 2); ++j)
+        mm += (substr (kept[k], j, 1) != substr (seq, j, 1));
+      if (mm <= 2)
+        keep = 0;
+    }
+  if (keep)
+    {
+      kept[n++] = seq;
+      printf ("%s\n%s\n+\n%s\n", id, seq, $0);
+    }
+}' $tmp/reads.fq > $tmp/ref.fq
+./ngscmd rmdup -x 2 -o plain -p $tmp/near $tmp/reads.fq > /dev/null
+cmp $tmp/near.1.fq $tmp/ref.fq
+rm -rf $tmp
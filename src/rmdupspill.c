@@ -0,0 +1,369 @@
+/* rmdupspill - Duplicate removal through fingerprint partitions spilled
+   to temporary files
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rmdup.h"
+#include "pipeline.h"
+#include "spill.h"
+
+/* The fingerprint of every read, or pair, is binned with its ordinal
+   by the high word of the fingerprint, so all copies of a read fall in
+   the same partition.  Each partition is then screened on its own--
+   its tuples are in input order, so the first copy is the one met
+   first, and the later copies are marked in a bitmap of ordinals kept
+   in a mapped temporary file.  A last pass reads the input again and
+   drops each record whose ordinal is marked.
+
+   The memory cap is split evenly between the bins, each of which spills
+   to its file when its share is full, and holds the fingerprint tables
+   of the partitions being screened as well-- fewer threads screen when
+   the largest table would not fit once for each */
+
+/* A fingerprint and the ordinal of its read in the input */
+typedef struct _rmdup_tuple
+{
+  fingerprint f;
+  unsigned long long ord;
+} rmdup_tuple;
+
+/* The partitions of every fingerprint */
+typedef struct _rmdup_bins
+{
+  int nparts;
+  fq_buf *mem;                 /* tuples held in memory */
+  FILE **file;                 /* spilled tuples, NULL if none */
+  unsigned long long *spilled; /* tuples written to each file */
+  size_t share;                /* bytes of tuples a bin holds */
+  size_t mem_limit;
+  unsigned long long nreads;   /* ordinal of the next read */
+  FILE *dups;                  /* bitmap of the duplicate ordinals */
+  unsigned char *bits;         /* the bitmap, mapped */
+  size_t bits_len;
+  int next_part;               /* next partition to screen */
+  pthread_mutex_t lock;
+} rmdup_bins;
+
+static void rmdup_fp_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                            fq_buf *, fq_buf *);
+static void rmdup_bin (void *, fq_buf *, fq_buf *);
+static void rmdup_spill_bin (rmdup_bins *, int);
+static size_t rmdup_table_size (const rmdup_bins *, int);
+static void *rmdup_screen_parts (void *);
+static void rmdup_screen (rmdup_bins *, int, fp_table *);
+static void rmdup_mark (rmdup_bins *, unsigned long long);
+static int rmdup_keep_first (rmdup_out *, const fingerprint *,
+                             unsigned long long);
+
+/* Remove duplicates in three passes that hold no more than the memory
+   cap-- binning, screening the partitions in parallel, and writing
+   the kept records as the input is read again */
+
+void
+rmdup_spill (ngs_params *p, fq_reader *in1, fq_reader *in2, rmdup_out *o)
+{
+  int i = 0;
+  int nthreads = p->threads;
+  size_t table = 0;
+  size_t largest = 0;
+  size_t held = 0;
+  rmdup_bins bins;
+  ngs_pipeline pl;
+  pthread_t *threads = NULL;
+
+  memset (&bins, 0, sizeof (rmdup_bins));
+  bins.nparts = (p->kmer_parts > 0) ? p->kmer_parts : RMDUP_PARTITIONS;
+  bins.mem_limit = (size_t) p->mem_limit << 20;
+  bins.share = bins.mem_limit / bins.nparts / sizeof (rmdup_tuple)
+    * sizeof (rmdup_tuple);
+  if (bins.mem_limit / bins.nparts < RMDUP_MIN_SHARE)
+    {
+      fprintf (stderr, "\n\nError: -M gives each of the %d partitions less "
+               "than %d bytes-- raise -M or lower -P.\n\n", bins.nparts,
+               RMDUP_MIN_SHARE);
+      abort ();
+    }
+  bins.mem = (fq_buf *) calloc (bins.nparts, sizeof (fq_buf));
+  bins.file = (FILE **) calloc (bins.nparts, sizeof (FILE *));
+  bins.spilled = (unsigned long long *) calloc (bins.nparts,
+                                                sizeof (unsigned long long));
+  if ((bins.mem == NULL) || (bins.file == NULL) || (bins.spilled == NULL))
+    {
+      fputs ("\n\nError: memory allocation failure for duplicate "
+             "partitions.\n\n", stderr);
+      abort ();
+    }
+
+  /* Pass one-- fingerprint reads on the worker threads and bin them in
+     input order on the calling thread */
+  pl.p = p;
+  pl.in1 = in1;
+  pl.in2 = in2;
+  pl.out1 = NULL;
+  pl.out2 = NULL;
+  pl.work = rmdup_fp_batch;
+  pl.emit = rmdup_bin;
+  pl.arg = &bins;
+  pipeline_run (&pl);
+
+  /* The bitmap of duplicates, one bit for each read */
+  bins.dups = spill_open ();
+  bins.bits_len = (size_t) (bins.nreads / 8) + 1;
+  if ((ftruncate (fileno (bins.dups), (off_t) bins.bits_len) != 0) ||
+      ((bins.bits = (unsigned char *) mmap (NULL, bins.bits_len,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_SHARED, fileno (bins.dups),
+                                            0)) == MAP_FAILED))
+    {
+      fputs ("\n\nError: cannot map a temporary file.\n\n", stderr);
+      abort ();
+    }
+
+  /* Make room for the screening tables-- spill the bins still held if
+     they and one table for each thread would go over the cap, and use
+     fewer threads if the tables alone would */
+  for (i = 0; i < bins.nparts; ++i)
+    {
+      if ((table = rmdup_table_size (&bins, i)) > largest)
+        largest = table;
+      held += bins.mem[i].m;
+    }
+  if (largest > bins.mem_limit)
+    {
+      fprintf (stderr, "Warning: screening a partition takes %lu MB, more "
+               "than -M-- raise -P.\n", (unsigned long) (largest >> 20) + 1);
+      nthreads = 1;
+    }
+  else if ((size_t) nthreads * largest > bins.mem_limit)
+    nthreads = (int) (bins.mem_limit / largest);
+  if (held + (size_t) nthreads * largest > bins.mem_limit)
+    for (i = 0; i < bins.nparts; ++i)
+      {
+        rmdup_spill_bin (&bins, i);
+        fq_buf_free (&bins.mem[i]);
+      }
+
+  /* Pass two-- screen the partitions independently */
+  pthread_mutex_init (&bins.lock, NULL);
+  if (nthreads < 2)
+    rmdup_screen_parts (&bins);
+  else
+    {
+      if ((threads = (pthread_t *) malloc (nthreads * sizeof (pthread_t)))
+          == NULL)
+        {
+          fputs ("\n\nError: memory allocation failure for duplicate "
+                 "partitions.\n\n", stderr);
+          abort ();
+        }
+      for (i = 0; i < nthreads; ++i)
+        {
+          if (pthread_create (&threads[i], NULL, rmdup_screen_parts, &bins)
+              != 0)
+            {
+              fputs ("\n\nError: cannot create a duplicate screening "
+                     "thread.\n\n", stderr);
+              abort ();
+            }
+        }
+      for (i = 0; i < nthreads; ++i)
+        pthread_join (threads[i], NULL);
+      free (threads);
+    }
+  pthread_mutex_destroy (&bins.lock);
+
+  /* Pass three-- read the input again and drop the duplicates */
+  o->keep = rmdup_keep_first;
+  o->arg = &bins;
+  rmdup_reread (p, o);
+
+  munmap (bins.bits, bins.bits_len);
+  fclose (bins.dups);
+  free (bins.mem);
+  free (bins.file);
+  free (bins.spilled);
+}
+
+/* Fingerprint a batch of reads, or pairs, into out1 */
+
+static void
+rmdup_fp_batch (ngs_params *p, void *arg, fq_batch *in1, fq_batch *in2,
+                fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  fingerprint *f = NULL;
+
+  (void) p;
+  (void) arg;
+  (void) out2;
+  f = (fingerprint *) fq_buf_reserve (out1, in1->n * sizeof (fingerprint));
+  for (i = 0; i < in1->n; ++i)
+    rmdup_fingerprint (&f[i], in1, in2, i);
+}
+
+/* Number the fingerprints of a batch and move them into their partition
+   bins-- called on one thread in input order */
+
+static void
+rmdup_bin (void *arg, fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  int part = 0;
+  rmdup_tuple t;
+  fq_buf *bin = NULL;
+  rmdup_bins *bins = (rmdup_bins *) arg;
+
+  (void) out2;
+  for (i = 0; i < out1->l; i += sizeof (fingerprint))
+    {
+      memcpy (&t.f, out1->s + i, sizeof (fingerprint));
+      t.ord = bins->nreads++;
+      part = (int) (t.f.hi % (unsigned long long) bins->nparts);
+      bin = &bins->mem[part];
+
+      /* A bin takes its whole share at once and spills when full */
+      if (bin->m == 0)
+        {
+          if ((bin->s = (char *) malloc (bins->share)) == NULL)
+            {
+              fputs ("\n\nError: memory allocation failure for duplicate "
+                     "partitions.\n\n", stderr);
+              abort ();
+            }
+          bin->m = bins->share;
+        }
+      else if (bin->l == bin->m)
+        rmdup_spill_bin (bins, part);
+      memcpy (bin->s + bin->l, &t, sizeof (rmdup_tuple));
+      bin->l += sizeof (rmdup_tuple);
+    }
+}
+
+/* Append the tuples of a bin held in memory to its temporary file */
+
+static void
+rmdup_spill_bin (rmdup_bins *bins, int part)
+{
+  fq_buf *bin = &bins->mem[part];
+
+  if (bin->l == 0)
+    return;
+  if (bins->file[part] == NULL)
+    bins->file[part] = spill_open ();
+  spill_write (bins->file[part], bin->s, bin->l);
+  bins->spilled[part] += bin->l / sizeof (rmdup_tuple);
+  bin->l = 0;
+}
+
+/* Return the bytes of the fingerprint table that screens a partition */
+
+static size_t
+rmdup_table_size (const rmdup_bins *bins, int part)
+{
+  size_t n = 0x400;
+  size_t want = (size_t) (bins->spilled[part] + bins->mem[part].l
+                          / sizeof (rmdup_tuple)) / 7 * 10;
+
+  while (n < want)
+    n <<= 1;
+
+  return n * sizeof (fingerprint);
+}
+
+/* Take partitions from the shared counter until none are left */
+
+static void *
+rmdup_screen_parts (void *arg)
+{
+  int i = 0;
+  fp_table t;
+  rmdup_bins *bins = (rmdup_bins *) arg;
+
+  while (1)
+    {
+      pthread_mutex_lock (&bins->lock);
+      i = bins->next_part++;
+      pthread_mutex_unlock (&bins->lock);
+      if (i >= bins->nparts)
+        break;
+      fp_init (&t, (size_t) (bins->spilled[i] + bins->mem[i].l
+                             / sizeof (rmdup_tuple)) / 7 * 10, 0);
+      rmdup_screen (bins, i, &t);
+      fp_free (&t);
+    }
+
+  return NULL;
+}
+
+/* Mark the ordinal of a duplicate in the bitmap-- partitions screened
+   on other threads may share its byte */
+
+static void
+rmdup_mark (rmdup_bins *bins, unsigned long long ord)
+{
+  __atomic_fetch_or (&bins->bits[ord >> 3], (unsigned char) (1 << (ord & 7)),
+                     __ATOMIC_RELAXED);
+}
+
+/* Screen the spilled and then the in-memory tuples of a partition,
+   marking the ordinals of fingerprints already seen */
+
+static void
+rmdup_screen (rmdup_bins *bins, int part, fp_table *t)
+{
+  size_t i = 0;
+  size_t n = 0;
+  unsigned long long left = 0;
+  rmdup_tuple buf[0x1000];
+  FILE *fp = NULL;
+  fq_buf *mem = &bins->mem[part];
+
+  if ((fp = bins->file[part]) != NULL)
+    rewind (fp);
+  for (left = bins->spilled[part]; left > 0; left -= n)
+    {
+      n = (left < 0x1000) ? (size_t) left : 0x1000;
+      spill_read (fp, buf, n * sizeof (rmdup_tuple));
+      for (i = 0; i < n; ++i)
+        if (!fp_add (t, &buf[i].f))
+          rmdup_mark (bins, buf[i].ord);
+    }
+  if (fp != NULL)
+    fclose (fp);
+  bins->file[part] = NULL;
+
+  for (i = 0; i < mem->l; i += sizeof (rmdup_tuple))
+    {
+      memcpy (&buf[0], mem->s + i, sizeof (rmdup_tuple));
+      if (!fp_add (t, &buf[0].f))
+        rmdup_mark (bins, buf[0].ord);
+    }
+  fq_buf_free (mem);
+}
+
+/* Keep a read, or pair, unless its ordinal is marked as a duplicate */
+
+static int
+rmdup_keep_first (rmdup_out *o, const fingerprint *f, unsigned long long ord)
+{
+  rmdup_bins *bins = (rmdup_bins *) o->arg;
+
+  (void) f;
+
+  return !(bins->bits[ord >> 3] & (1 << (ord & 7)));
+}
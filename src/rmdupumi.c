@@ -0,0 +1,287 @@
+/* rmdupumi - UMI extraction and UMI-aware duplicate removal
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <stdint.h>
+
+#include "rmdup.h"
+#include "arena.h"
+#include "pipeline.h"
+
+/* A UMI is taken from the read ID as the last colon-separated field of
+   its first word, as Illumina writes it, or cut from the first bases of
+   the first read and moved there-- so the output carries it either way.
+   Reads are grouped by the fingerprint of the first RMDUP_UMI_PREFIX
+   bases of each read, which stays the same when reads are trimmed to
+   different lengths.  A read whose UMI is within the allowed mismatches
+   of one seen in its group is a duplicate.  As rmdupnear does for reads,
+   each UMI is cut into one segment more than the allowed mismatches,
+   and entered in a bucket keyed by the group, the segment number, the
+   UMI length and the segment bases-- a UMI within the mismatches shares
+   at least one segment, so only the UMIs of its own buckets are
+   compared, and a large group costs no more than a small one.  Without
+   mismatches a bucket holds one UMI.  Every UMI of every group is held
+   to the end, so memory grows with the distinct UMIs and prefixes, and
+   -M does not apply.  A read with no UMI in its ID is kept as it is and
+   counted */
+
+/* A UMI seen in a group, followed by its bases */
+typedef struct _rmdup_umi_seen
+{
+  size_t len;
+} rmdup_umi_seen;
+
+/* An entry in the list of UMIs of a bucket */
+typedef struct _rmdup_umi_link
+{
+  const rmdup_umi_seen *umi;
+  struct _rmdup_umi_link *next;
+} rmdup_umi_link;
+
+/* The UMIs seen and their buckets */
+typedef struct _rmdup_umi_state
+{
+  int mismatches;
+  int nseg;
+  unsigned long long missing;  /* reads with no UMI in the ID */
+  fp_table buckets;            /* segment keys and the head of their list */
+  ngs_arena umis;
+} rmdup_umi_state;
+
+static void rmdup_umi_batch (ngs_params *, void *, fq_batch *, fq_batch *,
+                             fq_buf *, fq_buf *);
+static void rmdup_umi_move (fq_buf *, const fingerprint *, const fq_record *,
+                            const char *, size_t, fq_buf *);
+static int rmdup_keep_umi (rmdup_out *, const fingerprint *,
+                           unsigned long long);
+static const char *rmdup_umi_parse (const char *, size_t, size_t *);
+static void rmdup_umi_segment (fingerprint *, const fingerprint *, int, int,
+                               const char *, size_t);
+
+/* Remove reads, or pairs, of the same UMI and prefix, keeping the first
+   of each */
+
+void
+rmdup_umi (ngs_params *p, fq_reader *in1, fq_reader *in2, rmdup_out *o)
+{
+  ngs_pipeline pl;
+  rmdup_umi_state st;
+
+  memset (&st, 0, sizeof (rmdup_umi_state));
+  st.mismatches = p->umi_mismatches;
+  st.nseg = p->umi_mismatches + 1;
+  fp_init (&st.buckets, FP_INIT_SIZE, 1);
+  arena_init (&st.umis, ARENA_CHUNK_SIZE);
+
+  o->keep = rmdup_keep_umi;
+  o->arg = &st;
+  pl.p = p;
+  pl.in1 = in1;
+  pl.in2 = in2;
+  pl.out1 = o->out1;
+  pl.out2 = o->out2;
+  pl.work = rmdup_umi_batch;
+  pl.emit = rmdup_emit;
+  pl.arg = o;
+  pipeline_run (&pl);
+
+  fp_free (&st.buckets);
+  arena_free (&st.umis);
+  if (st.missing > 0)
+    fprintf (stderr, "Warning: %llu reads had no UMI of at most %d bases at "
+             "the end of the read ID and were kept.\n", st.missing,
+             RMDUP_MAX_UMI);
+}
+
+/* Move the UMI of each read, or pair, of a batch into its ID if it is
+   in its first bases, and lay the records out as rmdup_batch does--
+   under the fingerprint of the read prefixes */
+
+static void
+rmdup_umi_batch (ngs_params *p, void *arg, fq_batch *in1, fq_batch *in2,
+                 fq_buf *out1, fq_buf *out2)
+{
+  size_t i = 0;
+  size_t cut = 0;
+  size_t len = 0;
+  fingerprint f;
+  fq_record r1;
+  fq_buf id;
+
+  (void) arg;
+  fq_buf_init (&id);
+  for (i = 0; i < in1->n; ++i)
+    {
+      r1 = in1->rec[i];
+      cut = (p->umi_bases < (int) r1.seq_len) ? (size_t) p->umi_bases :
+        r1.seq_len;
+      r1.seq += cut;
+      r1.seq_len -= cut;
+      if (r1.qual_len >= cut)
+        {
+          r1.qual += cut;
+          r1.qual_len -= cut;
+        }
+
+      fp_start (&f);
+      len = (r1.seq_len < RMDUP_UMI_PREFIX) ? r1.seq_len : RMDUP_UMI_PREFIX;
+      fp_hash (&f, r1.seq, len);
+      if (in2 != NULL)
+        {
+          len = (in2->rec[i].seq_len < RMDUP_UMI_PREFIX) ?
+            in2->rec[i].seq_len : RMDUP_UMI_PREFIX;
+          fp_hash (&f, in2->rec[i].seq, len);
+        }
+
+      rmdup_umi_move (out1, &f, &r1, in1->rec[i].seq, cut, &id);
+      if (in2 != NULL)
+        rmdup_umi_move (out2, NULL, &in2->rec[i], in1->rec[i].seq, cut,
+                        &id);
+    }
+  fq_buf_free (&id);
+}
+
+/* Append a record as rmdup_put does, with the len bases of a UMI added
+   to the end of the first word of its ID-- id is scratch space */
+
+static void
+rmdup_umi_move (fq_buf *o, const fingerprint *f, const fq_record *rec,
+                const char *umi, size_t len, fq_buf *id)
+{
+  size_t word = 0;
+  fq_record r = *rec;
+
+  if (len == 0)
+    {
+      rmdup_put (o, f, rec);
+      return;
+    }
+  for (word = 0; (word < r.id_len) && !isspace ((unsigned char) r.id[word]);
+       ++word)
+    ;
+  id->l = 0;
+  fq_buf_put (id, r.id, word);
+  fq_buf_put (id, ":", 1);
+  fq_buf_put (id, umi, len);
+  fq_buf_put (id, r.id + word, r.id_len - word);
+  r.id = id->s;
+  r.id_len = id->l;
+  rmdup_put (o, f, &r);
+}
+
+/* Keep a read, or pair, unless its group holds a UMI within the allowed
+   mismatches of its own */
+
+static int
+rmdup_keep_umi (rmdup_out *o, const fingerprint *f, unsigned long long ord)
+{
+  size_t i = 0;
+  size_t len = 0;
+  int j = 0;
+  int mm = 0;
+  const char *umi = NULL;
+  const char *s = NULL;
+  unsigned long long *v = NULL;
+  fingerprint keys[RMDUP_MAX_UMI_MISMATCHES + 1];
+  rmdup_umi_seen *u = NULL;
+  rmdup_umi_link *l = NULL;
+  rmdup_umi_state *st = (rmdup_umi_state *) o->arg;
+
+  (void) ord;
+  if ((umi = rmdup_umi_parse (o->rec1, o->len1, &len)) == NULL)
+    {
+      ++st->missing;
+      return 1;
+    }
+
+  /* Compare the UMIs that share a segment with this one */
+  for (j = 0; j < st->nseg; ++j)
+    {
+      rmdup_umi_segment (&keys[j], f, j, st->nseg, umi, len);
+      if ((v = fp_get (&st->buckets, &keys[j])) == NULL)
+        continue;
+      for (l = (rmdup_umi_link *) (uintptr_t) *v; l != NULL; l = l->next)
+        {
+          s = (const char *) (l->umi + 1);
+          for (i = 0, mm = 0; (i < len) && (mm <= st->mismatches); ++i)
+            mm += (s[i] != umi[i]);
+          if (mm <= st->mismatches)
+            return 0;
+        }
+    }
+
+  /* A new UMI for the group, entered in the bucket of each segment */
+  u = (rmdup_umi_seen *) arena_alloc (&st->umis, sizeof (rmdup_umi_seen)
+                                      + len);
+  u->len = len;
+  memcpy (u + 1, umi, len);
+  for (j = 0; j < st->nseg; ++j)
+    {
+      l = (rmdup_umi_link *) arena_alloc (&st->umis, sizeof (rmdup_umi_link));
+      l->umi = u;
+      v = fp_get (&st->buckets, &keys[j]);
+      l->next = (v != NULL) ? (rmdup_umi_link *) (uintptr_t) *v : NULL;
+      fp_set (&st->buckets, &keys[j], (unsigned long long) (uintptr_t) l);
+    }
+
+  return 1;
+}
+
+/* Key segment j of nseg of a UMI by the fingerprint of its group, the
+   segment number, the UMI length and the bases of the segment */
+
+static void
+rmdup_umi_segment (fingerprint *k, const fingerprint *f, int j, int nseg,
+                   const char *umi, size_t len)
+{
+  size_t from = len * j / nseg;
+  size_t to = len * (j + 1) / nseg;
+  unsigned long long head[4];
+
+  head[0] = f->lo;
+  head[1] = f->hi;
+  head[2] = (unsigned long long) j;
+  head[3] = (unsigned long long) len;
+  fp_start (k);
+  fp_hash (k, (const char *) head, sizeof (head));
+  fp_hash (k, umi + from, to - from);
+}
+
+/* Return the UMI of a serialized record of n bytes and its length-- the
+   last colon-separated field of the first word of the ID-- or NULL if
+   the ID has none.  Only bases, and the + between the UMIs of two
+   reads, make a UMI, so the tile coordinate that ends an Illumina ID
+   without one is not taken for it */
+
+static const char *
+rmdup_umi_parse (const char *rec, size_t n, size_t *len)
+{
+  size_t i = 0;
+  size_t j = 0;
+  size_t word = 0;
+
+  for (word = 0; (word < n) && !isspace ((unsigned char) rec[word]); ++word)
+    ;
+  for (i = word; (i > 0) && (rec[i - 1] != ':'); --i)
+    ;
+  if ((i == 0) || (i == word) || (word - i > RMDUP_MAX_UMI))
+    return NULL;
+  *len = word - i;
+  for (j = i; j < word; ++j)
+    if ((rec[j] == '\0') || (strchr ("ACGTN+", rec[j]) == NULL))
+      return NULL;
+
+  return rec + i;
+}
@@ -17,20 +17,119 @@
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "pipeline.h"
+
+/* Convert the quality scores of a batch of records */
+
+static void
+score_batch (ngs_params * p, void *arg, fq_batch * in1, fq_batch * in2,
+	     fq_buf * out1, fq_buf * out2)
+{
+  size_t i = 0;
+  size_t j = 0;
+  char *q = NULL;
+  const int offset = (p->flag & SCORE_ILLUMINA) ? 64 : 33;
+
+  (void) arg;
+  (void) in2;
+  (void) out2;
+
+  for (i = 0; i < in1->n; ++i)
+    {
+      const fq_record *r = &in1->rec[i];
+
+      /* Copy the first three lines and make room
+         for the converted quality line */
+      fq_buf_put (out1, r->id, r->id_len);
+      fq_buf_put (out1, "\n", 1);
+      fq_buf_put (out1, r->seq, r->seq_len);
+      fq_buf_put (out1, "\n", 1);
+      fq_buf_put (out1, r->plus, r->plus_len);
+      fq_buf_put (out1, "\n", 1);
+      q = fq_buf_reserve (out1, r->qual_len + 1);
+
+      j = 0;
+      if (p->flag & SCORE_ASCII)
+	{
+	  /* Convert space-delimited numerical scores to ASCII */
+	  while (j < r->qual_len)
+	    {
+	      int score = 0;
+	      while ((j < r->qual_len) && isspace ((int) r->qual[j]))
+		++j;
+	      if (j == r->qual_len)
+		break;
+	      while ((j < r->qual_len) && isdigit ((int) r->qual[j]))
+		score = 10 * score + (r->qual[j++] - '0');
+	      if ((j < r->qual_len) && !isspace ((int) r->qual[j]))
+		{
+		  fputs ("\n\nError: the original Phred scores are "
+			 "not numerical.\n\n", stderr);
+		  abort ();
+		}
+	      if (score + offset > SCHAR_MAX)
+		{
+		  fputs ("\n\nError: the original Phred scores are "
+			 "out of range.\n\n", stderr);
+		  abort ();
+		}
+	      *q++ = score + offset;
+	    }
+	}
+      else if (p->flag & SCORE_ILLUMINA)
+	{
+	  /* Only do Sanger to Illumina conversion */
+	  while (j < r->qual_len)
+	    {
+	      int score = r->qual[j] + 31;
+	      if (score > SCHAR_MAX)
+		{
+		  fputs ("\n\nError: the original Phred scores are "
+			 "not in standard Sanger format.\n\n",
+			 stderr);
+		  exit (EXIT_FAILURE);
+		}
+	      else
+		*q++ = score;
+	      ++j;
+	    }
+	}
+      else
+	{
+	  /* Only do Illumina to Sanger conversion */
+	  while (j < r->qual_len)
+	    {
+	      int score = 0;
+	      score = r->qual[j] - 31;
+	      if ((score > SCHAR_MAX) || (score < 33))
+		{
+		  fputs ("\n\nError: the original Phred scores are "
+			 "not in Illumina format.\n\n", stderr);
+		  abort ();
+		}
+	      else
+		*q++ = score;
+	      ++j;
+	    }
+	}
+      *q++ = '\n';
+
+      /* Numerical scores take up less room than reserved */
+      out1->l = q - out1->s;
+    }
+}
 
 int
 ngs_score (ngs_params * p)
 {
-  int i = 0;
-  size_t j = 0;
-  size_t length = 0;
-  int input_buffer_count = 0;
-  char input_buffer[BUFFSIZE][MAX_LINE_LENGTH];
-  gzFile input_fastq;
-  gzFile output_fastq;
+  ngs_pipeline pl;
+  fq_reader *input_fastq = NULL;
+  bgzf_writer *output_fastq;
 
   /* Open the fastQ input stream */
-  if ((input_fastq = gzopen (p->seqfile_name1, "rb")) == Z_NULL)
+  if ((input_fastq = fq_open (p->seqfile_name1, p->threads,
+                              p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: "
 	       "%s.\n\n", p->seqfile_name1);
@@ -38,7 +137,8 @@ ngs_score (ngs_params * p)
     }
 
   /* Open the fastQ output stream */
-  if ((output_fastq = gzopen (p->outfile_name1, "wb")) == Z_NULL)
+  if ((output_fastq = bgzf_open (p->outfile_name1, p->output_format,
+				 p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the output fastQ file: "
 	       "%s.\n", p->outfile_name1);
@@ -49,115 +149,19 @@ ngs_score (ngs_params * p)
   signal (SIGINT, INThandler);
 
   /* Read through fastQ input sequence file */
-  while (1)
-    {
-      input_buffer_count = 0;
-
-      /* Fill up the input buffer */
-      while (input_buffer_count < BUFFSIZE)
-	{
-	  if (gzgets (input_fastq, input_buffer[input_buffer_count],
-		      MAX_LINE_LENGTH) == Z_NULL)
-	    break;
-	  ++input_buffer_count;
-	}
-
-      /* Dump the buffer to the output stream */
-      for (i = 0; i < input_buffer_count; ++i)
-	{
-	  if (i % 4 == 3)
-	    {
-	      j = 0;
-	      length = strlen (input_buffer[i]) - 1;
-	      if (p->flag & SCORE_ILLUMINA)
-		{
-		  /* Only do Sanger to Illumina conversion */
-		  while (j < length)
-		    {
-		      int score = input_buffer[i][j] + 31;
-		      if (score > SCHAR_MAX)
-			{
-			  fputs ("\n\nError: the original Phred scores are "
-				 "not in standard Sanger format.\n\n",
-				 stderr);
-			  exit (EXIT_FAILURE);
-			}
-		      else
-			gzputc (output_fastq, score);
-		      ++j;
-		    }
-		  gzputc (output_fastq, '\n');
-
-		  if (p->flag & SCORE_ASCII)
-		    {
-		      /* Do both numerical and Sanger to Illumina
-		         conversion here */
-		      const char delim = ' ';
-		      char *tok = NULL;
-		      int score = 0;
-		      tok = strtok (input_buffer[i], &delim);
-		      score = atoi (tok);
-		      gzputc (output_fastq, score);
-		      while (tok != NULL)
-			{
-			  tok = strtok (NULL, &delim);
-			  score = atoi (tok);
-			  gzputc (output_fastq, score + 31);
-			}
-		      gzputc (output_fastq, '\n');
-		    }
-		}
-	      else
-		{
-		  /* Only do Illumina to Sanger conversion */
-		  while (j < length)
-		    {
-		      int score = 0;
-		      score = input_buffer[i][j] - 31;
-		      if ((score > SCHAR_MAX) || (score < 33))
-			{
-			  fputs ("\n\nError: the original Phred scores are "
-				 "not in Illumina format.\n\n", stderr);
-			  abort ();
-			}
-		      else
-			gzputc (output_fastq, input_buffer[i][j] - 31);
-		      ++j;
-		    }
-		  gzputc (output_fastq, '\n');
-
-		  if (p->flag & SCORE_ASCII)
-		    {
-		      /* Do both numerical and Illumina to Sanger
-		         conversion here */
-		      const char delim = ' ';
-		      char *tok = NULL;
-		      int score = 0;
-		      tok = strtok (input_buffer[i], &delim);
-		      score = atoi (tok);
-		      gzputc (output_fastq, score);
-		      while (tok != NULL)
-			{
-			  tok = strtok (NULL, &delim);
-			  score = atoi (tok);
-			  gzputc (output_fastq, score - 31);
-			}
-		      gzputc (output_fastq, '\n');
-		    }
-		}
-	    }
-	  else
-	    gzputs (output_fastq, input_buffer[i]);
-	}
-
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-	break;
-    }
+  pl.p = p;
+  pl.in1 = input_fastq;
+  pl.in2 = NULL;
+  pl.out1 = output_fastq;
+  pl.out2 = NULL;
+  pl.work = score_batch;
+  pl.emit = NULL;
+  pl.arg = NULL;
+  pipeline_run (&pl);
 
   /* Close the fastQ input and output streams */
-  gzclose (input_fastq);
-  gzclose (output_fastq);
+  fq_close (input_fastq);
+  bgzf_close (output_fastq);
 
   return 0;
 }
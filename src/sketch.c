@@ -0,0 +1,264 @@
+/* sketch - Fixed-size sketches of k-mer streams
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <math.h>
+
+#include "ngscmd.h"
+#include "sketch.h"
+
+/* Clear a HyperLogLog sketch */
+
+void
+hll_init (hll_sketch *h)
+{
+  memset (h->reg, 0, HLL_SIZE);
+}
+
+/* Fold the registers of src into dst-- the union of the two streams */
+
+void
+hll_merge (hll_sketch *dst, const hll_sketch *src)
+{
+  size_t i = 0;
+
+  for (i = 0; i < HLL_SIZE; ++i)
+    if (src->reg[i] > dst->reg[i])
+      dst->reg[i] = src->reg[i];
+}
+
+/* Estimate the number of distinct hashes added-- the harmonic mean of
+   the registers, switching to linear counting of the empty registers
+   while the estimate is small */
+
+double
+hll_estimate (const hll_sketch *h)
+{
+  size_t i = 0;
+  size_t zeros = 0;
+  double m = HLL_SIZE;
+  double sum = 0.0;
+  double est = 0.0;
+
+  for (i = 0; i < HLL_SIZE; ++i)
+    {
+      sum += ldexp (1.0, -h->reg[i]);
+      zeros += (h->reg[i] == 0);
+    }
+  est = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+  if ((est <= 2.5 * m) && (zeros > 0))
+    est = m * log (m / (double) zeros);
+
+  return est;
+}
+
+/* Allocate a zeroed count-min sketch in mem bytes */
+
+void
+cm_init (cm_sketch *c, size_t mem)
+{
+  c->width = 1;
+  while (c->width * 2 * CM_DEPTH * sizeof (unsigned int) <= mem)
+    c->width <<= 1;
+  if ((c->cells = (unsigned int *) calloc (c->width * CM_DEPTH,
+                                           sizeof (unsigned int))) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for count-min "
+             "sketch.\n\n", stderr);
+      abort ();
+    }
+}
+
+/* Count one occurrence of a hash and return its count so far-- with
+   a conservative update, only the row counters at the current minimum
+   are bumped, which keeps collisions from inflating the counts of rare
+   hashes.  Counters are bumped by compare-and-swap, so threads may
+   share a sketch.  Rows are indexed by double hashing the two halves
+   of the hash */
+
+unsigned int
+cm_sync_add (cm_sketch *c, unsigned long long x)
+{
+  int i = 0;
+  unsigned int n = 0;
+  unsigned int min = ~0U;
+  size_t mask = c->width - 1;
+  unsigned long long h1 = x & 0xffffffffULL;
+  unsigned long long h2 = (x >> 32) | 1;
+  unsigned int *cell[CM_DEPTH];
+
+  for (i = 0; i < CM_DEPTH; ++i)
+    {
+      cell[i] = &c->cells[i * c->width + ((h1 + i * h2) & mask)];
+      if ((n = __atomic_load_n (cell[i], __ATOMIC_RELAXED)) < min)
+        min = n;
+    }
+  if (min == ~0U)
+    return min;
+
+  for (i = 0; i < CM_DEPTH; ++i)
+    {
+      n = min;
+      while ((n <= min) &&
+             !__atomic_compare_exchange_n (cell[i], &n, min + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    }
+
+  return min + 1;
+}
+
+/* Return the fraction of counters in use-- the chance that a hash not
+   yet added already looks counted in a row */
+
+double
+cm_fill (const cm_sketch *c)
+{
+  size_t i = 0;
+  size_t used = 0;
+
+  for (i = 0; i < c->width * CM_DEPTH; ++i)
+    used += (c->cells[i] != 0);
+
+  return (double) used / (double) (c->width * CM_DEPTH);
+}
+
+/* Free the counters of a count-min sketch */
+
+void
+cm_free (cm_sketch *c)
+{
+  free (c->cells);
+  memset (c, 0, sizeof (cm_sketch));
+}
+
+/* Allocate an empty Bloom filter of at most mem bytes, and at least
+   one block */
+
+void
+bf_init (bloom_filter *b, size_t mem)
+{
+  b->nblocks = 1;
+  while ((b->nblocks * 2 * BF_WORDS * sizeof (unsigned long long) <= mem) &&
+         (b->nblocks < BF_MAX_BLOCKS))
+    b->nblocks <<= 1;
+  if ((b->words = (unsigned long long *)
+       calloc (b->nblocks * BF_WORDS, sizeof (unsigned long long))) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for Bloom filter.\n\n",
+             stderr);
+      abort ();
+    }
+}
+
+/* Free the bits of a Bloom filter */
+
+void
+bf_free (bloom_filter *b)
+{
+  free (b->words);
+  memset (b, 0, sizeof (bloom_filter));
+}
+
+/* Allocate an empty cuckoo filter of at most mem bytes, and at least
+   one bucket */
+
+void
+cf_init (cuckoo_filter *c, size_t mem)
+{
+  memset (c, 0, sizeof (cuckoo_filter));
+  c->nbuckets = 1;
+  while ((c->nbuckets * 2 * CF_SLOTS * sizeof (unsigned short) <= mem) &&
+         (c->nbuckets < CF_MAX_BUCKETS))
+    c->nbuckets <<= 1;
+  if ((c->tags = (unsigned short *)
+       calloc (c->nbuckets * CF_SLOTS, sizeof (unsigned short))) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for cuckoo filter.\n\n",
+             stderr);
+      abort ();
+    }
+  c->rng = 0x9e3779b97f4a7c15ULL;
+}
+
+/* Add a 64-bit hash to a cuckoo filter-- the top CF_TAG_BITS bits are
+   its tag and the low bits its first bucket.  Returns 1, and adds
+   nothing, if the tag is in either bucket already */
+
+int
+cf_add (cuckoo_filter *c, unsigned long long x)
+{
+  int j = 0;
+  int kick = 0;
+  size_t mask = c->nbuckets - 1;
+  size_t i1 = (size_t) x & mask;
+  size_t i2 = 0;
+  unsigned short tag = (unsigned short) (x >> (64 - CF_TAG_BITS));
+  unsigned short t = 0;
+  unsigned short *b1 = NULL;
+  unsigned short *b2 = NULL;
+
+  if (tag == 0)
+    tag = 1;
+  i2 = (i1 ^ (size_t) (tag * 0x5bd1e995ULL)) & mask;
+  b1 = c->tags + i1 * CF_SLOTS;
+  b2 = c->tags + i2 * CF_SLOTS;
+  for (j = 0; j < CF_SLOTS; ++j)
+    if ((b1[j] == tag) || (b2[j] == tag))
+      return 1;
+
+  /* Take an empty slot of either bucket, or move a random tag of the
+     first to its other bucket, and so on */
+  ++c->n;
+  for (kick = 0; kick < CF_MAX_KICKS; ++kick)
+    {
+      for (j = 0; j < CF_SLOTS; ++j)
+        if (b1[j] == 0)
+          {
+            b1[j] = tag;
+            return 0;
+          }
+      for (j = 0; j < CF_SLOTS; ++j)
+        if (b2[j] == 0)
+          {
+            b2[j] = tag;
+            return 0;
+          }
+      c->rng ^= c->rng << 13;
+      c->rng ^= c->rng >> 7;
+      c->rng ^= c->rng << 17;
+      j = (int) (c->rng >> 62) % CF_SLOTS;
+      t = b1[j];
+      b1[j] = tag;
+      tag = t;
+      i1 = (i1 ^ (size_t) (tag * 0x5bd1e995ULL)) & mask;
+      b1 = c->tags + i1 * CF_SLOTS;
+      b2 = b1;
+    }
+
+  --c->n;
+  ++c->dropped;
+
+  return 0;
+}
+
+/* Free the tags of a cuckoo filter */
+
+void
+cf_free (cuckoo_filter *c)
+{
+  free (c->tags);
+  memset (c, 0, sizeof (cuckoo_filter));
+}
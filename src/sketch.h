@@ -0,0 +1,178 @@
+/* sketch - Fixed-size sketches of k-mer streams
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Define constants */
+#define HLL_BITS 14             /* register index bits-- 16K registers */
+#define HLL_SIZE (1 << HLL_BITS)
+#define CM_DEPTH 4              /* rows of a count-min sketch */
+#define CM_MEM 4                /* default MB of a count-min sketch */
+#define CM_MAX_FILL 0.3         /* fill past which counts are unreliable */
+#define BF_WORDS 8              /* words in a Bloom block-- one cache line */
+#define BF_HASHES 4             /* bits set in a block per hash */
+#define BF_MAX_BLOCKS (1ULL << 28)  /* blocks addressable by a hash */
+#define BF_MEM 256              /* default MB of a Bloom filter */
+#define CF_SLOTS 4              /* tags in a cuckoo bucket */
+#define CF_TAG_BITS 16
+#define CF_MAX_BUCKETS (1ULL << 40)  /* buckets addressable by a hash */
+#define CF_MAX_KICKS 500        /* relocations before a tag is dropped */
+#define CF_MEM 256              /* default MB of a cuckoo filter */
+
+  /* A HyperLogLog sketch-- each register keeps the longest run of
+     leading zeros seen among the hashes routed to it, for a standard
+     error of about 1.04 / sqrt(HLL_SIZE), or 0.8% */
+  typedef struct _hll_sketch
+  {
+    unsigned char reg[HLL_SIZE];
+  } hll_sketch;
+
+  /* A count-min sketch of CM_DEPTH rows of width counters-- the
+     smallest of the counters a hash maps to bounds its count from
+     above, and may be shared between threads */
+  typedef struct _cm_sketch
+  {
+    unsigned int *cells;
+    size_t width;        /* counters in a row, a power of two */
+  } cm_sketch;
+
+  /* A blocked Bloom filter-- all the bits of a hash fall in one block
+     of BF_WORDS words, so a test costs a single cache miss */
+  typedef struct _bloom_filter
+  {
+    unsigned long long *words;
+    size_t nblocks;      /* a power of two */
+  } bloom_filter;
+
+  /* A cuckoo filter of 16-bit tags, CF_SLOTS to a bucket-- a tag lives
+     in one of two buckets, the second found from the first and the tag
+     alone, so tags can be moved to make room without their hashes.  A
+     tag still homeless after CF_MAX_KICKS moves is dropped, which may
+     hide a later copy but never reports a false one */
+  typedef struct _cuckoo_filter
+  {
+    unsigned short *tags;  /* zero marks an empty slot */
+    size_t nbuckets;     /* a power of two */
+    size_t n;            /* number of tags held */
+    unsigned long long dropped;
+    unsigned long long rng;  /* picks the tag to move */
+  } cuckoo_filter;
+
+
+/* Inline functions */
+
+/* Add a 64-bit hash to a HyperLogLog sketch */
+  static inline void
+  hll_add (hll_sketch *h, unsigned long long x)
+  {
+    unsigned char rank = 0;
+    unsigned long long rest = (x << HLL_BITS) | (1ULL << (HLL_BITS - 1));
+
+    rank = (unsigned char) (__builtin_clzll (rest) + 1);
+    if (rank > h->reg[x >> (64 - HLL_BITS)])
+      h->reg[x >> (64 - HLL_BITS)] = rank;
+  }
+
+/* Set the bits of a 64-bit hash in a Bloom filter-- the low 36 bits
+   pick BF_HASHES bits of a block and the next 28 the block.  Returns
+   1 if all of them were set already */
+  static inline int
+  bf_add (bloom_filter *b, unsigned long long x)
+  {
+    int i = 0;
+    int seen = 1;
+    unsigned int bit = 0;
+    unsigned long long m = 0;
+    unsigned long long *blk = b->words + ((x >> 36) & (b->nblocks - 1))
+      * BF_WORDS;
+
+    for (i = 0; i < BF_HASHES; ++i)
+      {
+        bit = (unsigned int) (x >> (9 * i)) & (BF_WORDS * 64 - 1);
+        m = 1ULL << (bit & 63);
+        if ((blk[bit >> 6] & m) == 0)
+          {
+            blk[bit >> 6] |= m;
+            seen = 0;
+          }
+      }
+
+    return seen;
+  }
+
+/* Set the bits of a hash in a Bloom filter shared between threads */
+  static inline int
+  bf_sync_add (bloom_filter *b, unsigned long long x)
+  {
+    int i = 0;
+    int seen = 1;
+    unsigned int bit = 0;
+    unsigned long long m = 0;
+    unsigned long long *blk = b->words + ((x >> 36) & (b->nblocks - 1))
+      * BF_WORDS;
+
+    for (i = 0; i < BF_HASHES; ++i)
+      {
+        bit = (unsigned int) (x >> (9 * i)) & (BF_WORDS * 64 - 1);
+        m = 1ULL << (bit & 63);
+        if ((__atomic_load_n (&blk[bit >> 6], __ATOMIC_RELAXED) & m) == 0 &&
+            (__atomic_fetch_or (&blk[bit >> 6], m, __ATOMIC_RELAXED) & m)
+            == 0)
+          seen = 0;
+      }
+
+    return seen;
+  }
+
+
+/* Return the chance that a hash new to a cuckoo filter is taken for
+   one already in it-- each of the tags of its two buckets matches its
+   own with a chance of 1 in 2^16 - 1 */
+  static inline double
+  cf_false_rate (const cuckoo_filter *c)
+  {
+    return 2.0 * (double) c->n / (double) c->nbuckets
+      / (double) ((1 << CF_TAG_BITS) - 1);
+  }
+
+
+/* Function prototypes */
+  extern void hll_init (hll_sketch *);
+  extern void hll_merge (hll_sketch *, const hll_sketch *);
+  extern double hll_estimate (const hll_sketch *);
+  extern void cm_init (cm_sketch *, size_t);
+  extern unsigned int cm_sync_add (cm_sketch *, unsigned long long);
+  extern double cm_fill (const cm_sketch *);
+  extern void cm_free (cm_sketch *);
+  extern void bf_init (bloom_filter *, size_t);
+  extern void bf_free (bloom_filter *);
+  extern void cf_init (cuckoo_filter *, size_t);
+  extern int cf_add (cuckoo_filter *, unsigned long long);
+  extern void cf_free (cuckoo_filter *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* SKETCH_H */
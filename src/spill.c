@@ -0,0 +1,104 @@
+/* spill - Anonymous temporary files for data that outgrows memory
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "ngscmd.h"
+#include "spill.h"
+
+/* Open a temporary file under $TMPDIR, or /tmp-- the file is unlinked
+   right away, so it disappears when it is closed or the program ends */
+
+FILE *
+spill_open (void)
+{
+  int fd = 0;
+  const char *dir = getenv ("TMPDIR");
+  char *name = NULL;
+  FILE *fp = NULL;
+
+  if ((dir == NULL) || (*dir == '\0'))
+    dir = "/tmp";
+  if ((name = (char *) malloc (strlen (dir) + 16)) == NULL)
+    {
+      fputs ("\n\nError: memory allocation failure for temporary file.\n\n",
+             stderr);
+      abort ();
+    }
+  sprintf (name, "%s/ngscmd.XXXXXX", dir);
+
+  if (((fd = mkstemp (name)) < 0) || ((fp = fdopen (fd, "w+b")) == NULL))
+    {
+      fprintf (stderr, "\n\nError: cannot create a temporary file in: "
+               "%s.\n\n", dir);
+      abort ();
+    }
+  unlink (name);
+  free (name);
+
+  return fp;
+}
+
+/* Append len bytes to a temporary file */
+
+void
+spill_write (FILE *fp, const void *s, size_t len)
+{
+  if (fwrite (s, 1, len, fp) != len)
+    {
+      fputs ("\n\nError: cannot write to a temporary file.\n\n", stderr);
+      abort ();
+    }
+}
+
+/* Read len bytes from a temporary file */
+
+void
+spill_read (FILE *fp, void *s, size_t len)
+{
+  if (fread (s, 1, len, fp) != len)
+    {
+      fputs ("\n\nError: cannot read from a temporary file.\n\n", stderr);
+      abort ();
+    }
+}
+
+/* Read len bytes at offset off of a temporary file without moving its
+   position, so threads can read one file at once-- the file has to be
+   flushed after the last write */
+
+void
+spill_pread (FILE *fp, void *s, size_t len, unsigned long long off)
+{
+  size_t got = 0;
+  ssize_t ret = 0;
+
+  while (got < len)
+    {
+      ret = pread (fileno (fp), (char *) s + got, len - got,
+                   (off_t) (off + got));
+      if ((ret < 0) && (errno == EINTR))
+        continue;
+      if (ret <= 0)
+        {
+          fputs ("\n\nError: cannot read from a temporary file.\n\n",
+                 stderr);
+          abort ();
+        }
+      got += (size_t) ret;
+    }
+}
@@ -0,0 +1,38 @@
+/* spill - Anonymous temporary files for data that outgrows memory
+   Copyright (C) 2014 Laboratory for Comparative Population Genomics
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* Function prototypes */
+  extern FILE *spill_open (void);
+  extern void spill_write (FILE *, const void *, size_t);
+  extern void spill_read (FILE *, void *, size_t);
+  extern void spill_pread (FILE *, void *, size_t, unsigned long long);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif          /* SPILL_H */
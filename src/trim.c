@@ -17,24 +17,66 @@
 /* Written by Daniel Garrigan, dgarriga@lcpg.org */
 
 #include "ngscmd.h"
+#include "bgzf.h"
+#include "pipeline.h"
 
-int
-ngs_trim (ngs_params * p)
+/* Trim the low quality ends of a batch of reads */
+
+static void
+trim_batch (ngs_params * p, void *arg, fq_batch * in1, fq_batch * in2,
+	    fq_buf * out1, fq_buf * out2)
 {
-  int i = 0;
+  size_t i = 0;
   int s = 0;
   int max = 0;
-  int max_length = 0;
+  size_t max_length = 0;
   size_t j = 0;
   size_t length = 0;
-  int input_buffer_count = 0;
-  char input_buffer[BUFFSIZE][MAX_LINE_LENGTH];
-  gzFile input_fastq;
-  gzFile output_fastq;
+
+  (void) arg;
+  (void) in2;
+  (void) out2;
+
+  /* Trim the ends of the read according to
+     argmax_x{\sum_{i=x+1}^l(INT-q_i)} */
+  for (i = 0; i < in1->n; ++i)
+    {
+      fq_record *r = &in1->rec[i];
+
+      s = 0;
+      max = 0;
+      length = r->qual_len;
+      max_length = length;
+
+      for (j = length; j-- > (size_t) (p->min_read_length);)
+	{
+	  s += p->trim_quality - (r->qual[j] - 33);
+	  if (s < 0)
+	    break;
+	  if (s > max)
+	    {
+	      max = s;
+	      max_length = j;
+	    }
+	}
+      r->qual_len = max_length;
+      if (r->seq_len > max_length)
+	r->seq_len = max_length;
+      fq_buf_record (out1, r);
+    }
+}
+
+int
+ngs_trim (ngs_params * p)
+{
+  ngs_pipeline pl;
+  fq_reader *input_fastq = NULL;
+  bgzf_writer *output_fastq;
 
 
   /* Open the fastQ input stream */
-  if ((input_fastq = gzopen (p->seqfile_name1, "rb")) == Z_NULL)
+  if ((input_fastq = fq_open (p->seqfile_name1, p->threads,
+                              p->first_record)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the input fastQ file: %s.\n\n",
 	       p->seqfile_name1);
@@ -42,7 +84,8 @@ ngs_trim (ngs_params * p)
     }
 
   /* Open the fastQ output stream */
-  if ((output_fastq = gzopen (p->outfile_name1, "wb")) == Z_NULL)
+  if ((output_fastq = bgzf_open (p->outfile_name1, p->output_format,
+				 p->compress_level, p->threads)) == NULL)
     {
       fprintf (stderr, "\n\nError: cannot open the output fastQ file: %s.\n",
 	       p->outfile_name1);
@@ -52,68 +95,20 @@ ngs_trim (ngs_params * p)
   /* Set up interrupt trap */
   signal (SIGINT, INThandler);
 
-
   /* Read through fastQ input sequence file */
-  while (1)
-    {
-      /* Initialize counter for the number of lines in the buffer */
-      input_buffer_count = 0;
-
-      /* Fill up the buffer */
-      while (input_buffer_count < BUFFSIZE)
-	{
-	  /* get line from the fastQ input stream */
-	  if (gzgets
-	      (input_fastq, input_buffer[input_buffer_count],
-	       MAX_LINE_LENGTH) == Z_NULL)
-	    break;
-
-	  /* Iterate the counter for the number of lines
-	     currently in the input buffer */
-	  ++input_buffer_count;
-	}
-
-      /* Trim the ends of the read according to
-         argmax_x{\sum_{i=x+1}^l(INT-q_i)} */
-      for (i = 0; i < input_buffer_count; ++i)
-	{
-	  if (i % 4 == 3)
-	    {
-	      s = 0;
-	      max = 0;
-	      length = strlen (input_buffer[i]) - 1;
-	      max_length = length;
-
-	      for (j = length - 1; j >= (size_t) (p->min_read_length); --j)
-		{
-		  s += p->trim_quality - (input_buffer[i][j] - 33);
-		  if (s < 0)
-		    break;
-		  if (s > max)
-		    {
-		      max = s;
-		      max_length = j;
-		    }
-		}
-	      input_buffer[i][max_length] = '\n';
-	      input_buffer[i][max_length + 1] = '\0';
-	      input_buffer[i - 2][max_length] = '\n';
-	      input_buffer[i - 2][max_length + 1] = '\0';
-	      gzputs (output_fastq, input_buffer[i - 3]);
-	      gzputs (output_fastq, input_buffer[i - 2]);
-	      gzputs (output_fastq, input_buffer[i - 1]);
-	      gzputs (output_fastq, input_buffer[i]);
-	    }
-	}
-
-      /* If we are at the end of the file */
-      if (input_buffer_count < BUFFSIZE)
-	break;
-    }
+  pl.p = p;
+  pl.in1 = input_fastq;
+  pl.in2 = NULL;
+  pl.out1 = output_fastq;
+  pl.out2 = NULL;
+  pl.work = trim_batch;
+  pl.emit = NULL;
+  pl.arg = NULL;
+  pipeline_run (&pl);
 
   /* Close the fastQ input and output streams */
-  gzclose (input_fastq);
-  gzclose (output_fastq);
+  fq_close (input_fastq);
+  bgzf_close (output_fastq);
 
   return 0;
 }